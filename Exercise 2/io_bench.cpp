@@ -0,0 +1,402 @@
+// OS 24 EX2
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdlib>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <iostream>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "uthreads.h"
+#include "uthread_io.h"
+
+#define BENCH_QUANTUM_USECS 10000
+#define BENCH_STACK_SIZE 65536
+#define MN_WORKERS 2
+// connections are costlier than messages, they get fewer rounds.
+#define ACCEPT_ROUNDS_DIVISOR 10
+
+enum benchmark
+{
+  PIPE, SOCKETPAIR, ACCEPT, CANCEL_WAIT
+};
+const char *benchmark_names[] = {"pipe", "socketpair", "accept",
+                                 "cancel_wait"};
+
+enum implementation
+{
+  UTHREAD, UTHREAD_MN, PTHREAD
+};
+const char *implementation_names[] = {"uthread", "uthread_mn", "pthread"};
+
+long rounds;
+benchmark measured;
+implementation used;
+
+// the file descriptors of the measurement, only one is in use per process.
+// side i reads from read_fds[i] and writes to write_fds[i].
+int read_fds[2];
+int write_fds[2];
+struct sockaddr_un listen_addr;
+socklen_t listen_addr_len;
+int listen_fd;
+volatile bool reader_started;
+
+/**
+ * Reads the monotonic clock.
+ * @return - the current time in nano-seconds.
+ */
+uint64_t now_ns ()
+{
+  struct timespec t;
+  clock_gettime (CLOCK_MONOTONIC, &t);
+  return (uint64_t) t.tv_sec * 1000000000ULL + (uint64_t) t.tv_nsec;
+}
+
+/**
+ * Reads or writes a single byte with the calls of the measured implementation,
+ * exiting on failure.
+ */
+void read_byte (int fd)
+{
+  char byte;
+  ssize_t ret = used == PTHREAD ? read (fd, &byte, 1)
+                                : uthread_read (fd, &byte, 1);
+  if (ret != 1)
+  {
+    perror ("read");
+    exit (1);
+  }
+}
+
+void write_byte (int fd)
+{
+  char byte = 0;
+  ssize_t ret = used == PTHREAD ? write (fd, &byte, 1)
+                                : uthread_write (fd, &byte, 1);
+  if (ret != 1)
+  {
+    perror ("write");
+    exit (1);
+  }
+}
+
+/**
+ * Plays one side of the byte ping-pong over a pipe or a socketpair, rounds
+ * times.
+ * @param side - 0 for the side that serves, 1 for the other one.
+ */
+void play_side (int side)
+{
+  for (long i = 0; i < rounds; i++)
+  {
+    if (side == 0)
+    {
+      write_byte (write_fds[0]);
+      read_byte (read_fds[0]);
+    }
+    else
+    {
+      read_byte (read_fds[1]);
+      write_byte (write_fds[1]);
+    }
+  }
+}
+
+/**
+ * Accepts rounds connections, answering each with a byte.
+ */
+void accept_side ()
+{
+  for (long i = 0; i < rounds; i++)
+  {
+    int fd = used == PTHREAD ? accept (listen_fd, nullptr, nullptr)
+                             : uthread_accept (listen_fd, nullptr, nullptr);
+    if (fd < 0)
+    {
+      perror ("accept");
+      exit (1);
+    }
+    write_byte (fd);
+    close (fd);
+  }
+}
+
+/**
+ * Opens rounds connections, waiting for the byte that answers each.
+ */
+void connect_side ()
+{
+  for (long i = 0; i < rounds; i++)
+  {
+    int fd = socket (AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0 || connect (fd, (struct sockaddr *) &listen_addr,
+                           listen_addr_len) < 0)
+    {
+      perror ("connect");
+      exit (1);
+    }
+    read_byte (fd);
+    close (fd);
+  }
+}
+
+/**
+ * Entry point of the uthread that plays the other side.
+ */
+void uthread_other ()
+{
+  if (measured == ACCEPT)
+  {
+    accept_side ();
+  }
+  else
+  {
+    play_side (1);
+  }
+  uthread_terminate (uthread_get_tid ());
+}
+
+/**
+ * Entry point of the uthreads that wait on an empty pipe until terminated.
+ */
+void uthread_reader ()
+{
+  reader_started = true;
+  read_byte (read_fds[0]);
+  std::cerr << "a reader of the empty pipe woke up." << std::endl;
+  exit (1);
+}
+
+/**
+ * Entry point of the pthread that plays the other side, see uthread_other.
+ */
+void *pthread_other (void *)
+{
+  if (measured == ACCEPT)
+  {
+    accept_side ();
+  }
+  else
+  {
+    play_side (1);
+  }
+  return nullptr;
+}
+
+/**
+ * Creates the file descriptors the measured benchmark uses, exiting on
+ * failure.
+ */
+void open_fds ()
+{
+  int fds[2];
+  switch (measured)
+  {
+    case PIPE:
+    case CANCEL_WAIT:
+      if (pipe (fds) < 0)
+      {
+        break;
+      }
+      read_fds[1] = fds[0];
+      write_fds[0] = fds[1];
+      if (pipe (fds) < 0)
+      {
+        break;
+      }
+      read_fds[0] = fds[0];
+      write_fds[1] = fds[1];
+      return;
+    case SOCKETPAIR:
+      if (socketpair (AF_UNIX, SOCK_STREAM, 0, fds) < 0)
+      {
+        break;
+      }
+      read_fds[0] = write_fds[0] = fds[0];
+      read_fds[1] = write_fds[1] = fds[1];
+      return;
+    case ACCEPT:
+      // an abstract address, which leaves no file behind.
+      listen_addr = {};
+      listen_addr.sun_family = AF_UNIX;
+      snprintf (listen_addr.sun_path + 1, sizeof (listen_addr.sun_path) - 1,
+                "io_bench.%d", (int) getpid ());
+      listen_addr_len = (socklen_t) (offsetof (struct sockaddr_un, sun_path) + 1
+                                     + strlen (listen_addr.sun_path + 1));
+      listen_fd = socket (AF_UNIX, SOCK_STREAM, 0);
+      if (listen_fd < 0
+          || bind (listen_fd, (struct sockaddr *) &listen_addr,
+                   listen_addr_len) < 0
+          || listen (listen_fd, SOMAXCONN) < 0)
+      {
+        break;
+      }
+      return;
+  }
+  perror ("open_fds");
+  exit (1);
+}
+
+/**
+ * Runs the side of the benchmark that the main thread plays.
+ */
+void run_main_side ()
+{
+  if (measured == ACCEPT)
+  {
+    connect_side ();
+  }
+  else
+  {
+    play_side (0);
+  }
+}
+
+/**
+ * Spawns a thread that parks reading an empty pipe and terminates it, rounds
+ * times.
+ */
+void cancel_waits ()
+{
+  for (long i = 0; i < rounds; i++)
+  {
+    reader_started = false;
+    int tid = uthread_spawn (uthread_reader);
+    if (tid < 0)
+    {
+      exit (1);
+    }
+    while (!reader_started)
+    {
+      uthread_yield ();
+    }
+    uthread_yield ();
+    if (uthread_terminate (tid) != 0)
+    {
+      exit (1);
+    }
+  }
+}
+
+/**
+ * Measures the benchmark with one implementation and prints the average cost
+ * of one round.
+ * @param impl - the threads and calls to use.
+ * @param bench - what to measure.
+ */
+void run_bench (implementation impl, benchmark bench)
+{
+  measured = bench;
+  used = impl;
+  if (bench == ACCEPT)
+  {
+    rounds = std::max (rounds / ACCEPT_ROUNDS_DIVISOR, 1L);
+  }
+  open_fds ();
+  uint64_t start, end;
+  if (impl == PTHREAD)
+  {
+    pthread_t other;
+    start = now_ns ();
+    pthread_create (&other, nullptr, pthread_other, nullptr);
+    run_main_side ();
+    pthread_join (other, nullptr);
+    end = now_ns ();
+  }
+  else
+  {
+    uthread_config config = {BENCH_QUANTUM_USECS, 2, BENCH_STACK_SIZE,
+                             UTHREAD_POLICY_RR, 0,
+                             impl == UTHREAD_MN ? MN_WORKERS : 1};
+    if (uthread_init_config (&config) != 0)
+    {
+      exit (1);
+    }
+    start = now_ns ();
+    if (bench == CANCEL_WAIT)
+    {
+      cancel_waits ();
+    }
+    else
+    {
+      if (uthread_spawn (uthread_other) < 0)
+      {
+        exit (1);
+      }
+      run_main_side ();
+    }
+    end = now_ns ();
+  }
+  std::cout << benchmark_names[bench] << "," << implementation_names[impl]
+            << "," << (double) (end - start) / rounds << std::endl;
+  if (impl == PTHREAD)
+  {
+    exit (0);
+  }
+  uthread_terminate (0);
+}
+
+/**
+ * Measures blocking I/O between two threads: a byte ping-pong over two pipes
+ * and over a socketpair, where both sides park in uthread_read on every
+ * round, and a connection per round through uthread_accept on a unix socket.
+ * The cancel_wait row spawns a thread that parks reading an empty pipe and
+ * terminates it. Each runs with uthreads in 1:1 and M:N mode, and the first
+ * three with kernel threads and plain blocking calls. Every measurement runs
+ * in its own process, since the library can only be initialized once.
+ * Usage: './io_bench [rounds]' where:
+ *      - rounds - the number of rounds per measurement (default 20000), a
+ *        tenth of that for accept.
+ * The program will print output to stdout in the following format:
+ *      benchmark,impl,ns_per_round
+ *      benchmark_1,impl_1,ns_1
+ *              ...
+ */
+int main (int argc, char *argv[])
+{
+  rounds = argc > 1 ? atol (argv[1]) : 20000;
+  if (rounds <= 0)
+  {
+    std::cerr << "rounds must be positive" << std::endl;
+    return -1;
+  }
+
+  std::cout << "benchmark,impl,ns_per_round" << std::endl;
+  for (int bench = PIPE; bench <= CANCEL_WAIT; bench++)
+  {
+    for (int impl = UTHREAD; impl <= PTHREAD; impl++)
+    {
+      // a kernel thread blocked in read cannot be terminated.
+      if (impl == PTHREAD && bench == CANCEL_WAIT)
+      {
+        continue;
+      }
+      pid_t pid = fork ();
+      if (pid < 0)
+      {
+        std::cerr << "fork failed." << std::endl;
+        return -1;
+      }
+      if (pid == 0)
+      {
+        run_bench ((implementation) impl, (benchmark) bench);
+      }
+      int status;
+      waitpid (pid, &status, 0);
+      if (!WIFEXITED (status) || WEXITSTATUS (status) != 0)
+      {
+        std::cerr << benchmark_names[bench] << " with "
+                  << implementation_names[impl] << " failed." << std::endl;
+        return -1;
+      }
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,940 @@
+#include "mn_scheduler.h"
+#include "user_thread.h"
+#include "thread_queue.h"
+#include "sleep_wheel.h"
+#include "spin_lock.h"
+#include "work_stealing_deque.h"
+#include "uthreads_internal.h"
+#include "tracer.h"
+#include "thread_stack.h"
+#include <pthread.h>
+#include <ctime>
+#include <atomic>
+#include <vector>
+#include <queue>
+#include <functional>
+#include <iostream>
+#include <climits>
+#include <algorithm>
+
+#ifndef sigev_notify_thread_id
+#define sigev_notify_thread_id _sigev_un._tid
+#endif
+
+#define SCHEDULER_STACK_SIZE 65536
+#define IDLE_YIELDS 64
+#define IDLE_SLEEP_NSECS 50000
+#define IDLE_MAX_SLEEP_NSECS 1000000
+
+/*
+ * Every worker is a kernel thread with its own run queue and its own
+ * scheduler context. A uthread gives up its worker by jumping to the worker's
+ * scheduler context while holding its own lock; the scheduler, now off the
+ * uthread's stack, publishes the uthread again (finish_switch) and releases
+ * the lock. Until then nobody else may run the uthread, since its stack is
+ * still in use.
+ *
+ * Lock order: table_lock, then sleep_lock, then any User_Thread lock. The lock
+ * of a synchronization primitive ranks above all of them.
+ */
+struct Worker
+{
+  int id;
+  pthread_t pthread;
+  timer_t timer;
+  Work_Stealing_Deque run_queue;
+  sigjmp_buf sched_env;
+  char *sched_stack;
+  // the uthread running on this worker, nullptr inside the scheduler.
+  User_Thread *cur;
+  // the uthread that just jumped to the scheduler and still holds its lock.
+  User_Thread *prev;
+  // set when prev was switched out by the end of its quantum.
+  bool preempted;
+  // counts the uthreads this worker switched to, see mn_current_thread.
+  std::atomic<unsigned int> switches;
+};
+
+// added helper funcs declarations implemented at the end.
+Worker *current_worker ();
+void mn_timer_handler (int sig);
+void *worker_start_routine (void *arg);
+void worker_0_entry ();
+void worker_loop ();
+void schedule (Worker *worker);
+void finish_switch (Worker *worker);
+User_Thread *take_thread (Worker *worker);
+void run_thread (Worker *worker, User_Thread *thread);
+void switch_out (User_Thread *thread);
+void make_runnable (User_Thread *thread);
+void wake_due_threads ();
+void skip_idle_quantums ();
+void create_worker_timer (Worker *worker);
+void arm_worker_timer (Worker *worker, bool arm);
+void kick_worker (Worker *worker);
+void park_worker (Worker *worker);
+void stop_workers_and_exit ();
+User_Thread *find_thread (int tid);
+int mn_available_tid ();
+
+Worker *workers;
+int num_workers;
+thread_local Worker *this_worker = nullptr;
+int mn_quantum_usecs;
+int mn_stack_size;
+int mn_max_threads;
+
+// guarded by table_lock.
+Spin_Lock table_lock;
+std::vector<User_Thread *> mn_threads;
+std::priority_queue<int, std::vector<int>, std::greater<int> > mn_free_tids;
+int mn_total_threads = 1;
+
+// guarded by sleep_lock. the wheel trails mn_total_quantums while another
+// worker holds the lock.
+Spin_Lock sleep_lock;
+Sleep_Wheel mn_sleep_wheel;
+
+std::atomic<int> mn_total_quantums (1);
+std::atomic<bool> stopping (false);
+std::atomic<int> parked_workers (0);
+std::atomic<int> idle_workers (0);
+
+/**
+ * Returns the worker of the calling kernel thread. uthreads migrate between
+ * kernel threads, so the thread-local must be read afresh after every switch;
+ * keeping the access out of line stops the compiler from caching its address.
+ */
+__attribute__ ((noinline)) Worker *current_worker ()
+{
+  asm volatile ("" ::: "memory");
+  return this_worker;
+}
+
+int mn_init (int num_workers_, int quantum_usecs, int max_threads,
+             int stack_size)
+{
+  num_workers = num_workers_;
+  mn_quantum_usecs = quantum_usecs;
+  mn_max_threads = max_threads;
+  mn_stack_size = stack_size;
+
+  struct sigaction sa = {0};
+  sa.sa_handler = &mn_timer_handler;
+  if (sigaction (SIGVTALRM, &sa, nullptr) < 0)
+  {
+    std::cerr << SC_SIG_ACTION_ERR << std::endl;
+    exit (1);
+  }
+
+  block_alarm_signal ();
+  workers = new Worker[num_workers];
+  for (int i = 0; i < num_workers; i++)
+  {
+    workers[i].id = i;
+    workers[i].sched_stack = nullptr;
+    workers[i].cur = nullptr;
+    workers[i].prev = nullptr;
+    workers[i].preempted = false;
+    workers[i].switches = 0;
+  }
+
+  // the calling kernel thread becomes worker 0. its own stack belongs to the
+  // main thread, so its scheduler gets a stack of its own.
+  Worker *worker = &workers[0];
+  this_worker = worker;
+  worker->pthread = pthread_self ();
+  worker->sched_stack = new char[SCHEDULER_STACK_SIZE];
+  setup_thread_context (worker->sched_env, worker->sched_stack,
+                        SCHEDULER_STACK_SIZE, worker_0_entry);
+  sigaddset (&worker->sched_env->__saved_mask, SIGVTALRM);
+  create_worker_timer (worker);
+
+  User_Thread *main_thread = new User_Thread (0, nullptr, 0);
+  main_thread->on_cpu = true;
+  main_thread->worker = worker;
+  main_thread->inc_quantums_ran ();
+  mn_threads.push_back (main_thread);
+  worker->cur = main_thread;
+  TRACE_EVENT (TRACE_SWITCH_IN, main_thread);
+
+  // the workers inherit the blocked SIGVTALRM.
+  for (int i = 1; i < num_workers; i++)
+  {
+    if (pthread_create (&workers[i].pthread, nullptr, worker_start_routine,
+                        &workers[i]) != 0)
+    {
+      std::cerr << SC_PTHREAD_CREATE_ERR << std::endl;
+      exit (1);
+    }
+  }
+  arm_worker_timer (worker, true);
+  unblock_alarm_signal ();
+  return SUCCESS;
+}
+
+void mn_timer_handler (int sig)
+{
+  Worker *worker = current_worker ();
+  User_Thread *thread = worker->cur;
+  if (thread == nullptr)
+  {
+    return;
+  }
+  if (thread->preempt_deferred)
+  {
+    thread->preempt_pending = true;
+    return;
+  }
+  thread->lock.lock ();
+  worker->preempted = true;
+  switch_out (thread);
+}
+
+void *worker_start_routine (void *arg)
+{
+  auto *worker = static_cast<Worker *>(arg);
+  this_worker = worker;
+  create_worker_timer (worker);
+  install_overflow_stack ();
+  worker_loop ();
+  return nullptr;
+}
+
+void worker_0_entry ()
+{
+  worker_loop ();
+}
+
+void worker_loop ()
+{
+  block_alarm_signal ();
+  sigsetjmp (current_worker ()->sched_env, 1);
+  // every uthread that gives up this worker lands here.
+  schedule (current_worker ());
+}
+
+void schedule (Worker *worker)
+{
+  finish_switch (worker);
+  int idle_rounds = 0;
+  long idle_nsecs = IDLE_SLEEP_NSECS;
+  for (;;)
+  {
+    if (stopping.load ())
+    {
+      park_worker (worker);
+    }
+    if (io_pending ())
+    {
+      poll_io (0);
+    }
+    User_Thread *next = take_thread (worker);
+    if (next != nullptr)
+    {
+      if (idle_rounds > 0)
+      {
+        idle_workers--;
+      }
+      run_thread (worker, next);
+    }
+    if (idle_rounds++ == 0)
+    {
+      arm_worker_timer (worker, false);
+      idle_workers++;
+    }
+    if (idle_workers.load () == num_workers)
+    {
+      skip_idle_quantums ();
+    }
+    // back off from yielding to sleeping longer and longer.
+    if (idle_rounds < IDLE_YIELDS)
+    {
+      sched_yield ();
+    }
+    else
+    {
+      struct timespec idle = {0, idle_nsecs};
+      nanosleep (&idle, nullptr);
+      idle_nsecs = std::min (idle_nsecs * 2, (long) IDLE_MAX_SLEEP_NSECS);
+    }
+  }
+}
+
+void finish_switch (Worker *worker)
+{
+  User_Thread *thread = worker->prev;
+  if (thread != nullptr)
+  {
+    TRACE_EVENT (worker->preempted ? TRACE_PREEMPT : TRACE_SWITCH_OUT, thread);
+  }
+  worker->prev = nullptr;
+  worker->cur = nullptr;
+  worker->preempted = false;
+  if (thread == nullptr)
+  {
+    return;
+  }
+  thread->on_cpu = false;
+  // a thread terminated on its way into a wait queue is freed by its waker.
+  if (thread->get_status () == TERMINATED && !thread->waiting)
+  {
+    thread->lock.unlock ();
+    delete thread;
+    return;
+  }
+  make_runnable (thread);
+  thread->lock.unlock ();
+}
+
+User_Thread *take_thread (Worker *worker)
+{
+  // the own queue first, then steal round-robin from the others.
+  for (int i = 0; i < num_workers; i++)
+  {
+    Worker *victim = &workers[(worker->id + i) % num_workers];
+    User_Thread *thread;
+    while ((thread = victim->run_queue.steal ()) != nullptr)
+    {
+      thread->lock.lock ();
+      thread->queued = false;
+      if (thread->get_status () == TERMINATED)
+      {
+        thread->lock.unlock ();
+        delete thread;
+        continue;
+      }
+      // blocked or put to sleep while queued, whoever makes it READY again
+      // queues it again.
+      if (!thread->is_runnable ())
+      {
+        thread->lock.unlock ();
+        continue;
+      }
+      thread->on_cpu = true;
+      thread->worker = worker;
+      thread->inc_quantums_ran ();
+      thread->lock.unlock ();
+      return thread;
+    }
+  }
+  return nullptr;
+}
+
+void run_thread (Worker *worker, User_Thread *thread)
+{
+  worker->cur = thread;
+  worker->switches++;
+  TRACE_EVENT (TRACE_SWITCH_IN, thread);
+  mn_total_quantums++;
+  wake_due_threads ();
+  arm_worker_timer (worker, true);
+  siglongjmp (thread->env, 1);
+}
+
+void switch_out (User_Thread *thread)
+{
+  if (sigsetjmp(thread->env, 1) == 0)
+  {
+    Worker *worker = current_worker ();
+    worker->prev = thread;
+    siglongjmp (worker->sched_env, 1);
+  }
+}
+
+void make_runnable (User_Thread *thread)
+{
+  if (thread->is_runnable () && !thread->on_cpu && !thread->queued)
+  {
+    thread->queued = true;
+    TRACE_EVENT (TRACE_READY, thread);
+    current_worker ()->run_queue.push (thread);
+  }
+}
+
+void wake_due_threads ()
+{
+  // whoever holds the lock wakes the sleepers of every quantum up to now.
+  if (!sleep_lock.try_lock ())
+  {
+    return;
+  }
+  int total = mn_total_quantums.load ();
+  User_Thread *thread;
+  while ((thread = mn_sleep_wheel.pop_due (total)) != nullptr)
+  {
+    thread->lock.lock ();
+    thread->set_wake_quantum (0);
+    make_runnable (thread);
+    thread->lock.unlock ();
+  }
+  sleep_lock.unlock ();
+}
+
+void skip_idle_quantums ()
+{
+  // no worker runs a thread, so no quantum starts until the next sleeper
+  // wakes up. let the quantums up to the next event of the wheel pass at
+  // once, as the 1:1 scheduler does.
+  if (!sleep_lock.try_lock ())
+  {
+    return;
+  }
+  int next = mn_sleep_wheel.next_event ();
+  int total = mn_total_quantums.load ();
+  if (next != INT_MAX && next > total)
+  {
+    mn_total_quantums.compare_exchange_strong (total, next);
+  }
+  sleep_lock.unlock ();
+  wake_due_threads ();
+}
+
+int mn_spawn (thread_entry_point entry_point,
+              uthread_start_routine start_routine, void **args, int count,
+              int *tids)
+{
+  block_alarm_signal ();
+  int size = spawn_stack_size (stack_owner (entry_point, start_routine),
+                               mn_stack_size);
+  table_lock.lock ();
+  if (mn_total_threads > mn_max_threads - count)
+  {
+    table_lock.unlock ();
+    std::cerr << MAX_THREADS_ERR << std::endl;
+    unblock_alarm_signal ();
+    return FAILURE;
+  }
+  // the threads are only published once all of them exist, so a failure can
+  // be undone before any worker sees them. until then they belong to no
+  // queue, and are chained through their queue links, which costs no
+  // allocation.
+  User_Thread *first = nullptr;
+  User_Thread *last = nullptr;
+  int tid = FAILURE;
+  try
+  {
+    for (int i = 0; i < count; i++)
+    {
+      tid = mn_available_tid ();
+      auto *thread = new User_Thread (tid, entry_point, size, start_routine,
+                                      args != nullptr ? args[i] : nullptr);
+      tid = FAILURE;
+      (last != nullptr ? last->queue_next : first) = thread;
+      last = thread;
+    }
+    reserve_join_slots ((int) mn_threads.size ());
+  }
+  catch (const std::exception &)
+  {
+    if (tid != FAILURE)
+    {
+      mn_free_tids.push (tid);
+    }
+    while (first != nullptr)
+    {
+      User_Thread *next = first->queue_next;
+      mn_free_tids.push (first->get_tid ());
+      delete first;
+      first = next;
+    }
+    table_lock.unlock ();
+    std::cerr << MEM_ALLOC_ERR << std::endl;
+    unblock_alarm_signal ();
+    return FAILURE;
+  }
+  int i = 0;
+  for (User_Thread *thread = first; thread != nullptr;
+       thread = thread->queue_next)
+  {
+    tids[i++] = thread->get_tid ();
+    mn_threads[thread->get_tid ()] = thread;
+    reset_join_slot (thread->get_tid (), start_routine != nullptr);
+    TRACE_EVENT (TRACE_SPAWN, thread);
+    // held until the thread is queued, so that it cannot be terminated and
+    // freed before.
+    thread->lock.lock ();
+  }
+  mn_total_threads += count;
+  table_lock.unlock ();
+  while (first != nullptr)
+  {
+    User_Thread *next = first->queue_next;
+    first->queue_next = nullptr;
+    make_runnable (first);
+    first->lock.unlock ();
+    first = next;
+  }
+  unblock_alarm_signal ();
+  return SUCCESS;
+}
+
+int mn_terminate (int tid, uint64_t generation)
+{
+  block_alarm_signal ();
+  table_lock.lock ();
+  User_Thread *thread = find_thread (tid);
+  if (thread == nullptr)
+  {
+    table_lock.unlock ();
+    unblock_alarm_signal ();
+    return FAILURE;
+  }
+  if (tid != 0 && thread->get_generation () != generation)
+  {
+    table_lock.unlock ();
+    std::cerr << NONEXISTENT_THREAD_ERR << std::endl;
+    unblock_alarm_signal ();
+    return FAILURE;
+  }
+  if (tid == 0)
+  {
+    table_lock.unlock ();
+    stop_workers_and_exit ();
+  }
+  mn_threads[tid] = nullptr;
+  if (!end_join_slot (tid, thread->exit_result))
+  {
+    mn_free_tids.push (tid);
+    mn_total_threads--;
+  }
+  sleep_lock.lock ();
+  thread->lock.lock ();
+  // a waiting thread stays on its wait queue, whose lock ranks above ours.
+  if (thread->is_sleeping ())
+  {
+    mn_sleep_wheel.erase (thread);
+    thread->set_wake_quantum (0);
+  }
+  sleep_lock.unlock ();
+  table_lock.unlock ();
+  thread->set_status (TERMINATED);
+  TRACE_EVENT (TRACE_TERMINATE, thread);
+
+  // whoever holds the last reference to the thread frees it: the scheduler
+  // leaving its stack, the worker taking it out of a run queue, the thread
+  // waking it from a wait queue, or us.
+  if (thread == current_worker ()->cur)
+  {
+    switch_out (thread);
+  }
+  if (thread->on_cpu)
+  {
+    kick_worker (thread->worker);
+    thread->lock.unlock ();
+  }
+  else if (thread->queued || thread->waiting)
+  {
+    int fd = thread->waiting ? thread->waiting_fd : -1;
+    thread->lock.unlock ();
+    if (fd >= 0)
+    {
+      drop_fd_waiter (fd);
+    }
+  }
+  else
+  {
+    thread->lock.unlock ();
+    delete thread;
+  }
+  unblock_alarm_signal ();
+  return SUCCESS;
+}
+
+int mn_block (int tid)
+{
+  block_alarm_signal ();
+  table_lock.lock ();
+  User_Thread *thread = find_thread (tid);
+  if (thread == nullptr)
+  {
+    table_lock.unlock ();
+    unblock_alarm_signal ();
+    return FAILURE;
+  }
+  if (tid == 0)
+  {
+    table_lock.unlock ();
+    std::cerr << BLOCK_MAIN_ERR << std::endl;
+    unblock_alarm_signal ();
+    return FAILURE;
+  }
+  thread->lock.lock ();
+  table_lock.unlock ();
+  thread->set_status (BLOCKED);
+  TRACE_EVENT (TRACE_BLOCK, thread);
+  if (thread == current_worker ()->cur)
+  {
+    switch_out (thread);
+    unblock_alarm_signal ();
+    return SUCCESS;
+  }
+  // a queued thread is dropped lazily by the worker that takes it.
+  if (thread->on_cpu)
+  {
+    kick_worker (thread->worker);
+  }
+  thread->lock.unlock ();
+  unblock_alarm_signal ();
+  return SUCCESS;
+}
+
+int mn_resume (int tid)
+{
+  block_alarm_signal ();
+  table_lock.lock ();
+  User_Thread *thread = find_thread (tid);
+  if (thread == nullptr)
+  {
+    table_lock.unlock ();
+    unblock_alarm_signal ();
+    return FAILURE;
+  }
+  thread->lock.lock ();
+  table_lock.unlock ();
+  if (thread->get_status () == BLOCKED)
+  {
+    thread->set_status (READY);
+    TRACE_EVENT (TRACE_RESUME, thread);
+    make_runnable (thread);
+  }
+  thread->lock.unlock ();
+  unblock_alarm_signal ();
+  return SUCCESS;
+}
+
+int mn_sleep (int num_quantums)
+{
+  block_alarm_signal ();
+  if (num_quantums < 0)
+  {
+    std::cerr << INCORRECT_SLEEP_QUANTUMS_ERR << std::endl;
+    unblock_alarm_signal ();
+    return FAILURE;
+  }
+  User_Thread *thread = current_worker ()->cur;
+  if (thread->get_tid () == 0)
+  {
+    std::cerr << SLEEP_MAIN_THREAD_ERR << std::endl;
+    unblock_alarm_signal ();
+    return FAILURE;
+  }
+  if (num_quantums > 0)
+  {
+    sleep_lock.lock ();
+    thread->lock.lock ();
+    // the wheel trails mn_total_quantums, so the wake up quantum is still
+    // ahead of it.
+    thread->set_wake_quantum (mn_total_quantums.load () + num_quantums);
+    mn_sleep_wheel.insert (thread);
+    sleep_lock.unlock ();
+    TRACE_EVENT (TRACE_SLEEP, thread);
+  }
+  else
+  {
+    thread->lock.lock ();
+  }
+  switch_out (thread);
+  unblock_alarm_signal ();
+  return SUCCESS;
+}
+
+int mn_yield ()
+{
+  block_alarm_signal ();
+  Worker *worker = current_worker ();
+  User_Thread *thread = worker->cur;
+  // with no thread queued on any worker, the scheduler would only pick the
+  // caller again.
+  bool others_ready = false;
+  for (int i = 0; i < num_workers && !others_ready; i++)
+  {
+    others_ready = !workers[i].run_queue.empty ();
+  }
+  if (others_ready)
+  {
+    thread->lock.lock ();
+    switch_out (thread);
+  }
+  unblock_alarm_signal ();
+  return SUCCESS;
+}
+
+int mn_set_priority (int tid, int priority)
+{
+  block_alarm_signal ();
+  table_lock.lock ();
+  User_Thread *thread = find_thread (tid);
+  if (thread == nullptr)
+  {
+    table_lock.unlock ();
+    unblock_alarm_signal ();
+    return FAILURE;
+  }
+  if (priority < 0 || priority >= UTHREAD_NUM_PRIORITIES)
+  {
+    table_lock.unlock ();
+    std::cerr << INCORRECT_PRIORITY_ERR << std::endl;
+    unblock_alarm_signal ();
+    return FAILURE;
+  }
+  // the M:N scheduler is round-robin, the priority is only recorded.
+  thread->set_priority (priority);
+  table_lock.unlock ();
+  unblock_alarm_signal ();
+  return SUCCESS;
+}
+
+int mn_get_tid ()
+{
+  block_alarm_signal ();
+  int tid = current_worker ()->cur->get_tid ();
+  unblock_alarm_signal ();
+  return tid;
+}
+
+int mn_get_total_quantums ()
+{
+  return mn_total_quantums.load ();
+}
+
+int mn_get_metrics (int tid, uthread_metrics *metrics)
+{
+  if (metrics == nullptr)
+  {
+    std::cerr << NULL_ERR << std::endl;
+    return FAILURE;
+  }
+  block_alarm_signal ();
+  table_lock.lock ();
+  User_Thread *thread = find_thread (tid);
+  int ret = thread != nullptr ? read_metrics (thread, metrics) : FAILURE;
+  table_lock.unlock ();
+  unblock_alarm_signal ();
+  return ret;
+}
+
+int mn_stack_usage (int tid)
+{
+  block_alarm_signal ();
+  table_lock.lock ();
+  User_Thread *thread = find_thread (tid);
+  int usage = FAILURE;
+  if (thread != nullptr)
+  {
+    usage = tid != 0 ? stack_usage (thread->stack, thread->get_stack_size ())
+                     : FAILURE;
+    if (usage == FAILURE)
+    {
+      std::cerr << STACK_USAGE_ERR << std::endl;
+    }
+  }
+  table_lock.unlock ();
+  unblock_alarm_signal ();
+  return usage;
+}
+
+int mn_get_quantums (int tid)
+{
+  block_alarm_signal ();
+  table_lock.lock ();
+  User_Thread *thread = find_thread (tid);
+  int quantums = thread != nullptr ? thread->get_quantums_ran () : FAILURE;
+  table_lock.unlock ();
+  unblock_alarm_signal ();
+  return quantums;
+}
+
+int mn_worker_id ()
+{
+  Worker *worker = current_worker ();
+  return worker != nullptr ? worker->id : 0;
+}
+
+User_Thread *mn_current_thread ()
+{
+  // with SIGVTALRM unblocked the caller may migrate between reading its
+  // worker and reading the worker's thread. it was on the worker throughout
+  // iff it is still there afterwards and the worker has not switched since,
+  // as coming back would have counted a switch.
+  for (;;)
+  {
+    Worker *worker = current_worker ();
+    unsigned int switches = worker->switches.load ();
+    User_Thread *thread = __atomic_load_n (&worker->cur, __ATOMIC_SEQ_CST);
+    if (current_worker () == worker && worker->switches.load () == switches)
+    {
+      return thread;
+    }
+  }
+}
+
+void mn_park_thread (Thread_Queue *wait_queue, Spin_Lock *lock)
+{
+  User_Thread *thread = current_worker ()->cur;
+  // a waker blocks on our lock until the scheduler has left our stack.
+  thread->lock.lock ();
+  thread->waiting = true;
+  TRACE_EVENT (TRACE_WAIT, thread);
+  wait_queue->push_back (thread);
+  lock->unlock ();
+  switch_out (thread);
+}
+
+bool mn_unpark_thread (User_Thread *thread)
+{
+  thread->lock.lock ();
+  thread->waiting = false;
+  if (thread->get_status () == TERMINATED)
+  {
+    thread->lock.unlock ();
+    delete thread;
+    return false;
+  }
+  make_runnable (thread);
+  thread->lock.unlock ();
+  return true;
+}
+
+bool mn_thread_generation (int tid, uint64_t *generation)
+{
+  block_alarm_signal ();
+  table_lock.lock ();
+  bool exists = tid >= 0 && tid < (int) mn_threads.size ()
+                && mn_threads[tid] != nullptr;
+  if (exists)
+  {
+    *generation = mn_threads[tid]->get_generation ();
+  }
+  table_lock.unlock ();
+  unblock_alarm_signal ();
+  return exists;
+}
+
+bool mn_take_thread_values (int tid, uint64_t generation, void **values)
+{
+  block_alarm_signal ();
+  table_lock.lock ();
+  if (tid < 0 || tid >= (int) mn_threads.size () || mn_threads[tid] == nullptr
+      || mn_threads[tid]->get_generation () != generation)
+  {
+    table_lock.unlock ();
+    unblock_alarm_signal ();
+    return false;
+  }
+  User_Thread *thread = mn_threads[tid];
+  std::copy (thread->specific, thread->specific + UTHREAD_KEYS_MAX, values);
+  std::fill (thread->specific, thread->specific + UTHREAD_KEYS_MAX, nullptr);
+  table_lock.unlock ();
+  unblock_alarm_signal ();
+  return true;
+}
+
+void create_worker_timer (Worker *worker)
+{
+  // a per-thread CPU time clock, delivered to this kernel thread only.
+  struct sigevent event = {};
+  event.sigev_notify = SIGEV_THREAD_ID;
+  event.sigev_signo = SIGVTALRM;
+  event.sigev_notify_thread_id = gettid ();
+  if (timer_create (CLOCK_THREAD_CPUTIME_ID, &event, &worker->timer) < 0)
+  {
+    std::cerr << SC_TIMER_CREATE_ERR << std::endl;
+    exit (1);
+  }
+}
+
+void arm_worker_timer (Worker *worker, bool arm)
+{
+  struct itimerspec spec = {};
+  if (arm)
+  {
+    spec.it_value.tv_sec = mn_quantum_usecs / 1000000;
+    spec.it_value.tv_nsec = (long) (mn_quantum_usecs % 1000000) * 1000;
+    spec.it_interval = spec.it_value;
+  }
+  if (timer_settime (worker->timer, 0, &spec, nullptr) < 0)
+  {
+    std::cerr << SC_TIMER_SETTIME_ERR << std::endl;
+    exit (1);
+  }
+}
+
+void kick_worker (Worker *worker)
+{
+  // makes the worker reschedule now instead of at the end of its quantum.
+  pthread_kill (worker->pthread, SIGVTALRM);
+}
+
+void park_worker (Worker *worker)
+{
+  arm_worker_timer (worker, false);
+  parked_workers++;
+  for (;;)
+  {
+    pause ();
+  }
+}
+
+void stop_workers_and_exit ()
+{
+  // park every other worker in its scheduler before releasing the threads,
+  // so that no worker is still running on a stack that is being freed.
+  stopping.store (true);
+  Worker *self = current_worker ();
+  while (parked_workers.load () < num_workers - 1)
+  {
+    for (int i = 0; i < num_workers; i++)
+    {
+      if (&workers[i] != self)
+      {
+        kick_worker (&workers[i]);
+      }
+    }
+    sched_yield ();
+  }
+  for (User_Thread *thread: mn_threads)
+  {
+    // the calling thread's stack is still in use, exit reclaims it.
+    if (thread != nullptr && thread != self->cur)
+    {
+      delete thread;
+    }
+  }
+  exit (0);
+}
+
+void mn_release_tid (int tid)
+{
+  table_lock.lock ();
+  mn_free_tids.push (tid);
+  mn_total_threads--;
+  table_lock.unlock ();
+}
+
+User_Thread *find_thread (int tid)
+{
+  if (tid < 0 || tid >= mn_max_threads)
+  {
+    std::cerr << INCORRECT_TID_ERR << std::endl;
+    return nullptr;
+  }
+  if (tid >= (int) mn_threads.size () || mn_threads[tid] == nullptr)
+  {
+    std::cerr << NONEXISTENT_THREAD_ERR << std::endl;
+    return nullptr;
+  }
+  return mn_threads[tid];
+}
+
+int mn_available_tid ()
+{
+  if (!mn_free_tids.empty ())
+  {
+    int tid = mn_free_tids.top ();
+    mn_free_tids.pop ();
+    return tid;
+  }
+  mn_threads.push_back (nullptr);
+  return (int) mn_threads.size () - 1;
+}
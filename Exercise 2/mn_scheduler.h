@@ -0,0 +1,66 @@
+#ifndef _MN_SCHEDULER_H_
+#define _MN_SCHEDULER_H_
+
+#include "uthreads.h"
+#include "uthread_trace.h"
+#include <cstdint>
+
+class User_Thread;
+class Thread_Queue;
+class Spin_Lock;
+
+/*
+ * The M:N scheduler behind uthread_init_config with workers > 1. Each function
+ * implements the uthread_* function of the same name, with the same
+ * arguments, errors and return values.
+ */
+
+int mn_init (int num_workers, int quantum_usecs, int max_threads,
+             int stack_size);
+
+int mn_spawn (thread_entry_point entry_point,
+              uthread_start_routine start_routine, void **args, int count,
+              int *tids);
+
+// only terminates the thread with ID tid if it still has generation, unless
+// tid is 0.
+int mn_terminate (int tid, uint64_t generation);
+
+void mn_release_tid (int tid);
+
+int mn_block (int tid);
+
+int mn_resume (int tid);
+
+int mn_sleep (int num_quantums);
+
+int mn_yield ();
+
+int mn_set_priority (int tid, int priority);
+
+int mn_get_tid ();
+
+int mn_get_total_quantums ();
+
+int mn_get_quantums (int tid);
+
+int mn_get_metrics (int tid, uthread_metrics *metrics);
+
+int mn_stack_usage (int tid);
+
+// the M:N side of the scheduler hooks declared in uthreads_internal.h.
+
+User_Thread *mn_current_thread ();
+
+void mn_park_thread (Thread_Queue *wait_queue, Spin_Lock *lock);
+
+bool mn_unpark_thread (User_Thread *thread);
+
+bool mn_thread_generation (int tid, uint64_t *generation);
+
+bool mn_take_thread_values (int tid, uint64_t generation, void **values);
+
+// the id of the worker the caller runs on, 0 in the 1:1 mode.
+int mn_worker_id ();
+
+#endif //_MN_SCHEDULER_H_
@@ -0,0 +1,141 @@
+// OS 24 EX2
+
+#include <cstdlib>
+#include <cstdint>
+#include <ctime>
+#include <iostream>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "uthreads.h"
+
+#define BENCH_STACK_SIZE 16384
+#define BENCH_QUANTUM_USECS 1000
+#define BENCH_ROUNDS 4
+#define BASE_THREADS 1000
+
+volatile uint64_t rounds_done = 0;
+volatile uint64_t switch_time_ns = 0;
+volatile uint64_t switches_measured = 0;
+volatile uint64_t last_switch_ns = 0;
+
+/**
+ * Reads the monotonic clock.
+ * @return - the current time in nano-seconds.
+ */
+uint64_t now_ns ()
+{
+  struct timespec t;
+  clock_gettime (CLOCK_MONOTONIC, &t);
+  return (uint64_t) t.tv_sec * 1000000000ULL + (uint64_t) t.tv_nsec;
+}
+
+/**
+ * Entry point of every benchmark thread. Gives up the CPU BENCH_ROUNDS times,
+ * timing each hand-off from the previous thread, and then blocks itself until
+ * the main thread terminates it. Hand-offs that include a full quantum of the
+ * busy waiting main thread are not counted.
+ */
+void bench_thread ()
+{
+  for (int round = 0; round < BENCH_ROUNDS; round++)
+  {
+    last_switch_ns = now_ns ();
+    uthread_sleep (0);
+    uint64_t elapsed = now_ns () - last_switch_ns;
+    if (elapsed < BENCH_QUANTUM_USECS * 1000ULL / 2)
+    {
+      switch_time_ns += elapsed;
+      switches_measured++;
+    }
+    rounds_done++;
+  }
+  uthread_block (uthread_get_tid ());
+}
+
+/**
+ * Spawns, schedules and terminates num_threads threads in a fresh library
+ * instance and prints the average cost of each operation.
+ * @param num_threads - the number of concurrent threads to run.
+ */
+void run_bench (int num_threads)
+{
+  uthread_config config = {BENCH_QUANTUM_USECS, num_threads + 1,
+                           BENCH_STACK_SIZE};
+  if (uthread_init_config (&config) != 0)
+  {
+    exit (1);
+  }
+
+  uint64_t t0 = now_ns ();
+  for (int i = 0; i < num_threads; i++)
+  {
+    if (uthread_spawn (bench_thread) < 0)
+    {
+      exit (1);
+    }
+  }
+  uint64_t t1 = now_ns ();
+
+  while (rounds_done < (uint64_t) num_threads * BENCH_ROUNDS)
+  {}
+
+  uint64_t t2 = now_ns ();
+  for (int tid = 1; tid <= num_threads; tid++)
+  {
+    uthread_terminate (tid);
+  }
+  uint64_t t3 = now_ns ();
+
+  std::cout << num_threads << ","
+            << (double) (t1 - t0) / num_threads << ","
+            << (double) switch_time_ns / (switches_measured ? switches_measured : 1)
+            << "," << (double) (t3 - t2) / num_threads << std::endl;
+  uthread_terminate (0);
+}
+
+/**
+ * Measures how the cost of the scheduler operations changes with the number of
+ * concurrent threads. Every thread count runs in its own process, since the
+ * library can only be initialized once.
+ * Usage: './scalability_bench [max_threads]' where:
+ *      - max_threads - the largest thread count to measure (default 100000),
+ *        thread counts grow by a factor of 10 starting at 1000.
+ * The program will print output to stdout in the following format:
+ *      threads,spawn_ns,switch_ns,terminate_ns
+ *      num_threads_1,spawn_1,switch_1,terminate_1
+ *              ...
+ */
+int main (int argc, char *argv[])
+{
+  int max_threads = argc > 1 ? atoi (argv[1]) : 100000;
+  if (max_threads < BASE_THREADS)
+  {
+    std::cerr << "max_threads must be at least " << BASE_THREADS << std::endl;
+    return -1;
+  }
+
+  std::cout << "threads,spawn_ns,switch_ns,terminate_ns" << std::endl;
+  for (long num_threads = BASE_THREADS; num_threads <= max_threads;
+       num_threads *= 10)
+  {
+    pid_t pid = fork ();
+    if (pid < 0)
+    {
+      std::cerr << "fork failed." << std::endl;
+      return -1;
+    }
+    if (pid == 0)
+    {
+      run_bench ((int) num_threads);
+    }
+    int status;
+    waitpid (pid, &status, 0);
+    if (!WIFEXITED (status) || WEXITSTATUS (status) != 0)
+    {
+      std::cerr << "benchmark with " << num_threads << " threads failed."
+                << std::endl;
+      return -1;
+    }
+  }
+  return 0;
+}
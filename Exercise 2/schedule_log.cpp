@@ -0,0 +1,119 @@
+#include "schedule_log.h"
+#include "uthreads_internal.h"
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+#include <fstream>
+#include <iostream>
+#include <string>
+
+struct Log_Entry
+{
+  int quantum;
+  long virtual_usecs;
+  int tid;
+};
+
+std::vector<Log_Entry> schedule_log;
+// the tid to run per quantum of the replayed log, -1 for quantums it skips.
+std::vector<int> replay;
+uint64_t random_state = 0;
+
+void init_schedule_log (unsigned int seed)
+{
+  schedule_log.clear ();
+  replay.clear ();
+  random_state = seed;
+}
+
+void log_quantum (int quantum, long virtual_usecs, int tid)
+{
+  schedule_log.push_back ({quantum, virtual_usecs, tid});
+}
+
+int replayed_tid (int quantum)
+{
+  if (quantum < 0 || quantum >= (int) replay.size ())
+  {
+    return -1;
+  }
+  return replay[quantum];
+}
+
+bool replaying (int quantum)
+{
+  return quantum < (int) replay.size ();
+}
+
+void stop_replay ()
+{
+  replay.clear ();
+}
+
+bool seeded ()
+{
+  return random_state != 0;
+}
+
+unsigned int next_random ()
+{
+  // splitmix64, whose output is well mixed even for small seeds.
+  uint64_t z = (random_state += 0x9e3779b97f4a7c15ULL);
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+  return (unsigned int) ((z ^ (z >> 31)) >> 32);
+}
+
+int write_schedule_log (const char *path)
+{
+  std::ofstream out (path);
+  if (!out)
+  {
+    std::cerr << SCHEDULE_FILE_ERR << std::endl;
+    return FAILURE;
+  }
+  out << "quantum,time_usecs,tid\n";
+  for (const Log_Entry &entry: schedule_log)
+  {
+    out << entry.quantum << "," << entry.virtual_usecs << "," << entry.tid
+        << "\n";
+  }
+  out.close ();
+  if (!out)
+  {
+    std::cerr << SCHEDULE_FILE_ERR << std::endl;
+    return FAILURE;
+  }
+  return SUCCESS;
+}
+
+int read_schedule_log (const char *path)
+{
+  std::ifstream in (path);
+  std::string line;
+  if (!in || !std::getline (in, line))
+  {
+    std::cerr << SCHEDULE_FILE_ERR << std::endl;
+    return FAILURE;
+  }
+  std::vector<int> tids;
+  while (std::getline (in, line))
+  {
+    int quantum;
+    long virtual_usecs;
+    int tid;
+    if (std::sscanf (line.c_str (), "%d,%ld,%d", &quantum, &virtual_usecs,
+                     &tid) != 3 || quantum < 0 || tid < 0)
+    {
+      std::cerr << SCHEDULE_FORMAT_ERR << std::endl;
+      return FAILURE;
+    }
+    if (quantum >= (int) tids.size ())
+    {
+      tids.resize (quantum + 1, -1);
+    }
+    tids[quantum] = tid;
+  }
+  replay.swap (tids);
+  return SUCCESS;
+}
@@ -0,0 +1,39 @@
+#ifndef _SCHEDULE_LOG_H_
+#define _SCHEDULE_LOG_H_
+
+/*
+ * The schedule log of the deterministic mode: one entry per quantum, naming
+ * the thread that ran it and the virtual time it started at. A log written by
+ * uthread_schedule_dump can be read back by uthread_schedule_replay, after
+ * which the scheduler runs the logged thread in each logged quantum.
+ * The log also holds the pseudo-random generator of the seeded policy, so
+ * that a seed alone fixes every choice the scheduler makes.
+ */
+
+// clears the log and seeds the generator, 0 leaves the policy alone.
+void init_schedule_log (unsigned int seed);
+
+// records that tid runs the quantum starting at virtual_usecs.
+void log_quantum (int quantum, long virtual_usecs, int tid);
+
+// the tid a replayed log ran in quantum, -1 if no log is replayed or it holds
+// no entry for quantum.
+int replayed_tid (int quantum);
+
+// true while a replayed log still has entries after quantum.
+bool replaying (int quantum);
+
+// stops following the replayed log.
+void stop_replay ();
+
+// true when a non-zero seed was given.
+bool seeded ();
+
+// the next number of the seeded generator.
+unsigned int next_random ();
+
+// write the log to path as CSV, and read one back for replay.
+int write_schedule_log (const char *path);
+int read_schedule_log (const char *path);
+
+#endif //_SCHEDULE_LOG_H_
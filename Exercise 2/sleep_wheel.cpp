@@ -0,0 +1,151 @@
+#include "sleep_wheel.h"
+#include "user_thread.h"
+#include <algorithm>
+#include <climits>
+
+Sleep_Wheel::Sleep_Wheel () : in_use (), now (0), count (0)
+{}
+
+bool Sleep_Wheel::empty () const
+{
+  return this->count == 0;
+}
+
+size_t Sleep_Wheel::size () const
+{
+  return this->count;
+}
+
+void Sleep_Wheel::insert (User_Thread *thread)
+{
+  // a thread due already needs no bucket.
+  if ((uint32_t) thread->get_wake_quantum () <= this->now)
+  {
+    this->due.push_back (thread);
+  }
+  else
+  {
+    link (thread);
+  }
+  this->count++;
+}
+
+void Sleep_Wheel::erase (User_Thread *thread)
+{
+  Thread_Queue *queue = thread->queue;
+  queue->erase (thread);
+  this->count--;
+  if (queue != &this->due && queue->empty ())
+  {
+    long index = queue - &this->buckets[0][0];
+    int level = (int) (index / SLEEP_WHEEL_SIZE);
+    int bucket = (int) (index % SLEEP_WHEEL_SIZE);
+    this->in_use[level][bucket / 64] &= ~(1ULL << (bucket % 64));
+  }
+}
+
+int Sleep_Wheel::next_event () const
+{
+  if (this->count == 0)
+  {
+    return INT_MAX;
+  }
+  if (!this->due.empty ())
+  {
+    return (int) this->now;
+  }
+  uint64_t next = UINT64_MAX;
+  for (int level = 0; level < SLEEP_WHEEL_LEVELS; ++level)
+  {
+    int bucket = next_bucket (level);
+    if (bucket < 0)
+    {
+      continue;
+    }
+    // the quantum where the digits below the bucket start over.
+    int above = SLEEP_WHEEL_BITS * (level + 1);
+    uint64_t high = above < 32 ? (this->now >> above) << above : 0;
+    next = std::min (next, high | ((uint64_t) bucket
+        << (SLEEP_WHEEL_BITS * level)));
+  }
+  return next > INT_MAX ? INT_MAX : (int) next;
+}
+
+User_Thread *Sleep_Wheel::pop_due (int quantum)
+{
+  while (this->due.empty () && this->now < (uint32_t) quantum)
+  {
+    int next = next_event ();
+    if (next > quantum)
+    {
+      this->now = (uint32_t) quantum;
+      break;
+    }
+    // the quantums between held no event, so the wheel skips them at once.
+    this->now = (uint32_t) next;
+    for (int level = SLEEP_WHEEL_LEVELS - 1; level > 0; --level)
+    {
+      if ((this->now & ((1u << (SLEEP_WHEEL_BITS * level)) - 1)) == 0)
+      {
+        cascade (level);
+      }
+    }
+    int bucket = this->now & (SLEEP_WHEEL_SIZE - 1);
+    Thread_Queue &due_bucket = this->buckets[0][bucket];
+    while (!due_bucket.empty ())
+    {
+      this->due.push_back (due_bucket.pop_front ());
+    }
+    this->in_use[0][bucket / 64] &= ~(1ULL << (bucket % 64));
+  }
+  User_Thread *thread = this->due.pop_front ();
+  if (thread != nullptr)
+  {
+    this->count--;
+  }
+  return thread;
+}
+
+void Sleep_Wheel::link (User_Thread *thread)
+{
+  uint32_t wake = (uint32_t) thread->get_wake_quantum ();
+  uint32_t differ = wake ^ this->now;
+  int level = differ == 0 ? 0
+                          : (31 - __builtin_clz (differ)) / SLEEP_WHEEL_BITS;
+  int bucket = (wake >> (SLEEP_WHEEL_BITS * level)) & (SLEEP_WHEEL_SIZE - 1);
+  this->buckets[level][bucket].push_back (thread);
+  this->in_use[level][bucket / 64] |= 1ULL << (bucket % 64);
+}
+
+void Sleep_Wheel::cascade (int level)
+{
+  // every thread of the bucket now differs from the wheel in a lower digit
+  // only, or in none if it is due this quantum.
+  int bucket = (this->now >> (SLEEP_WHEEL_BITS * level))
+               & (SLEEP_WHEEL_SIZE - 1);
+  Thread_Queue &queue = this->buckets[level][bucket];
+  this->in_use[level][bucket / 64] &= ~(1ULL << (bucket % 64));
+  while (!queue.empty ())
+  {
+    link (queue.pop_front ());
+  }
+}
+
+int Sleep_Wheel::next_bucket (int level) const
+{
+  int first = (int) ((this->now >> (SLEEP_WHEEL_BITS * level))
+                     & (SLEEP_WHEEL_SIZE - 1)) + 1;
+  for (int word = first / 64; word < WORDS; ++word)
+  {
+    uint64_t bits = this->in_use[level][word];
+    if (word == first / 64)
+    {
+      bits &= ~0ULL << (first % 64);
+    }
+    if (bits != 0)
+    {
+      return word * 64 + __builtin_ctzll (bits);
+    }
+  }
+  return -1;
+}
@@ -0,0 +1,73 @@
+#ifndef _SLEEP_WHEEL_H_
+#define _SLEEP_WHEEL_H_
+
+#include "thread_queue.h"
+#include <cstddef>
+#include <cstdint>
+
+// a wheel has SLEEP_WHEEL_LEVELS levels of SLEEP_WHEEL_SIZE buckets, which
+// together cover every int quantum.
+#define SLEEP_WHEEL_LEVELS 4
+#define SLEEP_WHEEL_BITS 8
+#define SLEEP_WHEEL_SIZE (1 << SLEEP_WHEEL_BITS)
+
+/**
+ * A hierarchical timing wheel of sleeping threads, keyed by their wake up
+ * quantum. A thread sits at the level of the highest SLEEP_WHEEL_BITS digit in
+ * which its wake up quantum differs from the quantum of the wheel, in the
+ * bucket of that digit. Once the wheel reaches the quantum where the lower
+ * digits of a bucket start over, the bucket is cascaded to the levels below,
+ * so a thread moves at most SLEEP_WHEEL_LEVELS - 1 times, and every thread in
+ * a bucket of the lowest level is due exactly when the wheel reaches it.
+ * A bitmap of the buckets in use finds the next of them in constant time.
+ * The links live inside User_Thread, as with Thread_Queue, so nothing here
+ * allocates. Not thread safe.
+ */
+class Sleep_Wheel
+{
+
+ public:
+  // constructor
+  Sleep_Wheel ();
+
+  bool empty () const;
+
+  size_t size () const;
+
+  // adds a thread, which wakes up at its wake quantum. the wake quantum must
+  // be past the quantum the wheel has reached.
+  void insert (User_Thread *thread);
+
+  // removes the thread from the wheel, the thread must be a member of it.
+  void erase (User_Thread *thread);
+
+  // the next quantum at which the wheel has a bucket to wake or cascade,
+  // INT_MAX when empty. no thread is due before it, so the quantums up to it
+  // can pass idle.
+  int next_event () const;
+
+  // moves the wheel on to quantum and returns the next thread due by then,
+  // or nullptr once no thread is left due. the thread is no longer a member.
+  User_Thread *pop_due (int quantum);
+
+ private:
+  static const int WORDS = SLEEP_WHEEL_SIZE / 64;
+
+  void link (User_Thread *thread);
+
+  void cascade (int level);
+
+  // the next bucket of level in use after the digit of now at that level,
+  // or -1 when there is none before the digit above it changes.
+  int next_bucket (int level) const;
+
+  Thread_Queue buckets[SLEEP_WHEEL_LEVELS][SLEEP_WHEEL_SIZE];
+  uint64_t in_use[SLEEP_WHEEL_LEVELS][WORDS];
+  // the threads of a bucket woken by pop_due and not returned yet.
+  Thread_Queue due;
+  // every thread due by now has been moved to due.
+  uint32_t now;
+  size_t count;
+};
+
+#endif //_SLEEP_WHEEL_H_
@@ -0,0 +1,53 @@
+#ifndef _SPIN_LOCK_H_
+#define _SPIN_LOCK_H_
+
+#include <atomic>
+#include <sched.h>
+
+#define SPIN_LOCK_SPINS 64
+
+/**
+ * A test-and-test-and-set lock for the short critical sections of the M:N
+ * scheduler. Holders always run with SIGVTALRM blocked, so the library never
+ * preempts a holder, only the kernel may. Waiters yield the CPU after a few
+ * spins so that such a holder gets to run.
+ */
+class Spin_Lock
+{
+
+ public:
+  // constructor
+  Spin_Lock () : locked (false)
+  {}
+
+  void lock ()
+  {
+    int spins = 0;
+    while (locked.exchange (true, std::memory_order_acquire))
+    {
+      while (locked.load (std::memory_order_relaxed))
+      {
+        if (++spins > SPIN_LOCK_SPINS)
+        {
+          sched_yield ();
+        }
+      }
+    }
+  }
+
+  bool try_lock ()
+  {
+    return !locked.load (std::memory_order_relaxed)
+           && !locked.exchange (true, std::memory_order_acquire);
+  }
+
+  void unlock ()
+  {
+    locked.store (false, std::memory_order_release);
+  }
+
+ private:
+  std::atomic<bool> locked;
+};
+
+#endif //_SPIN_LOCK_H_
@@ -0,0 +1,241 @@
+// OS 24 EX2
+
+#include <cstdlib>
+#include <cstdint>
+#include <ctime>
+#include <iostream>
+#include <pthread.h>
+#include <semaphore.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "uthreads.h"
+#include "uthread_sync.h"
+
+#define BENCH_QUANTUM_USECS 10000
+#define BENCH_STACK_SIZE 65536
+#define MN_WORKERS 2
+
+enum primitive
+{
+  MUTEX_COND, SEMAPHORE, CHANNEL
+};
+const char *primitive_names[] = {"mutex_cond", "semaphore", "channel"};
+
+enum implementation
+{
+  UTHREAD, UTHREAD_MN, PTHREAD
+};
+const char *implementation_names[] = {"uthread", "uthread_mn", "pthread"};
+
+long rounds;
+primitive measured;
+
+// the ping-pong state of every implementation, only one is in use per process.
+int turn = 0;
+uthread_mutex *u_mutex;
+uthread_cond *u_cond;
+uthread_sem *u_sems[2];
+uthread_chan *u_chans[2];
+pthread_mutex_t p_mutex = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t p_cond = PTHREAD_COND_INITIALIZER;
+sem_t p_sems[2];
+
+/**
+ * Reads the monotonic clock.
+ * @return - the current time in nano-seconds.
+ */
+uint64_t now_ns ()
+{
+  struct timespec t;
+  clock_gettime (CLOCK_MONOTONIC, &t);
+  return (uint64_t) t.tv_sec * 1000000000ULL + (uint64_t) t.tv_nsec;
+}
+
+/**
+ * Plays one side of the uthread ping-pong: waits for the ball and passes it
+ * back, rounds times.
+ * @param side - 0 for the side that serves, 1 for the other one.
+ */
+void uthread_side (int side)
+{
+  for (long i = 0; i < rounds; i++)
+  {
+    void *ball;
+    switch (measured)
+    {
+      case MUTEX_COND:
+        uthread_mutex_lock (u_mutex);
+        while (turn != side)
+        {
+          uthread_cond_wait (u_cond, u_mutex);
+        }
+        turn = 1 - side;
+        uthread_cond_signal (u_cond);
+        uthread_mutex_unlock (u_mutex);
+        break;
+      case SEMAPHORE:
+        if (side == 1 || i > 0)
+        {
+          uthread_sem_wait (u_sems[side]);
+        }
+        uthread_sem_post (u_sems[1 - side]);
+        break;
+      case CHANNEL:
+        if (side == 1 || i > 0)
+        {
+          uthread_chan_recv (u_chans[side], &ball);
+        }
+        uthread_chan_send (u_chans[1 - side], nullptr);
+        break;
+    }
+  }
+}
+
+/**
+ * Entry point of the uthread that receives the first ball.
+ */
+void uthread_receiver ()
+{
+  uthread_side (1);
+  uthread_terminate (uthread_get_tid ());
+}
+
+/**
+ * Plays one side of the pthread ping-pong, see uthread_side.
+ */
+void *pthread_side (void *arg)
+{
+  int side = (int) (intptr_t) arg;
+  for (long i = 0; i < rounds; i++)
+  {
+    if (measured == MUTEX_COND)
+    {
+      pthread_mutex_lock (&p_mutex);
+      while (turn != side)
+      {
+        pthread_cond_wait (&p_cond, &p_mutex);
+      }
+      turn = 1 - side;
+      pthread_cond_signal (&p_cond);
+      pthread_mutex_unlock (&p_mutex);
+    }
+    else
+    {
+      if (side == 1 || i > 0)
+      {
+        sem_wait (&p_sems[side]);
+      }
+      sem_post (&p_sems[1 - side]);
+    }
+  }
+  return nullptr;
+}
+
+/**
+ * Passes a ball back and forth between two threads rounds times and prints the
+ * average latency of one hand-off.
+ * @param impl - the threads and primitives to use.
+ * @param prim - the primitive that carries the ball.
+ */
+void run_bench (implementation impl, primitive prim)
+{
+  measured = prim;
+  uint64_t start, end;
+  if (impl == PTHREAD)
+  {
+    sem_init (&p_sems[0], 0, 0);
+    sem_init (&p_sems[1], 0, 0);
+    pthread_t other;
+    start = now_ns ();
+    pthread_create (&other, nullptr, pthread_side, (void *) 1);
+    pthread_side ((void *) 0);
+    pthread_join (other, nullptr);
+    end = now_ns ();
+  }
+  else
+  {
+    uthread_config config = {BENCH_QUANTUM_USECS, 2, BENCH_STACK_SIZE,
+                             UTHREAD_POLICY_RR, 0,
+                             impl == UTHREAD_MN ? MN_WORKERS : 1};
+    if (uthread_init_config (&config) != 0)
+    {
+      exit (1);
+    }
+    u_mutex = uthread_mutex_create ();
+    u_cond = uthread_cond_create ();
+    u_sems[0] = uthread_sem_create (0);
+    u_sems[1] = uthread_sem_create (0);
+    u_chans[0] = uthread_chan_create (0);
+    u_chans[1] = uthread_chan_create (0);
+    start = now_ns ();
+    if (uthread_spawn (uthread_receiver) < 0)
+    {
+      exit (1);
+    }
+    uthread_side (0);
+    end = now_ns ();
+  }
+  // every round but the first ends with the ball changing sides twice.
+  std::cout << primitive_names[prim] << "," << implementation_names[impl] << ","
+            << (double) (end - start) / (2.0 * rounds - 1) << std::endl;
+  if (impl == PTHREAD)
+  {
+    exit (0);
+  }
+  uthread_terminate (0);
+}
+
+/**
+ * Measures the latency of handing a lock, a semaphore unit or a channel item
+ * from one thread to another that waits for it, for uthreads in 1:1 and M:N
+ * mode and for kernel threads using pthread mutexes and POSIX semaphores. Every
+ * measurement runs in its own process, since the library can only be
+ * initialized once.
+ * Usage: './sync_bench [rounds]' where:
+ *      - rounds - the number of round trips per measurement (default 100000).
+ * The program will print output to stdout in the following format:
+ *      primitive,impl,ns_per_handoff
+ *      primitive_1,impl_1,ns_1
+ *              ...
+ */
+int main (int argc, char *argv[])
+{
+  rounds = argc > 1 ? atol (argv[1]) : 100000;
+  if (rounds <= 0)
+  {
+    std::cerr << "rounds must be positive" << std::endl;
+    return -1;
+  }
+
+  std::cout << "primitive,impl,ns_per_handoff" << std::endl;
+  for (int prim = MUTEX_COND; prim <= CHANNEL; prim++)
+  {
+    for (int impl = UTHREAD; impl <= PTHREAD; impl++)
+    {
+      // POSIX has no channel to compare with.
+      if (impl == PTHREAD && prim == CHANNEL)
+      {
+        continue;
+      }
+      pid_t pid = fork ();
+      if (pid < 0)
+      {
+        std::cerr << "fork failed." << std::endl;
+        return -1;
+      }
+      if (pid == 0)
+      {
+        run_bench ((implementation) impl, (primitive) prim);
+      }
+      int status;
+      waitpid (pid, &status, 0);
+      if (!WIFEXITED (status) || WEXITSTATUS (status) != 0)
+      {
+        std::cerr << primitive_names[prim] << " with "
+                  << implementation_names[impl] << " failed." << std::endl;
+        return -1;
+      }
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,291 @@
+// OS 24 EX2
+
+#include <cstdlib>
+#include <cstdint>
+#include <ctime>
+#include <iostream>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "uthreads.h"
+#include "uthread_sync.h"
+#include "uthread_task.h"
+
+#define BENCH_STACK_SIZE 65536
+// long enough that no benchmark is ever preempted.
+#define LONG_QUANTUM_USECS 1000000
+// spawning this many uthreads at once takes BENCH_STACK_SIZE bytes each.
+#define MAX_UTHREADS 1000
+
+/*
+ * Every benchmark runs once with coroutine tasks and once with uthreads doing
+ * the same work, each in a forked child so that both start from a fresh
+ * library.
+ */
+
+long rounds;
+int num_tasks;
+int done_tasks = 0;
+
+uthread_sem *done_sem;
+uthread_chan *ping;
+uthread_chan *pong;
+
+/**
+ * Reads the monotonic clock.
+ * @return - the current time in nano-seconds.
+ */
+uint64_t now_ns ()
+{
+  struct timespec t;
+  clock_gettime (CLOCK_MONOTONIC, &t);
+  return (uint64_t) t.tv_sec * 1000000000ULL + (uint64_t) t.tv_nsec;
+}
+
+/**
+ * Prints one CSV row.
+ */
+void report (const char *bench, const char *impl, int tasks, double value,
+             const char *unit)
+{
+  std::cout << bench << "," << impl << "," << tasks << "," << value << ","
+            << unit << std::endl;
+}
+
+/**
+ * Initializes a fresh uthreads instance in which main only waits on done_sem.
+ */
+void init_uthreads (int max_threads)
+{
+  uthread_config config = {LONG_QUANTUM_USECS, max_threads, BENCH_STACK_SIZE};
+  if (uthread_init_config (&config) != 0)
+  {
+    exit (1);
+  }
+  done_sem = uthread_sem_create (0);
+  // capacity 1 is enough for a ping pong, and sending never waits.
+  ping = uthread_chan_create (1);
+  pong = uthread_chan_create (1);
+}
+
+/**
+ * Counts the calling task or uthread as done, and wakes main after the last.
+ */
+void finish ()
+{
+  if (++done_tasks == num_tasks)
+  {
+    uthread_sem_post (done_sem);
+  }
+}
+
+// spawn_complete: num_tasks tasks that each give up the CPU once and end.
+
+uthread::task<void> task_yielder ()
+{
+  co_await uthread::yield ();
+  finish ();
+}
+
+void uthread_yielder ()
+{
+  uthread_yield ();
+  finish ();
+  uthread_terminate (uthread_get_tid ());
+}
+
+// ping_pong: two tasks handing an item back and forth over two channels.
+
+uthread::task<void> task_pinger ()
+{
+  void *item;
+  for (long i = 0; i < rounds; i++)
+  {
+    uthread_chan_send (ping, nullptr);
+    co_await uthread::recv (pong, &item);
+  }
+  finish ();
+}
+
+uthread::task<void> task_ponger ()
+{
+  void *item;
+  for (long i = 0; i < rounds; i++)
+  {
+    co_await uthread::recv (ping, &item);
+    uthread_chan_send (pong, nullptr);
+  }
+  finish ();
+}
+
+void uthread_pinger ()
+{
+  void *item;
+  for (long i = 0; i < rounds; i++)
+  {
+    uthread_chan_send (ping, nullptr);
+    uthread_chan_recv (pong, &item);
+  }
+  finish ();
+  uthread_terminate (uthread_get_tid ());
+}
+
+void uthread_ponger ()
+{
+  void *item;
+  for (long i = 0; i < rounds; i++)
+  {
+    uthread_chan_recv (ping, &item);
+    uthread_chan_send (pong, nullptr);
+  }
+  finish ();
+  uthread_terminate (uthread_get_tid ());
+}
+
+// await_child: a task awaiting a child task that returns a value, a join.
+
+uthread::task<long> task_child (long i)
+{
+  co_return i;
+}
+
+uthread::task<void> task_parent ()
+{
+  long sum = 0;
+  for (long i = 0; i < rounds; i++)
+  {
+    sum += co_await task_child (i);
+  }
+  if (sum != rounds * (rounds - 1) / 2)
+  {
+    exit (1);
+  }
+  finish ();
+}
+
+/**
+ * Runs one benchmark in the calling process, prints its row and exits.
+ */
+void run_bench (int bench, int impl)
+{
+  init_uthreads (impl == 0 ? 2 : num_tasks + 1);
+  uint64_t start = now_ns ();
+  for (int i = 0; i < num_tasks; i++)
+  {
+    int ret;
+    if (bench == 0)
+    {
+      ret = impl == 0 ? uthread::spawn (task_yielder ())
+                      : uthread_spawn (&uthread_yielder);
+    }
+    else if (bench == 1)
+    {
+      ret = impl == 0 ? uthread::spawn (i == 0 ? task_pinger ()
+                                               : task_ponger ())
+                      : uthread_spawn (i == 0 ? &uthread_pinger
+                                              : &uthread_ponger);
+    }
+    else
+    {
+      ret = uthread::spawn (task_parent ());
+    }
+    if (ret < 0)
+    {
+      exit (1);
+    }
+  }
+  uthread_sem_wait (done_sem);
+  double elapsed = (double) (now_ns () - start);
+  const char *impl_name = impl == 0 ? "task" : "uthread";
+  if (bench == 0)
+  {
+    report ("spawn_complete", impl_name, num_tasks, elapsed / num_tasks,
+            "ns/task");
+  }
+  else if (bench == 1)
+  {
+    report ("ping_pong", impl_name, num_tasks, elapsed / rounds,
+            "ns/round_trip");
+  }
+  else
+  {
+    report ("await_child", impl_name, num_tasks, elapsed / rounds,
+            "ns/await");
+  }
+  exit (0);
+}
+
+/**
+ * Runs one benchmark in a child process, so that every measurement starts
+ * from a fresh library.
+ * @return - 0 on success, -1 if the child failed.
+ */
+int fork_bench (int bench, int impl, int tasks)
+{
+  num_tasks = tasks;
+  pid_t pid = fork ();
+  if (pid < 0)
+  {
+    std::cerr << "fork failed." << std::endl;
+    return -1;
+  }
+  if (pid == 0)
+  {
+    run_bench (bench, impl);
+  }
+  int status;
+  waitpid (pid, &status, 0);
+  if (!WIFEXITED (status) || WEXITSTATUS (status) != 0)
+  {
+    std::cerr << "benchmark " << bench << " of implementation " << impl
+              << " failed." << std::endl;
+    return -1;
+  }
+  return 0;
+}
+
+/**
+ * Compares the stackless coroutine tasks of uthread_task.h with uthreads:
+ *      - spawn_complete: cost of spawning a task that yields once and ends,
+ *        with up to 1000000 tasks alive at once. uthreads need a stack each,
+ *        so they stop at MAX_UTHREADS.
+ *      - ping_pong: round trip of two tasks waking each other through two
+ *        channels.
+ *      - await_child: cost of a task awaiting a child task, tasks only.
+ * Usage: './task_bench [rounds]' where:
+ *      - rounds - the number of round trips and awaits (default 100000).
+ * The program will print output to stdout in the following format:
+ *      benchmark,impl,tasks,value,unit
+ *      benchmark_1,impl_1,tasks_1,value_1,unit_1
+ *              ...
+ */
+int main (int argc, char *argv[])
+{
+  rounds = argc > 1 ? atol (argv[1]) : 100000;
+  if (rounds <= 0)
+  {
+    std::cerr << "rounds must be positive" << std::endl;
+    return -1;
+  }
+
+  std::cout << "benchmark,impl,tasks,value,unit" << std::endl;
+  const int task_counts[] = {100, 1000, 100000, 1000000};
+  for (int tasks: task_counts)
+  {
+    for (int impl = 0; impl < 2; impl++)
+    {
+      if ((impl == 0 || tasks <= MAX_UTHREADS)
+          && fork_bench (0, impl, tasks) < 0)
+      {
+        return -1;
+      }
+    }
+  }
+  for (int impl = 0; impl < 2; impl++)
+  {
+    if (fork_bench (1, impl, 2) < 0)
+    {
+      return -1;
+    }
+  }
+  return fork_bench (2, 0, 1);
+}
@@ -0,0 +1,71 @@
+#include "thread_queue.h"
+#include "user_thread.h"
+
+Thread_Queue::Thread_Queue () : head (nullptr), tail (nullptr), count (0)
+{}
+
+bool Thread_Queue::empty () const
+{
+  return this->count == 0;
+}
+
+size_t Thread_Queue::size () const
+{
+  return this->count;
+}
+
+User_Thread *Thread_Queue::front () const
+{
+  return this->head;
+}
+
+void Thread_Queue::push_back (User_Thread *thread)
+{
+  thread->queue = this;
+  thread->queue_next = nullptr;
+  thread->queue_prev = this->tail;
+  if (this->tail != nullptr)
+  {
+    this->tail->queue_next = thread;
+  }
+  else
+  {
+    this->head = thread;
+  }
+  this->tail = thread;
+  this->count++;
+}
+
+User_Thread *Thread_Queue::pop_front ()
+{
+  User_Thread *thread = this->head;
+  if (thread != nullptr)
+  {
+    erase (thread);
+  }
+  return thread;
+}
+
+void Thread_Queue::erase (User_Thread *thread)
+{
+  if (thread->queue_prev != nullptr)
+  {
+    thread->queue_prev->queue_next = thread->queue_next;
+  }
+  else
+  {
+    this->head = thread->queue_next;
+  }
+  if (thread->queue_next != nullptr)
+  {
+    thread->queue_next->queue_prev = thread->queue_prev;
+  }
+  else
+  {
+    this->tail = thread->queue_prev;
+  }
+  thread->queue = nullptr;
+  thread->queue_next = nullptr;
+  thread->queue_prev = nullptr;
+  this->count--;
+}
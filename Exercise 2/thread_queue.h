@@ -0,0 +1,39 @@
+#ifndef _THREAD_QUEUE_H_
+#define _THREAD_QUEUE_H_
+
+#include <cstddef>
+
+class User_Thread;
+
+/**
+ * An intrusive FIFO of threads. The links live inside User_Thread, so pushing,
+ * popping and erasing an arbitrary thread are all O(1) and never allocate.
+ * A thread can be a member of at most one queue at a time.
+ */
+class Thread_Queue
+{
+
+ public:
+  // constructor
+  Thread_Queue ();
+
+  bool empty () const;
+
+  size_t size () const;
+
+  User_Thread *front () const;
+
+  void push_back (User_Thread *thread);
+
+  User_Thread *pop_front ();
+
+  // removes the thread from the queue, the thread must be a member of it.
+  void erase (User_Thread *thread);
+
+ private:
+  User_Thread *head;
+  User_Thread *tail;
+  size_t count;
+};
+
+#endif //_THREAD_QUEUE_H_
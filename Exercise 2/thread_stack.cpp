@@ -0,0 +1,265 @@
+#include "thread_stack.h"
+#include "user_thread.h"
+#include "spin_lock.h"
+#include "uthreads_internal.h"
+#include <sys/mman.h>
+#include <ucontext.h>
+#include <unistd.h>
+#include <csignal>
+#include <cstdint>
+#include <cstring>
+#include <new>
+#include <unordered_map>
+#include <algorithm>
+#include <iostream>
+
+// added helper funcs declarations implemented at the end.
+void overflow_handler (int sig, siginfo_t *info, void *context);
+int round_to_pages (long bytes);
+char *take_cached_stack (int stack_size);
+bool cache_stack (char *stack, int stack_size, int usage);
+
+uthread_stack_mode stack_mode = UTHREAD_STACK_PLAIN;
+long page_size;
+// the largest stack usage seen per entry point, guarded by learned_lock.
+Spin_Lock learned_lock;
+std::unordered_map<thread_entry_point, int> learned_usage;
+
+// freed stacks kept for reuse, with the depth their last thread used them to,
+// guarded by cache_lock.
+struct Cached_Stack
+{
+  char *stack;
+  int size;
+  int usage;
+};
+Spin_Lock cache_lock;
+Cached_Stack stack_cache[STACK_CACHE_SIZE];
+int cached_stacks = 0;
+
+void init_stacks (uthread_stack_mode mode)
+{
+  stack_mode = mode;
+  page_size = sysconf (_SC_PAGESIZE);
+  if (stack_mode == UTHREAD_STACK_PLAIN)
+  {
+    return;
+  }
+  struct sigaction sa = {};
+  sa.sa_sigaction = &overflow_handler;
+  sa.sa_flags = SA_SIGINFO | SA_ONSTACK;
+  if (sigaction (SIGSEGV, &sa, nullptr) < 0)
+  {
+    std::cerr << SC_SIG_ACTION_ERR << std::endl;
+    exit (1);
+  }
+  install_overflow_stack ();
+}
+
+void install_overflow_stack ()
+{
+  if (stack_mode == UTHREAD_STACK_PLAIN)
+  {
+    return;
+  }
+  // lives as long as the kernel thread, which is as long as the process.
+  stack_t overflow_stack = {};
+  overflow_stack.ss_sp = new char[OVERFLOW_STACK_SIZE];
+  overflow_stack.ss_size = OVERFLOW_STACK_SIZE;
+  if (sigaltstack (&overflow_stack, nullptr) < 0)
+  {
+    std::cerr << SC_SIGALTSTACK_ERR << std::endl;
+    exit (1);
+  }
+}
+
+thread_entry_point stack_owner (thread_entry_point entry_point,
+                                uthread_start_routine start_routine)
+{
+  if (start_routine != nullptr)
+  {
+    return reinterpret_cast<thread_entry_point> (start_routine);
+  }
+  return entry_point;
+}
+
+int spawn_stack_size (thread_entry_point entry_point, int stack_size)
+{
+  if (stack_mode == UTHREAD_STACK_PLAIN)
+  {
+    return stack_size;
+  }
+  if (stack_mode == UTHREAD_STACK_LEARNED)
+  {
+    learned_lock.lock ();
+    auto it = learned_usage.find (entry_point);
+    int usage = it != learned_usage.end () ? it->second : -1;
+    learned_lock.unlock ();
+    if (usage >= 0)
+    {
+      long learned = (long) usage + usage / 4 + STACK_MARGIN;
+      stack_size = (int) std::min ((long) stack_size,
+                                   std::max (learned, (long) MIN_STACK_SIZE));
+    }
+  }
+  return round_to_pages (stack_size);
+}
+
+char *allocate_stack (int stack_size)
+{
+  char *cached = take_cached_stack (stack_size);
+  if (cached != nullptr)
+  {
+    return cached;
+  }
+  if (stack_mode == UTHREAD_STACK_PLAIN)
+  {
+    return new char[stack_size];
+  }
+  long guard_size = STACK_GUARD_PAGES * page_size;
+  void *mapping = mmap (nullptr, guard_size + stack_size, PROT_NONE,
+                        MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if (mapping == MAP_FAILED)
+  {
+    throw std::bad_alloc ();
+  }
+  char *stack = (char *) mapping + guard_size;
+  if (mprotect (stack, stack_size, PROT_READ | PROT_WRITE) < 0)
+  {
+    munmap (mapping, guard_size + stack_size);
+    throw std::bad_alloc ();
+  }
+  std::memset (stack, STACK_PAINT, stack_size);
+  return stack;
+}
+
+void free_stack (char *stack, int stack_size, thread_entry_point entry_point)
+{
+  if (stack_mode == UTHREAD_STACK_PLAIN)
+  {
+    if (!cache_stack (stack, stack_size, 0))
+    {
+      delete[] stack;
+    }
+    return;
+  }
+  int usage = stack_usage (stack, stack_size);
+  if (stack_mode == UTHREAD_STACK_LEARNED)
+  {
+    learned_lock.lock ();
+    int &learned = learned_usage.emplace (entry_point, 0).first->second;
+    learned = std::max (learned, usage);
+    learned_lock.unlock ();
+  }
+  if (cache_stack (stack, stack_size, usage))
+  {
+    return;
+  }
+  long guard_size = STACK_GUARD_PAGES * page_size;
+  munmap (stack - guard_size, guard_size + stack_size);
+}
+
+int stack_usage (const char *stack, int stack_size)
+{
+  if (stack_mode == UTHREAD_STACK_PLAIN)
+  {
+    return FAILURE;
+  }
+  // the stack grows down, so the first byte from the bottom that lost its
+  // paint is the deepest one the thread reached. stacks are page aligned,
+  // so whole words can be compared first.
+  uint64_t paint;
+  std::memset (&paint, STACK_PAINT, sizeof (paint));
+  const auto *words = (const uint64_t *) stack;
+  int offset = 0;
+  while (offset + (int) sizeof (paint) <= stack_size
+         && words[offset / sizeof (paint)] == paint)
+  {
+    offset += sizeof (paint);
+  }
+  while (offset < stack_size && (unsigned char) stack[offset] == STACK_PAINT)
+  {
+    offset++;
+  }
+  return stack_size - offset;
+}
+
+/**
+ * Reports a fault of the running thread as a stack overflow when it hit the
+ * guard pages, or when the stack pointer is already below the stack, which
+ * catches frames large enough to jump over the guard. Runs on the overflow
+ * stack, since the thread's own is used up.
+ */
+void overflow_handler (int sig, siginfo_t *info, void *context)
+{
+  User_Thread *thread = current_thread ();
+  if (thread == nullptr || thread->stack == nullptr)
+  {
+    signal (SIGSEGV, SIG_DFL);
+    return;
+  }
+  auto *address = (char *) info->si_addr;
+  const greg_t *registers = ((ucontext_t *) context)->uc_mcontext.gregs;
+#ifdef __x86_64__
+  auto *sp = (char *) registers[REG_RSP];
+#else
+  auto *sp = (char *) registers[REG_ESP];
+#endif
+  char *guard = thread->stack - STACK_GUARD_PAGES * page_size;
+  if ((guard <= address && address < thread->stack)
+      || (sp < thread->stack && address < thread->stack))
+  {
+    std::cerr << STACK_OVERFLOW_ERR << " tid: " << thread->get_tid ()
+              << ", stack size: " << thread->get_stack_size () << std::endl;
+    _exit (1);
+  }
+  // any other fault is a plain crash, return into it with the default action.
+  signal (SIGSEGV, SIG_DFL);
+}
+
+/**
+ * Takes a cached stack of stack_size bytes, repainted where its last thread
+ * wrote. returns nullptr if none is cached.
+ */
+char *take_cached_stack (int stack_size)
+{
+  cache_lock.lock ();
+  for (int i = 0; i < cached_stacks; i++)
+  {
+    if (stack_cache[i].size == stack_size)
+    {
+      Cached_Stack cached = stack_cache[i];
+      stack_cache[i] = stack_cache[--cached_stacks];
+      cache_lock.unlock ();
+      if (stack_mode != UTHREAD_STACK_PLAIN)
+      {
+        std::memset (cached.stack + stack_size - cached.usage, STACK_PAINT,
+                     cached.usage);
+      }
+      return cached.stack;
+    }
+  }
+  cache_lock.unlock ();
+  return nullptr;
+}
+
+/**
+ * Keeps a freed stack for reuse. returns false if the cache is full.
+ */
+bool cache_stack (char *stack, int stack_size, int usage)
+{
+  cache_lock.lock ();
+  if (cached_stacks == STACK_CACHE_SIZE)
+  {
+    cache_lock.unlock ();
+    return false;
+  }
+  stack_cache[cached_stacks++] = {stack, stack_size, usage};
+  cache_lock.unlock ();
+  return true;
+}
+
+int round_to_pages (long bytes)
+{
+  return (int) ((bytes + page_size - 1) / page_size * page_size);
+}
@@ -0,0 +1,48 @@
+#ifndef _THREAD_STACK_H_
+#define _THREAD_STACK_H_
+
+#include "uthreads.h"
+
+#define STACK_PAINT 0xa5
+#define OVERFLOW_STACK_SIZE 65536
+#define STACK_CACHE_SIZE 16
+
+/*
+ * Thread stacks. UTHREAD_STACK_PLAIN stacks are plain heap blocks. The other
+ * modes map every stack with STACK_GUARD_PAGES inaccessible pages below it, so
+ * that an overflow faults in the guard instead of corrupting the memory
+ * underneath, and paint it with STACK_PAINT at spawn, so that the lowest byte
+ * the thread ever wrote can be found again.
+ * Freed stacks go to a cache of up to STACK_CACHE_SIZE stacks, which serves
+ * later allocations of the same size without the heap or the kernel. A
+ * painted stack is repainted only as deep as its last thread used it.
+ */
+
+// selects the stack mode and, unless it is plain, installs the overflow
+// handler and an overflow stack for the calling kernel thread.
+void init_stacks (uthread_stack_mode mode);
+
+// gives the calling kernel thread the alternate signal stack the overflow
+// handler runs on. every M:N worker calls it once.
+void install_overflow_stack ();
+
+// the entry point the learned mode files the stack of a thread under: its
+// start routine if it has one, its entry_point otherwise.
+thread_entry_point stack_owner (thread_entry_point entry_point,
+                                uthread_start_routine start_routine);
+
+// the size of the stack of a new thread of entry_point, given the configured
+// stack_size.
+int spawn_stack_size (thread_entry_point entry_point, int stack_size);
+
+// throws std::bad_alloc on failure, as new does.
+char *allocate_stack (int stack_size);
+
+// frees a stack of allocate_stack. in the learned mode, the stack usage of
+// the thread is remembered for the next spawns of entry_point.
+void free_stack (char *stack, int stack_size, thread_entry_point entry_point);
+
+// the high-water mark of a painted stack in bytes, -1 in the plain mode.
+int stack_usage (const char *stack, int stack_size);
+
+#endif //_THREAD_STACK_H_
@@ -0,0 +1,257 @@
+#include "tracer.h"
+#include "uthread_trace.h"
+#include "user_thread.h"
+#include "uthreads_internal.h"
+#include "mn_scheduler.h"
+#include <iostream>
+
+#ifdef UTHREAD_TRACE
+
+#include <atomic>
+#include <fstream>
+#include <ctime>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+/*
+ * The ring is written by every worker at once. A writer claims a slot with a
+ * fetch_add on trace_head and publishes it by storing the slot's sequence
+ * number last, so a reader can tell a finished slot from one that is being
+ * overwritten.
+ */
+struct Trace_Slot
+{
+  // 1 + the index the slot was last written for, 0 while being written.
+  std::atomic<uint64_t> seq;
+  uint64_t tsc;
+  int tid;
+  int worker;
+  Trace_Type type;
+};
+
+// added helper funcs declarations implemented at the end.
+uint64_t read_tsc ();
+uint64_t monotonic_ns ();
+double ticks_per_usec ();
+const char *trace_type_name (Trace_Type type);
+
+Trace_Slot trace_ring[TRACE_RING_SIZE];
+std::atomic<uint64_t> trace_head (0);
+uint64_t trace_start_tsc;
+uint64_t trace_start_ns;
+
+void trace_init ()
+{
+  trace_start_tsc = read_tsc ();
+  trace_start_ns = monotonic_ns ();
+}
+
+void trace_event (Trace_Type type, User_Thread *thread)
+{
+  uint64_t now = read_tsc ();
+  Thread_Metrics &metrics = thread->metrics;
+  switch (type)
+  {
+    case TRACE_READY:
+      if (!metrics.ready)
+      {
+        metrics.ready = true;
+        metrics.ready_since = now;
+      }
+      break;
+    case TRACE_SWITCH_IN:
+      if (metrics.ready)
+      {
+        metrics.wait_ticks += now - metrics.ready_since;
+        metrics.ready = false;
+      }
+      metrics.switched_in = now;
+      metrics.running = true;
+      metrics.switches++;
+      break;
+    case TRACE_SWITCH_OUT:
+    case TRACE_PREEMPT:
+      if (metrics.running)
+      {
+        metrics.cpu_ticks += now - metrics.switched_in;
+        metrics.running = false;
+      }
+      if (type == TRACE_PREEMPT)
+      {
+        metrics.preemptions++;
+      }
+      break;
+    default:
+      break;
+  }
+
+  uint64_t index = trace_head.fetch_add (1, std::memory_order_relaxed);
+  Trace_Slot &slot = trace_ring[index & (TRACE_RING_SIZE - 1)];
+  slot.seq.store (0, std::memory_order_relaxed);
+  std::atomic_thread_fence (std::memory_order_release);
+  slot.tsc = now;
+  slot.tid = thread->get_tid ();
+  slot.worker = mn_worker_id ();
+  slot.type = type;
+  slot.seq.store (index + 1, std::memory_order_release);
+}
+
+int read_metrics (const User_Thread *thread, uthread_metrics *metrics)
+{
+  const Thread_Metrics &m = thread->metrics;
+  double ticks = ticks_per_usec ();
+  uint64_t cpu = m.cpu_ticks;
+  if (m.running)
+  {
+    cpu += read_tsc () - m.switched_in;
+  }
+  metrics->cpu_usecs = (long) ((double) cpu / ticks);
+  metrics->wait_usecs = (long) ((double) m.wait_ticks / ticks);
+  metrics->switches = m.switches;
+  metrics->preemptions = m.preemptions;
+  return SUCCESS;
+}
+
+int uthread_trace_dump (const char *path)
+{
+  if (path == nullptr)
+  {
+    std::cerr << NULL_ERR << std::endl;
+    return FAILURE;
+  }
+  std::ofstream out (path);
+  if (!out)
+  {
+    std::cerr << TRACE_FILE_ERR << std::endl;
+    return FAILURE;
+  }
+  double ticks = ticks_per_usec ();
+  uint64_t head = trace_head.load (std::memory_order_acquire);
+  uint64_t first = head > TRACE_RING_SIZE ? head - TRACE_RING_SIZE : 0;
+  bool separator = false;
+  out << "{\"traceEvents\":[";
+  for (uint64_t index = first; index < head; index++)
+  {
+    Trace_Slot &slot = trace_ring[index & (TRACE_RING_SIZE - 1)];
+    if (slot.seq.load (std::memory_order_acquire) != index + 1)
+    {
+      continue;
+    }
+    uint64_t tsc = slot.tsc;
+    int tid = slot.tid;
+    int worker = slot.worker;
+    Trace_Type type = slot.type;
+    std::atomic_thread_fence (std::memory_order_acquire);
+    if (slot.seq.load (std::memory_order_relaxed) != index + 1)
+    {
+      continue;
+    }
+    double ts = tsc > trace_start_tsc ? (double) (tsc - trace_start_tsc) / ticks
+                                      : 0.0;
+    out << (separator ? ",\n" : "\n") << "{\"name\":\"";
+    separator = true;
+    // every run of a thread is a slice, everything else an instant event.
+    switch (type)
+    {
+      case TRACE_SWITCH_IN:
+        out << "run\",\"ph\":\"B\"";
+        break;
+      case TRACE_SWITCH_OUT:
+      case TRACE_PREEMPT:
+        out << "run\",\"ph\":\"E\"";
+        break;
+      default:
+        out << trace_type_name (type) << "\",\"ph\":\"i\",\"s\":\"t\"";
+    }
+    out << ",\"pid\":1,\"tid\":" << tid << ",\"ts\":" << std::fixed << ts
+        << ",\"args\":{\"worker\":" << worker;
+    if (type == TRACE_SWITCH_OUT || type == TRACE_PREEMPT)
+    {
+      out << ",\"preempted\":" << (type == TRACE_PREEMPT ? "true" : "false");
+    }
+    out << "}}";
+  }
+  out << "\n],\"displayTimeUnit\":\"ns\"}\n";
+  out.close ();
+  if (!out)
+  {
+    std::cerr << TRACE_FILE_ERR << std::endl;
+    return FAILURE;
+  }
+  return SUCCESS;
+}
+
+/**
+ * Reads the time stamp counter, or the monotonic clock in nano-seconds where
+ * there is none.
+ */
+uint64_t read_tsc ()
+{
+#if defined(__x86_64__) || defined(__i386__)
+  return __rdtsc ();
+#else
+  return monotonic_ns ();
+#endif
+}
+
+uint64_t monotonic_ns ()
+{
+  struct timespec t;
+  clock_gettime (CLOCK_MONOTONIC, &t);
+  return (uint64_t) t.tv_sec * 1000000000ULL + (uint64_t) t.tv_nsec;
+}
+
+/**
+ * Calibrates the time stamp counter against the monotonic clock over the time
+ * since trace_init.
+ */
+double ticks_per_usec ()
+{
+  uint64_t ticks = read_tsc () - trace_start_tsc;
+  uint64_t nsecs = monotonic_ns () - trace_start_ns;
+  if (nsecs == 0 || ticks == 0)
+  {
+    return 1000.0;
+  }
+  return (double) ticks * 1000.0 / (double) nsecs;
+}
+
+const char *trace_type_name (Trace_Type type)
+{
+  switch (type)
+  {
+    case TRACE_SPAWN:
+      return "spawn";
+    case TRACE_TERMINATE:
+      return "terminate";
+    case TRACE_BLOCK:
+      return "block";
+    case TRACE_RESUME:
+      return "resume";
+    case TRACE_SLEEP:
+      return "sleep";
+    case TRACE_WAIT:
+      return "wait";
+    case TRACE_READY:
+      return "ready";
+    default:
+      return "switch";
+  }
+}
+
+#else
+
+int read_metrics (const User_Thread *, uthread_metrics *)
+{
+  std::cerr << TRACE_DISABLED_ERR << std::endl;
+  return FAILURE;
+}
+
+int uthread_trace_dump (const char *)
+{
+  std::cerr << TRACE_DISABLED_ERR << std::endl;
+  return FAILURE;
+}
+
+#endif
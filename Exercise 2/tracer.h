@@ -0,0 +1,71 @@
+#ifndef _TRACER_H_
+#define _TRACER_H_
+
+#include "uthread_trace.h"
+#include <cstdint>
+
+class User_Thread;
+
+/*
+ * Scheduler tracing, compiled in with -DUTHREAD_TRACE ('make TRACE=1').
+ * Without it every TRACE_* macro expands to nothing and User_Thread carries no
+ * metrics, so the scheduler pays nothing for the instrumentation.
+ */
+
+enum Trace_Type
+{
+  TRACE_SPAWN,
+  TRACE_TERMINATE,
+  TRACE_BLOCK,
+  TRACE_RESUME,
+  TRACE_SLEEP,
+  // parked on a synchronization primitive or on I/O.
+  TRACE_WAIT,
+  // became runnable and entered a run queue.
+  TRACE_READY,
+  TRACE_SWITCH_IN,
+  // switched out before the end of its quantum.
+  TRACE_SWITCH_OUT,
+  // switched out at the end of its quantum.
+  TRACE_PREEMPT
+};
+
+// the runtime of a thread in time stamp counter ticks, kept up to date by
+// trace_event.
+struct Thread_Metrics
+{
+  uint64_t cpu_ticks;
+  uint64_t wait_ticks;
+  uint64_t switched_in;
+  uint64_t ready_since;
+  int switches;
+  int preemptions;
+  bool running;
+  bool ready;
+};
+
+// fills metrics from the metrics of thread, fails when tracing is not compiled
+// in.
+int read_metrics (const User_Thread *thread, uthread_metrics *metrics);
+
+#ifdef UTHREAD_TRACE
+
+#define TRACE_INIT() trace_init ()
+#define TRACE_EVENT(type, thread) trace_event ((type), (thread))
+#define TRACE_METRICS Thread_Metrics metrics{};
+
+// starts the clock the trace time stamps are relative to.
+void trace_init ();
+
+// records an event of thread in the trace ring and updates its metrics.
+void trace_event (Trace_Type type, User_Thread *thread);
+
+#else
+
+#define TRACE_INIT() ((void) 0)
+#define TRACE_EVENT(type, thread) ((void) 0)
+#define TRACE_METRICS
+
+#endif
+
+#endif //_TRACER_H_
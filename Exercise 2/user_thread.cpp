@@ -1,127 +1,229 @@
-#include "user_thread.h"
-
-#ifdef __x86_64__
-/* code for 64 bit Intel arch */
-
-typedef unsigned long address_t;
-#define JB_SP 6
-#define JB_PC 7
-
-address_t translate_address (address_t addr)
-{
-  address_t ret;
-  asm volatile("xor    %%fs:0x30,%0\n"
-               "rol    $0x11,%0\n"
-      : "=g" (ret)
-      : "0" (addr));
-  return ret;
-}
-
-#else
-/* code for 32 bit Intel arch */
-
-typedef unsigned int address_t;
-#define JB_SP 4
-#define JB_PC 5
-
-address_t translate_address(address_t addr)
-{
-    address_t ret;
-    asm volatile("xor    %%gs:0x18,%0\n"
-                 "rol    $0x9,%0\n"
-    : "=g" (ret)
-    : "0" (addr));
-    return ret;
-}
-#endif
-
-User_Thread::User_Thread (int id, thread_entry_point entry_point) :
-    status (READY), tid (id),  sleep_time (0),
-    quantums_ran (0), initial_func (entry_point)
-{
-  this->stack = nullptr;
-  if(this->tid != 0)
-  {
-    stack = new char[STACK_SIZE];
-    auto sp = (address_t) stack + STACK_SIZE - sizeof (address_t);
-    auto pc = (address_t) entry_point;
-    sigsetjmp(env, 1);
-    env->__jmpbuf[JB_SP] = translate_address (sp);
-    env->__jmpbuf[JB_PC] = translate_address (pc);
-    sigemptyset (&env->__saved_mask);
-  }
-}
-
-
-
-User_Thread::~User_Thread ()
-{
-  if(this->stack != nullptr && this->tid != 0){
-    delete[] this->stack;
-    stack = nullptr;
-  }
-}
-int User_Thread::get_tid () const
-{
-  return this->tid;
-}
-int User_Thread::get_status () const
-{
-  return this->status;
-}
-int User_Thread::get_quantums_ran () const
-{
-  return this->quantums_ran;
-}
-int User_Thread::get_sleep_time () const
-{
-  return this->sleep_time;
-}
-void User_Thread::set_status (int set_status)
-{
-  this->status = set_status;
-}
-void User_Thread::set_sleep_time (int set_sleep_time)
-{
-  this->sleep_time = set_sleep_time;
-}
-User_Thread::User_Thread (const User_Thread &other)
-    : status(other.status), tid(other.tid),
-    sleep_time(other.sleep_time), quantums_ran(other.quantums_ran),
-    initial_func(other.initial_func) {
-  if(other.get_tid() != 0){
-    this->stack = new char[STACK_SIZE];
-    std::memcpy(stack, other.stack, STACK_SIZE);
-  }
-  std::memcpy(&env, &other.env, sizeof(sigjmp_buf));
-}
-
-User_Thread &User_Thread::operator= (const User_Thread &other)
-{
-  if (this != &other) { // Avoid self-assignment
-    // Copy the member variables from the other object
-    this->status = other.status;
-    this->tid = other.tid;
-    this->sleep_time = other.sleep_time;
-    this->quantums_ran = other.quantums_ran;
-    this->initial_func = other.initial_func;
-    if(stack != nullptr){
-      delete[] stack;
-      stack = nullptr;
-    }
-    if(other.get_tid() != 0){
-      this->stack = new char[STACK_SIZE];
-      std::memcpy(this->stack, other.stack, STACK_SIZE);
-    }
-    std::memcpy(&env, &other.env, sizeof(sigjmp_buf));
-  }
-  return *this;
-}
-void User_Thread::set_tid (int id)
-{
-  this->tid = id;
-}
-void User_Thread::inc_quantums_ran ()
-{
-  this->quantums_ran++;
-}
+#include "user_thread.h"
+#include "thread_stack.h"
+#include <new>
+#include <atomic>
+
+// a control block on the free list of the pool.
+struct Free_Block
+{
+  Free_Block *next;
+};
+
+Spin_Lock pool_lock;
+Free_Block *free_blocks = nullptr;
+
+// the generation of the next thread created.
+std::atomic<uint64_t> next_generation (1);
+
+#ifdef __x86_64__
+/* code for 64 bit Intel arch */
+
+typedef unsigned long address_t;
+#define JB_SP 6
+#define JB_PC 7
+
+address_t translate_address (address_t addr)
+{
+  address_t ret;
+  asm volatile("xor    %%fs:0x30,%0\n"
+               "rol    $0x11,%0\n"
+      : "=g" (ret)
+      : "0" (addr));
+  return ret;
+}
+
+#else
+/* code for 32 bit Intel arch */
+
+typedef unsigned int address_t;
+#define JB_SP 4
+#define JB_PC 5
+
+address_t translate_address(address_t addr)
+{
+    address_t ret;
+    asm volatile("xor    %%gs:0x18,%0\n"
+                 "rol    $0x9,%0\n"
+    : "=g" (ret)
+    : "0" (addr));
+    return ret;
+}
+#endif
+
+void setup_thread_context (sigjmp_buf env, char *stack, int stack_size,
+                           thread_entry_point entry_point)
+{
+  auto sp = (address_t) stack + stack_size - sizeof (address_t);
+  auto pc = (address_t) entry_point;
+  sigsetjmp(env, 1);
+  env->__jmpbuf[JB_SP] = translate_address (sp);
+  env->__jmpbuf[JB_PC] = translate_address (pc);
+  sigemptyset (&env->__saved_mask);
+}
+
+User_Thread::User_Thread (int id, thread_entry_point entry_point,
+                          int stack_size, uthread_start_routine start_routine,
+                          void *start_arg) :
+    queue (nullptr), queue_prev (nullptr), queue_next (nullptr),
+    on_cpu (false), queued (false), worker (nullptr), waiting (false),
+    wait_data (nullptr), wait_result (0), waiting_fd (-1),
+    preempt_deferred (false), preempt_pending (false), on_wake (nullptr),
+    specific (),
+    start_routine (start_routine), start_arg (start_arg),
+    exit_result (nullptr), status (READY), tid (id),
+    generation (next_generation.fetch_add (1, std::memory_order_relaxed)),
+    stack_size (stack_size),
+    wake_quantum (0), quantums_ran (0), priority (0), level (0),
+    boost_epoch (0), quantum_shift (0),
+    initial_func (stack_owner (entry_point, start_routine))
+{
+  this->stack = nullptr;
+  // main and the stand-ins of uthread_task.cpp run on no stack of ours.
+  if(this->tid != 0 && stack_size > 0)
+  {
+    stack = allocate_stack (stack_size);
+    setup_thread_context (env, stack, stack_size, entry_point);
+  }
+}
+
+
+
+User_Thread::~User_Thread ()
+{
+  if(this->stack != nullptr && this->tid != 0){
+    free_stack (this->stack, this->stack_size, this->initial_func);
+    stack = nullptr;
+  }
+}
+int User_Thread::get_tid () const
+{
+  return this->tid;
+}
+uint64_t User_Thread::get_generation () const
+{
+  return this->generation;
+}
+int User_Thread::get_status () const
+{
+  return this->status;
+}
+int User_Thread::get_quantums_ran () const
+{
+  return this->quantums_ran;
+}
+int User_Thread::get_wake_quantum () const
+{
+  return this->wake_quantum;
+}
+bool User_Thread::is_sleeping () const
+{
+  return this->wake_quantum != 0;
+}
+bool User_Thread::is_runnable () const
+{
+  return this->status == READY && this->wake_quantum == 0 && !this->waiting;
+}
+int User_Thread::get_priority () const
+{
+  return this->priority;
+}
+int User_Thread::get_level () const
+{
+  return this->level;
+}
+int User_Thread::get_boost_epoch () const
+{
+  return this->boost_epoch;
+}
+int User_Thread::get_quantum_shift () const
+{
+  return this->quantum_shift;
+}
+int User_Thread::get_stack_size () const
+{
+  return this->stack_size;
+}
+void User_Thread::set_status (int set_status)
+{
+  this->status = set_status;
+}
+void User_Thread::set_wake_quantum (int set_wake_quantum)
+{
+  this->wake_quantum = set_wake_quantum;
+}
+void User_Thread::set_priority (int set_priority)
+{
+  this->priority = set_priority;
+}
+void User_Thread::set_level (int set_level, int set_boost_epoch)
+{
+  this->level = set_level;
+  this->boost_epoch = set_boost_epoch;
+}
+void User_Thread::set_quantum_shift (int set_quantum_shift)
+{
+  this->quantum_shift = set_quantum_shift;
+}
+
+void *User_Thread::operator new (std::size_t size)
+{
+  if (size != sizeof (User_Thread))
+  {
+    return ::operator new (size);
+  }
+  pool_lock.lock ();
+  if (free_blocks == nullptr)
+  {
+    // carve a new slab into blocks. slabs are never given back, the pool
+    // stays as large as the most threads that ever existed at once.
+    char *slab;
+    try
+    {
+      slab = static_cast<char *> (
+          ::operator new (THREAD_SLAB_SIZE * sizeof (User_Thread)));
+    }
+    catch (...)
+    {
+      pool_lock.unlock ();
+      throw;
+    }
+    for (int i = 0; i < THREAD_SLAB_SIZE; i++)
+    {
+      auto *block = reinterpret_cast<Free_Block *> (
+          slab + i * sizeof (User_Thread));
+      block->next = free_blocks;
+      free_blocks = block;
+    }
+  }
+  Free_Block *block = free_blocks;
+  free_blocks = block->next;
+  pool_lock.unlock ();
+  return block;
+}
+
+void User_Thread::operator delete (void *block, std::size_t size)
+{
+  if (block == nullptr)
+  {
+    return;
+  }
+  if (size != sizeof (User_Thread))
+  {
+    ::operator delete (block);
+    return;
+  }
+  pool_lock.lock ();
+  auto *free_block = static_cast<Free_Block *> (block);
+  free_block->next = free_blocks;
+  free_blocks = free_block;
+  pool_lock.unlock ();
+}
+
+void User_Thread::set_tid (int id)
+{
+  this->tid = id;
+}
+void User_Thread::inc_quantums_ran ()
+{
+  this->quantums_ran++;
+}
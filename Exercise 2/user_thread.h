@@ -1,61 +1,164 @@
-#ifndef _USER_THREAD_H_
-#define _USER_THREAD_H_
-
-#include "uthreads.h"
-#include <cstdio>
-#include <csignal>
-#include <unistd.h>
-#include <csetjmp>
-#include <sys/time.h>
-#include <cstring>
-#include <iostream>
-
-
-#define READY 1
-#define BLOCKED 2
-#define SLEEPY 3
-
-class User_Thread
-{
-
- public:
-  sigjmp_buf env{};
-  char *stack;
-
-  // constructor
-  User_Thread (int id, thread_entry_point entry_point);
-
-  // copy constructor
-  User_Thread(const User_Thread &other);
-
-  // assignment operator
-  User_Thread& operator=(const User_Thread &other);
-
-  // destructor
-  ~User_Thread ();
-
-  int get_tid () const;
-
-  int get_status () const;
-
-  int get_quantums_ran () const;
-
-  int get_sleep_time () const;
-
-  void set_tid (int id);
-
-  void set_status (int set_status);
-
-  void set_sleep_time (int set_sleep_time);
-
-  void inc_quantums_ran ();
-
- private:
-  int status;
-  int tid;
-  int sleep_time;
-  int quantums_ran;
-  thread_entry_point initial_func;
-};
-
-#endif //_USER_THREAD_H_
+#ifndef _USER_THREAD_H_
+#define _USER_THREAD_H_
+
+#include "uthreads.h"
+#include "spin_lock.h"
+#include "tracer.h"
+#include "uthread_key.h"
+#include <cstdio>
+#include <csignal>
+#include <unistd.h>
+#include <csetjmp>
+#include <sys/time.h>
+#include <cstring>
+#include <cstdint>
+#include <iostream>
+
+class Thread_Queue;
+struct Worker;
+
+
+#define READY 1
+#define BLOCKED 2
+#define TERMINATED 3
+#define THREAD_SLAB_SIZE 64
+
+// points env at entry_point running on top of the given stack, with no
+// signals masked.
+void setup_thread_context (sigjmp_buf env, char *stack, int stack_size,
+                           thread_entry_point entry_point);
+
+class User_Thread
+{
+
+ public:
+  sigjmp_buf env{};
+  char *stack;
+
+  // intrusive links, owned by the Thread_Queue the thread is a member of.
+  Thread_Queue *queue;
+  User_Thread *queue_prev;
+  User_Thread *queue_next;
+
+  // M:N scheduling state, guarded by lock. a thread is on_cpu from the moment
+  // a worker picks it until that worker has left its stack, and queued while
+  // it sits in some worker's run queue.
+  Spin_Lock lock;
+  bool on_cpu;
+  bool queued;
+  Worker *worker;
+
+  // set while the thread is parked on the wait queue of a synchronization
+  // primitive. wait_data and wait_result carry a value from the thread that
+  // wakes it, e.g. a channel item, and are written before the wake up.
+  bool waiting;
+  void *wait_data;
+  int wait_result;
+  // the file descriptor a thread parked by the I/O reactor waits on, -1
+  // otherwise.
+  int waiting_fd;
+  // set while the thread runs key destructors. a tick of the timer then only
+  // sets preempt_pending, and the thread is preempted once they are done.
+  bool preempt_deferred;
+  bool preempt_pending;
+  // set on the stackless stand-ins that wait for coroutine tasks, called
+  // instead of making the stand-in runnable.
+  void (*on_wake) (User_Thread *thread);
+
+  // the values of the thread for every key, see uthread_key.h.
+  void *specific[UTHREAD_KEYS_MAX];
+
+  // what a thread of uthread_spawn_arg runs, and the value it returned.
+  uthread_start_routine start_routine;
+  void *start_arg;
+  void *exit_result;
+
+  // runtime metrics, only present when tracing is compiled in.
+  TRACE_METRICS
+
+  // constructor. threads of uthread_spawn_arg start at entry_point, which
+  // runs start_routine.
+  User_Thread (int id, thread_entry_point entry_point, int stack_size,
+               uthread_start_routine start_routine = nullptr,
+               void *start_arg = nullptr);
+
+  // a thread owns its stack, which its saved context and the queues and wait
+  // queues it is linked into point at, so it is never copied or moved.
+  User_Thread (const User_Thread &other) = delete;
+
+  User_Thread &operator= (const User_Thread &other) = delete;
+
+  User_Thread (User_Thread &&other) = delete;
+
+  User_Thread &operator= (User_Thread &&other) = delete;
+
+  // control blocks come from slabs of THREAD_SLAB_SIZE and go back to a free
+  // list, so spawning and terminating stop allocating once the pool has
+  // grown to the peak number of threads. derived classes use the heap.
+  static void *operator new (std::size_t size);
+
+  static void operator delete (void *block, std::size_t size);
+
+  // destructor
+  ~User_Thread ();
+
+  int get_tid () const;
+
+  // unique among all the threads ever created, unlike the tid and the address
+  // of the control block, which both get reused.
+  uint64_t get_generation () const;
+
+  int get_status () const;
+
+  int get_quantums_ran () const;
+
+  int get_wake_quantum () const;
+
+  int get_priority () const;
+
+  int get_level () const;
+
+  int get_boost_epoch () const;
+
+  int get_quantum_shift () const;
+
+  int get_stack_size () const;
+
+  bool is_sleeping () const;
+
+  // READY, awake and not waiting, i.e. the thread belongs in a run queue.
+  bool is_runnable () const;
+
+  void set_tid (int id);
+
+  void set_status (int set_status);
+
+  void set_wake_quantum (int set_wake_quantum);
+
+  void set_priority (int set_priority);
+
+  void set_level (int set_level, int set_boost_epoch);
+
+  void set_quantum_shift (int set_quantum_shift);
+
+  void inc_quantums_ran ();
+
+ private:
+  int status;
+  int tid;
+  uint64_t generation;
+  int stack_size;
+  // the quantum at which a sleeping thread wakes up, 0 when awake.
+  int wake_quantum;
+  int quantums_ran;
+  // the priority set by the user, and the feedback queue level derived from
+  // it together with the boost epoch the level was computed in.
+  int priority;
+  int level;
+  int boost_epoch;
+  // the adaptive quantum of the thread is quantum_usecs << quantum_shift.
+  int quantum_shift;
+  thread_entry_point initial_func;
+};
+
+#endif //_USER_THREAD_H_
@@ -0,0 +1,607 @@
+// OS 24 EX2
+
+#include <cstdlib>
+#include <cstdint>
+#include <ctime>
+#include <cmath>
+#include <atomic>
+#include <new>
+#include <iostream>
+#include <vector>
+#include <pthread.h>
+#include <sched.h>
+#include <ucontext.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "uthreads.h"
+#include "uthread_sync.h"
+
+#define BENCH_STACK_SIZE 65536
+// long enough that voluntary benchmarks are never preempted.
+#define LONG_QUANTUM_USECS 1000000
+#define SHORT_QUANTUM_USECS 1000
+#define PREEMPTIONS 200
+#define PREEMPT_TIMEOUT_NS 2000000000ULL
+#define SLEEP_QUANTUMS 5
+#define SLEEP_SAMPLES 50
+
+/*
+ * Every benchmark is implemented three times: with uthreads, with pthreads
+ * pinned to one CPU, and with ucontext contexts switched by hand. The ucontext
+ * version is the floor for a user-level switch that saves the signal mask,
+ * the pthread version what the kernel charges for the same work.
+ */
+
+long rounds;
+int num_threads;
+// switch_voluntary keeps the total number of switches at about rounds.
+long yields;
+
+volatile int done_threads = 0;
+volatile uint64_t switches = 0;
+volatile uint64_t switch_time_ns = 0;
+volatile uint64_t last_ns = 0;
+volatile int last_runner = -1;
+volatile int turn = 0;
+
+uthread_sem *done_sem;
+pthread_mutex_t p_mutex = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t p_cond = PTHREAD_COND_INITIALIZER;
+std::vector<ucontext_t> contexts;
+std::vector<char *> stacks;
+ucontext_t main_context;
+// every heap allocation of the process, the library's included.
+std::atomic<long> allocations (0);
+
+void *operator new (std::size_t size)
+{
+  allocations.fetch_add (1, std::memory_order_relaxed);
+  void *block = std::malloc (size != 0 ? size : 1);
+  if (block == nullptr)
+  {
+    throw std::bad_alloc ();
+  }
+  return block;
+}
+
+void operator delete (void *block) noexcept
+{
+  std::free (block);
+}
+
+void operator delete (void *block, std::size_t) noexcept
+{
+  std::free (block);
+}
+
+/**
+ * Reads the monotonic clock.
+ * @return - the current time in nano-seconds.
+ */
+uint64_t now_ns ()
+{
+  struct timespec t;
+  clock_gettime (CLOCK_MONOTONIC, &t);
+  return (uint64_t) t.tv_sec * 1000000000ULL + (uint64_t) t.tv_nsec;
+}
+
+/**
+ * Prints one CSV row.
+ */
+void report (const char *bench, const char *impl, int threads, double value,
+             const char *unit)
+{
+  std::cout << bench << "," << impl << "," << threads << "," << value << ","
+            << unit << std::endl;
+}
+
+/**
+ * Initializes a fresh uthreads instance in which main only waits on done_sem.
+ */
+void init_uthreads (int quantum_usecs, int max_threads)
+{
+  uthread_config config = {quantum_usecs, max_threads, BENCH_STACK_SIZE};
+  if (uthread_init_config (&config) != 0)
+  {
+    exit (1);
+  }
+  done_sem = uthread_sem_create (0);
+}
+
+/**
+ * Marks the calling uthread as finished and terminates it.
+ */
+void uthread_finish ()
+{
+  uthread_sem_post (done_sem);
+  uthread_terminate (uthread_get_tid ());
+}
+
+/**
+ * Keeps every CPU but the first out of the pthread benchmarks, so that their
+ * threads have to switch as uthreads do.
+ */
+void pin_to_one_cpu ()
+{
+  cpu_set_t set;
+  CPU_ZERO (&set);
+  CPU_SET (0, &set);
+  sched_setaffinity (0, sizeof (set), &set);
+}
+
+/**
+ * Allocates num contexts that start at entry_point and return to main_context.
+ */
+void make_contexts (int num, void (*entry_point) ())
+{
+  contexts.resize (num);
+  for (int i = 0; i < num; i++)
+  {
+    stacks.push_back (new char[BENCH_STACK_SIZE]);
+    getcontext (&contexts[i]);
+    contexts[i].uc_stack.ss_sp = stacks.back ();
+    contexts[i].uc_stack.ss_size = BENCH_STACK_SIZE;
+    contexts[i].uc_link = &main_context;
+    makecontext (&contexts[i], entry_point, 0);
+  }
+}
+
+// switch_voluntary: num_threads threads that give up the CPU in turn.
+
+void uthread_yielder ()
+{
+  for (long i = 0; i < yields; i++)
+  {
+    uthread_yield ();
+  }
+  uthread_finish ();
+}
+
+void *pthread_yielder (void *)
+{
+  for (long i = 0; i < yields; i++)
+  {
+    sched_yield ();
+  }
+  return nullptr;
+}
+
+int current_context = 0;
+
+void ucontext_yielder ()
+{
+  for (long i = 0; i < yields; i++)
+  {
+    int self = current_context;
+    current_context = (self + 1) % num_threads;
+    swapcontext (&contexts[self], &contexts[current_context]);
+  }
+  // the first context to finish ends the benchmark.
+}
+
+// switch_preemptive: two busy threads, every change of the running thread
+// is timed from the last time stamp of one to the first of the other.
+
+void busy_runner (int self)
+{
+  uint64_t start = now_ns ();
+  while (switches < PREEMPTIONS && now_ns () - start < PREEMPT_TIMEOUT_NS)
+  {
+    if (last_runner != self)
+    {
+      // read the clock only after seeing the switch, a time stamp taken
+      // before it may be older than the other thread's last one.
+      uint64_t t = now_ns ();
+      if (last_runner != -1 && t > last_ns)
+      {
+        switch_time_ns += t - last_ns;
+        switches++;
+      }
+      last_runner = self;
+    }
+    last_ns = now_ns ();
+  }
+}
+
+void uthread_busy_runner ()
+{
+  busy_runner (uthread_get_tid ());
+  uthread_finish ();
+}
+
+void *pthread_busy_runner (void *arg)
+{
+  busy_runner ((int) (intptr_t) arg);
+  return nullptr;
+}
+
+// spawn_terminate: threads that do nothing but end.
+
+void uthread_empty ()
+{
+  uthread_finish ();
+}
+
+void *pthread_empty (void *)
+{
+  return nullptr;
+}
+
+void *uthread_empty_routine (void *)
+{
+  return nullptr;
+}
+
+void ucontext_empty ()
+{}
+
+// block_resume: two threads that resume each other and block themselves.
+
+void uthread_ping ()
+{
+  int self = uthread_get_tid ();
+  int other = 3 - self;
+  for (long i = 0; i < rounds; i++)
+  {
+    uthread_resume (other);
+    uthread_block (self);
+  }
+  // the other thread is still blocked only if it has not finished first.
+  if (++done_threads == 1)
+  {
+    uthread_resume (other);
+  }
+  uthread_finish ();
+}
+
+void *pthread_ping (void *arg)
+{
+  int self = (int) (intptr_t) arg;
+  for (long i = 0; i < rounds; i++)
+  {
+    pthread_mutex_lock (&p_mutex);
+    while (turn != self)
+    {
+      pthread_cond_wait (&p_cond, &p_mutex);
+    }
+    turn = 1 - self;
+    pthread_cond_signal (&p_cond);
+    pthread_mutex_unlock (&p_mutex);
+  }
+  return nullptr;
+}
+
+void ucontext_ping ()
+{
+  for (long i = 0; i < rounds; i++)
+  {
+    swapcontext (&contexts[0], &contexts[1]);
+  }
+}
+
+void ucontext_pong ()
+{
+  for (;;)
+  {
+    swapcontext (&contexts[1], &contexts[0]);
+  }
+}
+
+// sleep_accuracy: a thread that sleeps while main keeps the CPU busy.
+
+void uthread_sleeper ()
+{
+  for (int i = 0; i < SLEEP_SAMPLES; i++)
+  {
+    uint64_t start = now_ns ();
+    uthread_sleep (SLEEP_QUANTUMS);
+    double elapsed_us = (double) (now_ns () - start) / 1000.0;
+    switch_time_ns += (uint64_t) (1000.0
+        * std::fabs (elapsed_us - SLEEP_QUANTUMS * SHORT_QUANTUM_USECS));
+  }
+  done_threads = 1;
+  uthread_terminate (uthread_get_tid ());
+}
+
+/**
+ * Runs one benchmark with one implementation and prints its result.
+ */
+void run_bench (int bench, int impl)
+{
+  uint64_t start, end;
+  switch (bench * 3 + impl)
+  {
+    // switch_voluntary
+    case 0:
+      init_uthreads (LONG_QUANTUM_USECS, num_threads + 1);
+      start = now_ns ();
+      for (int i = 0; i < num_threads; i++)
+      {
+        uthread_spawn (uthread_yielder);
+      }
+      for (int i = 0; i < num_threads; i++)
+      {
+        uthread_sem_wait (done_sem);
+      }
+      end = now_ns ();
+      report ("switch_voluntary", "uthread", num_threads,
+              (double) (end - start) / (yields * num_threads), "ns");
+      uthread_terminate (0);
+      break;
+    case 1:
+    {
+      pin_to_one_cpu ();
+      std::vector<pthread_t> threads (num_threads);
+      start = now_ns ();
+      for (pthread_t &thread: threads)
+      {
+        pthread_create (&thread, nullptr, pthread_yielder, nullptr);
+      }
+      for (pthread_t &thread: threads)
+      {
+        pthread_join (thread, nullptr);
+      }
+      end = now_ns ();
+      report ("switch_voluntary", "pthread", num_threads,
+              (double) (end - start) / (yields * num_threads), "ns");
+      break;
+    }
+    case 2:
+      make_contexts (num_threads, ucontext_yielder);
+      start = now_ns ();
+      swapcontext (&main_context, &contexts[0]);
+      end = now_ns ();
+      report ("switch_voluntary", "ucontext", num_threads,
+              (double) (end - start) / (yields * num_threads), "ns");
+      break;
+
+    // switch_preemptive
+    case 3:
+      init_uthreads (SHORT_QUANTUM_USECS, 3);
+      uthread_spawn (uthread_busy_runner);
+      uthread_spawn (uthread_busy_runner);
+      uthread_sem_wait (done_sem);
+      uthread_sem_wait (done_sem);
+      report ("switch_preemptive", "uthread", 2,
+              (double) switch_time_ns / (switches ? switches : 1), "ns");
+      uthread_terminate (0);
+      break;
+    case 4:
+    {
+      pin_to_one_cpu ();
+      pthread_t threads[2];
+      for (intptr_t i = 0; i < 2; i++)
+      {
+        pthread_create (&threads[i], nullptr, pthread_busy_runner, (void *) i);
+      }
+      pthread_join (threads[0], nullptr);
+      pthread_join (threads[1], nullptr);
+      report ("switch_preemptive", "pthread", 2,
+              (double) switch_time_ns / (switches ? switches : 1), "ns");
+      break;
+    }
+
+    // spawn_terminate
+    case 6:
+      init_uthreads (LONG_QUANTUM_USECS, 2);
+      start = now_ns ();
+      for (long i = 0; i < rounds; i++)
+      {
+        uthread_spawn (uthread_empty);
+        uthread_sem_wait (done_sem);
+      }
+      end = now_ns ();
+      report ("spawn_terminate", "uthread", 1,
+              (double) (end - start) / rounds, "ns");
+      // the timed rounds warmed the pools up, from here on a spawn and its
+      // end, or a spawn and its join, should not touch the heap.
+      {
+        long before = allocations.load ();
+        for (long i = 0; i < rounds; i++)
+        {
+          uthread_spawn (uthread_empty);
+          uthread_sem_wait (done_sem);
+          uthread_join (uthread_spawn_arg (uthread_empty_routine, nullptr),
+                        nullptr);
+        }
+        report ("spawn_allocations", "uthread", 1,
+                (double) (allocations.load () - before) / (2 * rounds),
+                "allocs");
+      }
+      uthread_terminate (0);
+      break;
+    case 7:
+      start = now_ns ();
+      for (long i = 0; i < rounds; i++)
+      {
+        pthread_t thread;
+        pthread_create (&thread, nullptr, pthread_empty, nullptr);
+        pthread_join (thread, nullptr);
+      }
+      end = now_ns ();
+      report ("spawn_terminate", "pthread", 1,
+              (double) (end - start) / rounds, "ns");
+      {
+        long before = allocations.load ();
+        for (long i = 0; i < rounds; i++)
+        {
+          pthread_t thread;
+          pthread_create (&thread, nullptr, pthread_empty, nullptr);
+          pthread_join (thread, nullptr);
+        }
+        report ("spawn_allocations", "pthread", 1,
+                (double) (allocations.load () - before) / rounds, "allocs");
+      }
+      break;
+    case 8:
+      start = now_ns ();
+      for (long i = 0; i < rounds; i++)
+      {
+        char *stack = new char[BENCH_STACK_SIZE];
+        ucontext_t context;
+        getcontext (&context);
+        context.uc_stack.ss_sp = stack;
+        context.uc_stack.ss_size = BENCH_STACK_SIZE;
+        context.uc_link = &main_context;
+        makecontext (&context, ucontext_empty, 0);
+        swapcontext (&main_context, &context);
+        delete[] stack;
+      }
+      end = now_ns ();
+      report ("spawn_terminate", "ucontext", 1,
+              (double) (end - start) / rounds, "ns");
+      break;
+
+    // block_resume
+    case 9:
+      init_uthreads (LONG_QUANTUM_USECS, 3);
+      uthread_spawn (uthread_ping);
+      uthread_spawn (uthread_ping);
+      start = now_ns ();
+      uthread_sem_wait (done_sem);
+      end = now_ns ();
+      report ("block_resume", "uthread", 2, (double) (end - start) / rounds,
+              "ns");
+      uthread_terminate (0);
+      break;
+    case 10:
+    {
+      pin_to_one_cpu ();
+      pthread_t threads[2];
+      start = now_ns ();
+      for (intptr_t i = 0; i < 2; i++)
+      {
+        pthread_create (&threads[i], nullptr, pthread_ping, (void *) i);
+      }
+      pthread_join (threads[0], nullptr);
+      pthread_join (threads[1], nullptr);
+      end = now_ns ();
+      report ("block_resume", "pthread", 2, (double) (end - start) / rounds,
+              "ns");
+      break;
+    }
+    case 11:
+      make_contexts (2, ucontext_pong);
+      makecontext (&contexts[0], ucontext_ping, 0);
+      start = now_ns ();
+      swapcontext (&main_context, &contexts[0]);
+      end = now_ns ();
+      report ("block_resume", "ucontext", 2, (double) (end - start) / rounds,
+              "ns");
+      break;
+
+    // sleep_accuracy
+    case 12:
+      init_uthreads (SHORT_QUANTUM_USECS, 2);
+      uthread_spawn (uthread_sleeper);
+      while (!done_threads)
+      {}
+      report ("sleep_accuracy", "uthread", 1,
+              (double) switch_time_ns / SLEEP_SAMPLES / 1000.0, "us");
+      uthread_terminate (0);
+      break;
+    case 13:
+      for (int i = 0; i < SLEEP_SAMPLES; i++)
+      {
+        struct timespec sleep = {0, SLEEP_QUANTUMS * SHORT_QUANTUM_USECS
+                                    * 1000L};
+        uint64_t t0 = now_ns ();
+        nanosleep (&sleep, nullptr);
+        double elapsed_us = (double) (now_ns () - t0) / 1000.0;
+        switch_time_ns += (uint64_t) (1000.0 * std::fabs (
+            elapsed_us - SLEEP_QUANTUMS * SHORT_QUANTUM_USECS));
+      }
+      report ("sleep_accuracy", "pthread", 1,
+              (double) switch_time_ns / SLEEP_SAMPLES / 1000.0, "us");
+      break;
+    default:
+      break;
+  }
+  exit (0);
+}
+
+/**
+ * Runs a benchmark in a child process, since the library can only be
+ * initialized once.
+ * @return - 0 on success, -1 if the child failed.
+ */
+int fork_bench (int bench, int impl, int threads)
+{
+  num_threads = threads;
+  yields = rounds / threads > 0 ? rounds / threads : 1;
+  pid_t pid = fork ();
+  if (pid < 0)
+  {
+    std::cerr << "fork failed." << std::endl;
+    return -1;
+  }
+  if (pid == 0)
+  {
+    run_bench (bench, impl);
+  }
+  int status;
+  waitpid (pid, &status, 0);
+  if (!WIFEXITED (status) || WEXITSTATUS (status) != 0)
+  {
+    std::cerr << "benchmark " << bench << " of implementation " << impl
+              << " failed." << std::endl;
+    return -1;
+  }
+  return 0;
+}
+
+/**
+ * Measures the basic operations of the library next to pthread and ucontext
+ * baselines:
+ *      - switch_voluntary: cost of a thread giving up the CPU to the next one,
+ *        with 2 to 1000 threads to show how the scheduler scales.
+ *      - switch_preemptive: time from the last instruction of a preempted busy
+ *        thread to the first of the next one.
+ *      - spawn_terminate: cost of creating a thread, running it and ending it.
+ *        spawn_allocations counts the heap allocations of the same cycle
+ *        once it has warmed up, uthread_spawn_arg and uthread_join included.
+ *      - block_resume: round trip of two threads waking each other.
+ *      - sleep_accuracy: mean distance of the wake up time of a thread
+ *        sleeping SLEEP_QUANTUMS quantums from SLEEP_QUANTUMS * quantum.
+ * ucontext cannot preempt or sleep, so it is missing from those two.
+ * Usage: './uthread_bench [rounds]' where:
+ *      - rounds - the number of operations per measurement (default 10000).
+ * The program will print output to stdout in the following format:
+ *      benchmark,impl,threads,value,unit
+ *      benchmark_1,impl_1,threads_1,value_1,unit_1
+ *              ...
+ */
+int main (int argc, char *argv[])
+{
+  rounds = argc > 1 ? atol (argv[1]) : 10000;
+  if (rounds <= 0)
+  {
+    std::cerr << "rounds must be positive" << std::endl;
+    return -1;
+  }
+
+  std::cout << "benchmark,impl,threads,value,unit" << std::endl;
+  const int thread_counts[] = {2, 10, 100, 1000};
+  for (int threads: thread_counts)
+  {
+    for (int impl = 0; impl < 3; impl++)
+    {
+      if (fork_bench (0, impl, threads) < 0)
+      {
+        return -1;
+      }
+    }
+  }
+  for (int bench = 1; bench < 5; bench++)
+  {
+    for (int impl = 0; impl < 3; impl++)
+    {
+      bool has_baseline = impl != 2 || bench == 2 || bench == 3;
+      if (has_baseline && fork_bench (bench, impl, 2) < 0)
+      {
+        return -1;
+      }
+    }
+  }
+  return 0;
+}
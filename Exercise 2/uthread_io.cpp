@@ -0,0 +1,292 @@
+#include "uthread_io.h"
+#include "user_thread.h"
+#include "thread_queue.h"
+#include "spin_lock.h"
+#include "uthreads_internal.h"
+#include <sys/epoll.h>
+#include <fcntl.h>
+#include <cerrno>
+#include <atomic>
+#include <vector>
+#include <iostream>
+
+#define IO_EVENTS 64
+
+/*
+ * The reactor keeps, for every file descriptor a thread waits on, a queue of
+ * waiting readers and one of waiting writers, and registers the file
+ * descriptor with epoll for exactly the directions that have waiters. It is
+ * level-triggered, so readiness that arrives between a call failing with
+ * EAGAIN and the thread parking is still reported by the next poll.
+ * A readiness event wakes every waiter of its direction, and each of them
+ * retries its call.
+ * errno is shared by all the threads of a kernel thread, so the calls run
+ * with SIGVTALRM blocked until their errno has been read.
+ */
+
+struct Fd_Waiters
+{
+  Thread_Queue readers;
+  Thread_Queue writers;
+  // the events fd is registered for, 0 when it is not registered.
+  uint32_t events;
+};
+
+// added helper funcs declarations implemented at the end.
+int set_nonblocking (int fd);
+void wait_fd (int fd, uint32_t direction);
+Fd_Waiters *fd_waiters_of (int fd);
+void register_fd (int fd, Fd_Waiters *waiters, uint32_t events);
+void wake_all (Thread_Queue *wait_queue);
+
+// guarded by reactor_lock. entries are allocated once per fd and never move,
+// since parked threads point at their queues.
+Spin_Lock reactor_lock;
+std::vector<Fd_Waiters *> fd_waiters;
+int epoll_fd = -1;
+// the number of registered file descriptors, read without the lock.
+std::atomic<int> registered_fds (0);
+
+ssize_t uthread_read (int fd, void *buf, size_t count)
+{
+  if (set_nonblocking (fd) == FAILURE)
+  {
+    return FAILURE;
+  }
+  for (;;)
+  {
+    block_alarm_signal ();
+    ssize_t ret = read (fd, buf, count);
+    int error = errno;
+    unblock_alarm_signal ();
+    if (ret >= 0 || (error != EAGAIN && error != EWOULDBLOCK))
+    {
+      errno = error;
+      return ret;
+    }
+    wait_fd (fd, EPOLLIN);
+  }
+}
+
+ssize_t uthread_write (int fd, const void *buf, size_t count)
+{
+  if (set_nonblocking (fd) == FAILURE)
+  {
+    return FAILURE;
+  }
+  for (;;)
+  {
+    block_alarm_signal ();
+    ssize_t ret = write (fd, buf, count);
+    int error = errno;
+    unblock_alarm_signal ();
+    if (ret >= 0 || (error != EAGAIN && error != EWOULDBLOCK))
+    {
+      errno = error;
+      return ret;
+    }
+    wait_fd (fd, EPOLLOUT);
+  }
+}
+
+int uthread_accept (int fd, struct sockaddr *addr, socklen_t *addrlen)
+{
+  if (set_nonblocking (fd) == FAILURE)
+  {
+    return FAILURE;
+  }
+  for (;;)
+  {
+    block_alarm_signal ();
+    int ret = accept (fd, addr, addrlen);
+    int error = errno;
+    unblock_alarm_signal ();
+    if (ret >= 0 || (error != EAGAIN && error != EWOULDBLOCK))
+    {
+      errno = error;
+      return ret;
+    }
+    wait_fd (fd, EPOLLIN);
+  }
+}
+
+bool io_pending ()
+{
+  return registered_fds.load (std::memory_order_relaxed) > 0;
+}
+
+void poll_io (int timeout_ms)
+{
+  // another worker is already polling.
+  if (!reactor_lock.try_lock ())
+  {
+    return;
+  }
+  struct epoll_event events[IO_EVENTS];
+  int ready = epoll_wait (epoll_fd, events, IO_EVENTS, timeout_ms);
+  if (ready < 0 && errno != EINTR)
+  {
+    std::cerr << SC_EPOLL_ERR << std::endl;
+    exit (1);
+  }
+  for (int i = 0; i < ready; i++)
+  {
+    int fd = events[i].data.fd;
+    Fd_Waiters *waiters = fd_waiters[fd];
+    // errors and hang ups wake both directions, their calls will report them.
+    if (events[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP))
+    {
+      wake_all (&waiters->readers);
+    }
+    if (events[i].events & (EPOLLOUT | EPOLLERR | EPOLLHUP))
+    {
+      wake_all (&waiters->writers);
+    }
+    register_fd (fd, waiters, 0);
+  }
+  reactor_lock.unlock ();
+}
+
+/**
+ * Makes fd non-blocking, leaving errno set on failure.
+ * @return On success, 0. On failure, -1.
+ */
+int set_nonblocking (int fd)
+{
+  int flags = fcntl (fd, F_GETFL);
+  if (flags < 0)
+  {
+    return FAILURE;
+  }
+  if (!(flags & O_NONBLOCK) && fcntl (fd, F_SETFL, flags | O_NONBLOCK) < 0)
+  {
+    return FAILURE;
+  }
+  return SUCCESS;
+}
+
+/**
+ * Parks the calling thread until the reactor sees fd ready for direction,
+ * EPOLLIN or EPOLLOUT.
+ */
+void wait_fd (int fd, uint32_t direction)
+{
+  block_alarm_signal ();
+  reactor_lock.lock ();
+  Fd_Waiters *waiters = fd_waiters_of (fd);
+  register_fd (fd, waiters, direction);
+  User_Thread *self = current_thread ();
+  self->waiting_fd = fd;
+  park_thread (direction == EPOLLIN ? &waiters->readers : &waiters->writers,
+               &reactor_lock);
+  self->waiting_fd = -1;
+  unblock_alarm_signal ();
+}
+
+void drop_fd_waiter (int fd)
+{
+  reactor_lock.lock ();
+  Fd_Waiters *waiters = fd_waiters[fd];
+  // in the M:N mode the terminated thread is still queued, waking it frees
+  // it. the other waiters retry their calls and park again.
+  wake_all (&waiters->readers);
+  wake_all (&waiters->writers);
+  register_fd (fd, waiters, 0);
+  reactor_lock.unlock ();
+}
+
+void queue_fd_waiter (int fd, uint32_t direction, User_Thread *waiter)
+{
+  reactor_lock.lock ();
+  Fd_Waiters *waiters = fd_waiters_of (fd);
+  register_fd (fd, waiters, direction);
+  waiter->waiting = true;
+  Thread_Queue &queue = direction == EPOLLIN ? waiters->readers
+                                             : waiters->writers;
+  queue.push_back (waiter);
+  reactor_lock.unlock ();
+}
+
+/**
+ * Returns the waiters of fd, creating the epoll instance and the entry of fd
+ * on first use. The caller must hold reactor_lock.
+ */
+Fd_Waiters *fd_waiters_of (int fd)
+{
+  if (epoll_fd < 0)
+  {
+    epoll_fd = epoll_create1 (EPOLL_CLOEXEC);
+    if (epoll_fd < 0)
+    {
+      std::cerr << SC_EPOLL_ERR << std::endl;
+      exit (1);
+    }
+  }
+  if ((int) fd_waiters.size () <= fd)
+  {
+    fd_waiters.resize (fd + 1, nullptr);
+  }
+  if (fd_waiters[fd] == nullptr)
+  {
+    fd_waiters[fd] = new Fd_Waiters;
+    fd_waiters[fd]->events = 0;
+  }
+  return fd_waiters[fd];
+}
+
+/**
+ * Registers fd for the directions that have waiters, plus the extra events
+ * of a thread that is about to wait. The caller must hold reactor_lock.
+ */
+void register_fd (int fd, Fd_Waiters *waiters, uint32_t events)
+{
+  if (!waiters->readers.empty ())
+  {
+    events |= EPOLLIN;
+  }
+  if (!waiters->writers.empty ())
+  {
+    events |= EPOLLOUT;
+  }
+  if (events == waiters->events)
+  {
+    return;
+  }
+  struct epoll_event event = {};
+  event.events = events;
+  event.data.fd = fd;
+  int op = EPOLL_CTL_MOD;
+  if (waiters->events == 0)
+  {
+    op = EPOLL_CTL_ADD;
+    registered_fds++;
+  }
+  else if (events == 0)
+  {
+    op = EPOLL_CTL_DEL;
+    registered_fds--;
+  }
+  // a file descriptor closed while registered has left the epoll set, and
+  // its number may since have been reused.
+  if (epoll_ctl (epoll_fd, op, fd, &event) < 0
+      && !(op == EPOLL_CTL_DEL && (errno == ENOENT || errno == EBADF))
+      && !(op == EPOLL_CTL_MOD && errno == ENOENT
+           && epoll_ctl (epoll_fd, EPOLL_CTL_ADD, fd, &event) == 0))
+  {
+    std::cerr << SC_EPOLL_ERR << std::endl;
+    exit (1);
+  }
+  waiters->events = events;
+}
+
+/**
+ * Wakes every thread on wait_queue so that each retries its call.
+ */
+void wake_all (Thread_Queue *wait_queue)
+{
+  User_Thread *thread;
+  while ((thread = wait_queue->pop_front ()) != nullptr)
+  {
+    unpark_thread (thread);
+  }
+}
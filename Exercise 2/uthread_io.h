@@ -0,0 +1,45 @@
+/*
+ * User-Level Threads Library (uthreads) - blocking I/O.
+ *
+ * Plain read(2), write(2) and accept(2) on a pipe or a socket block the kernel
+ * thread, and with it every uthread that runs on it. The functions below make
+ * the file descriptor non-blocking and, whenever the call would block, park
+ * only the calling uthread until the scheduler's epoll reactor sees the file
+ * descriptor become ready. The reactor is polled on every context switch, and
+ * waited on while no thread is ready to run.
+ * The file descriptor stays non-blocking afterwards. Regular files are always
+ * ready, so calls on them simply go through.
+ */
+#ifndef _UTHREAD_IO_H
+#define _UTHREAD_IO_H
+
+#include <sys/types.h>
+#include <sys/socket.h>
+
+
+/**
+ * @brief Reads up to count bytes from fd into buf, as read(2), parking the calling thread until fd is readable.
+ *
+ * @return On success, return the number of bytes read, 0 at end of file. On failure, return -1 and set errno.
+*/
+ssize_t uthread_read(int fd, void *buf, size_t count);
+
+/**
+ * @brief Writes up to count bytes from buf to fd, as write(2), parking the calling thread until fd is writable.
+ *
+ * As with write(2), fewer than count bytes may be written.
+ *
+ * @return On success, return the number of bytes written. On failure, return -1 and set errno.
+*/
+ssize_t uthread_write(int fd, const void *buf, size_t count);
+
+/**
+ * @brief Accepts a connection on the listening socket fd, as accept(2), parking the calling thread until a
+ * connection arrives.
+ *
+ * @return On success, return the file descriptor of the accepted socket. On failure, return -1 and set errno.
+*/
+int uthread_accept(int fd, struct sockaddr *addr, socklen_t *addrlen);
+
+
+#endif
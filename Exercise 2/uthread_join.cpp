@@ -0,0 +1,136 @@
+#include "uthreads.h"
+#include "user_thread.h"
+#include "thread_queue.h"
+#include "spin_lock.h"
+#include "uthreads_internal.h"
+#include <deque>
+#include <iostream>
+
+/*
+ * Every tid has a join slot holding the threads waiting for the thread with
+ * that tid to end. A thread with a start routine is joinable: when it ends
+ * with nobody waiting, its slot keeps the result and its tid stays taken until
+ * uthread_join collects it. Other threads free their tid as they end.
+ * The slots are guarded by join_lock, which ranks below the thread table lock
+ * of the scheduler and above the locks of the threads.
+ */
+
+struct Join_Slot
+{
+  Thread_Queue joiners;
+  void *result = nullptr;
+  bool joinable = false;
+  // true while no thread has the tid, a slot of a tid never used included.
+  bool ended = true;
+};
+
+Spin_Lock join_lock;
+// a deque never moves its elements, so the joiners queues stay where their
+// threads point.
+std::deque<Join_Slot> join_slots;
+
+int uthread_join (int tid, void **result)
+{
+  if (tid == 0 || tid == uthread_get_tid ())
+  {
+    std::cerr << JOIN_SELF_ERR << std::endl;
+    return FAILURE;
+  }
+  if (tid < 0)
+  {
+    std::cerr << INCORRECT_TID_ERR << std::endl;
+    return FAILURE;
+  }
+  block_alarm_signal ();
+  join_lock.lock ();
+  if (tid >= (int) join_slots.size ()
+      || (join_slots[tid].ended && !join_slots[tid].joinable))
+  {
+    join_lock.unlock ();
+    std::cerr << NONEXISTENT_THREAD_ERR << std::endl;
+    unblock_alarm_signal ();
+    return FAILURE;
+  }
+  Join_Slot &slot = join_slots[tid];
+  void *value;
+  if (slot.ended)
+  {
+    // the thread ended before anyone joined it, its tid was kept for us.
+    value = slot.result;
+    slot.joinable = false;
+    join_lock.unlock ();
+    release_thread_tid (tid);
+  }
+  else
+  {
+    User_Thread *self = current_thread ();
+    park_thread (&slot.joiners, &join_lock);
+    value = self->wait_data;
+  }
+  unblock_alarm_signal ();
+  if (result != nullptr)
+  {
+    *result = value;
+  }
+  return SUCCESS;
+}
+
+/**
+ * The entry point of every thread with a start routine: runs it, and ends the
+ * thread with the value it returns.
+ */
+void run_start_routine ()
+{
+  User_Thread *self = current_thread ();
+  self->exit_result = self->start_routine (self->start_arg);
+  uthread_terminate (uthread_get_tid ());
+}
+
+void reserve_join_slots (int count)
+{
+  join_lock.lock ();
+  try
+  {
+    while ((int) join_slots.size () < count)
+    {
+      join_slots.emplace_back ();
+    }
+  }
+  catch (...)
+  {
+    join_lock.unlock ();
+    throw;
+  }
+  join_lock.unlock ();
+}
+
+void reset_join_slot (int tid, bool joinable)
+{
+  join_lock.lock ();
+  Join_Slot &slot = join_slots[tid];
+  slot.result = nullptr;
+  slot.joinable = joinable;
+  slot.ended = false;
+  join_lock.unlock ();
+}
+
+bool end_join_slot (int tid, void *result)
+{
+  join_lock.lock ();
+  Join_Slot &slot = join_slots[tid];
+  slot.ended = true;
+  slot.result = result;
+  bool joined = false;
+  User_Thread *joiner;
+  while ((joiner = slot.joiners.pop_front ()) != nullptr)
+  {
+    joiner->wait_data = result;
+    joiner->wait_result = SUCCESS;
+    // a joiner terminated while waiting collects nothing.
+    joined = unpark_thread (joiner) || joined;
+  }
+  slot.joinable = slot.joinable && !joined;
+  bool keep_tid = slot.joinable;
+  join_lock.unlock ();
+  return keep_tid;
+}
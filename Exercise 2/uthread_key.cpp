@@ -0,0 +1,93 @@
+#include "uthread_key.h"
+#include "user_thread.h"
+#include "spin_lock.h"
+#include "uthreads_internal.h"
+#include <atomic>
+#include <iostream>
+
+/*
+ * Keys are handed out in order and never deleted, so a key is valid iff it is
+ * below key_count, and its destructor never changes once it is created.
+ * A key is reserved under key_lock, and key_count is published with release
+ * semantics only once its destructor is stored, so whoever reads key_count
+ * with acquire semantics sees the destructor of every key below it.
+ */
+
+Spin_Lock key_lock;
+uthread_key_destructor key_destructors[UTHREAD_KEYS_MAX];
+std::atomic<int> key_count (0);
+
+int uthread_key_create (uthread_key_t *key, uthread_key_destructor destructor)
+{
+  if (key == nullptr)
+  {
+    std::cerr << NULL_ERR << std::endl;
+    return FAILURE;
+  }
+  block_alarm_signal ();
+  key_lock.lock ();
+  int next = key_count.load (std::memory_order_relaxed);
+  if (next == UTHREAD_KEYS_MAX)
+  {
+    key_lock.unlock ();
+    unblock_alarm_signal ();
+    std::cerr << KEYS_EXHAUSTED_ERR << std::endl;
+    return FAILURE;
+  }
+  key_destructors[next] = destructor;
+  key_count.store (next + 1, std::memory_order_release);
+  key_lock.unlock ();
+  unblock_alarm_signal ();
+  *key = next;
+  return SUCCESS;
+}
+
+void *uthread_getspecific (uthread_key_t key)
+{
+  if ((unsigned) key >= UTHREAD_KEYS_MAX)
+  {
+    return nullptr;
+  }
+  return current_thread ()->specific[key];
+}
+
+int uthread_setspecific (uthread_key_t key, const void *value)
+{
+  if (key < 0 || key >= key_count.load (std::memory_order_relaxed))
+  {
+    std::cerr << INCORRECT_KEY_ERR << std::endl;
+    return FAILURE;
+  }
+  current_thread ()->specific[key] = const_cast<void *> (value);
+  return SUCCESS;
+}
+
+void run_key_destructors (int tid, uint64_t generation)
+{
+  void *values[UTHREAD_KEYS_MAX];
+  // the caller is not preempted halfway through, so in the 1:1 mode the thread
+  // whose values they are cannot run and set new ones meanwhile.
+  defer_preemption ();
+  for (int round = 0; round < UTHREAD_DESTRUCTOR_ITERATIONS; round++)
+  {
+    if (!take_thread_values (tid, generation, values))
+    {
+      break;
+    }
+    bool called = false;
+    int keys = key_count.load (std::memory_order_acquire);
+    for (int key = 0; key < keys; key++)
+    {
+      if (values[key] != nullptr && key_destructors[key] != nullptr)
+      {
+        key_destructors[key] (values[key]);
+        called = true;
+      }
+    }
+    if (!called)
+    {
+      break;
+    }
+  }
+  allow_preemption ();
+}
@@ -0,0 +1,56 @@
+/*
+ * User-Level Threads Library (uthreads) - thread-specific data.
+ *
+ * Every thread has UTHREAD_KEYS_MAX value slots stored inline in its control
+ * block, one per key, all null when the thread is spawned. Reading or writing
+ * the calling thread's slot is an array access: it makes no system call and
+ * leaves the signal mask alone, so it is cheap enough for hot paths that
+ * would otherwise look data up by uthread_get_tid.
+ * The functions work in both the 1:1 and the M:N mode of the library, and must
+ * only be used after uthread_init or uthread_init_config.
+ */
+#ifndef _UTHREAD_KEY_H
+#define _UTHREAD_KEY_H
+
+#define UTHREAD_KEYS_MAX 16 /* number of keys a process may create */
+#define UTHREAD_DESTRUCTOR_ITERATIONS 4 /* rounds of destructors run for a terminating thread */
+
+typedef int uthread_key_t;
+
+typedef void (*uthread_key_destructor)(void *);
+
+
+/**
+ * @brief Creates a new key, visible to all threads, and stores it in key.
+ *
+ * destructor may be null. Otherwise, when a thread other than main is terminated while its value for the key is not
+ * null, uthread_terminate sets the value to null and calls destructor with the old value, in the calling thread,
+ * before the thread is terminated. Destructors that set values again are run again, up to
+ * UTHREAD_DESTRUCTOR_ITERATIONS rounds. The calling thread is not preempted while destructors run, unless one of them
+ * blocks or yields. Terminating the main thread, or a tid naming no thread, runs no destructor.
+ * Keys cannot be deleted. It is an error to create more than UTHREAD_KEYS_MAX keys, or to pass a null key.
+ *
+ * @return On success, return 0. On failure, return -1.
+*/
+int uthread_key_create(uthread_key_t *key, uthread_key_destructor destructor);
+
+/**
+ * @brief Returns the value of the calling thread for key, null if it was never set.
+ *
+ * An invalid key also returns null, without an error message, so that the call stays a bare array access.
+ *
+ * @return The value of the calling thread for key.
+*/
+void *uthread_getspecific(uthread_key_t key);
+
+/**
+ * @brief Sets the value of the calling thread for key.
+ *
+ * It is an error to pass a key that was not returned by uthread_key_create.
+ *
+ * @return On success, return 0. On failure, return -1.
+*/
+int uthread_setspecific(uthread_key_t key, const void *value);
+
+
+#endif
@@ -0,0 +1,635 @@
+#include "uthread_sync.h"
+#include "user_thread.h"
+#include "thread_queue.h"
+#include "spin_lock.h"
+#include "uthreads_internal.h"
+#include <vector>
+#include <iostream>
+
+#define WOULD_BLOCK 1
+#define CHANNEL_CLOSED 1
+
+/*
+ * Every primitive keeps its state and its wait queues under a Spin_Lock of its
+ * own. In the 1:1 mode SIGVTALRM is blocked inside the library, so the lock is
+ * never contended there; in the M:N mode it orders the workers.
+ * A thread that has to wait parks itself on a wait queue, and whoever makes
+ * the awaited thing available hands it to the first waiter directly (the mutex
+ * ownership, the semaphore unit, the channel item) before waking it, so a woken
+ * thread never has to compete for it again.
+ */
+
+struct uthread_mutex
+{
+  Spin_Lock lock;
+  // the tid and generation of the holder, -1 and 0 when unlocked. a control
+  // block, and with it the address of a thread, is reused once the thread
+  // terminates, the generation never is.
+  int owner_tid;
+  uint64_t owner_generation;
+  Thread_Queue waiters;
+};
+
+struct uthread_cond
+{
+  Spin_Lock lock;
+  Thread_Queue waiters;
+};
+
+struct uthread_sem
+{
+  Spin_Lock lock;
+  int value;
+  Thread_Queue waiters;
+};
+
+struct uthread_chan
+{
+  Spin_Lock lock;
+  // a ring of capacity items, count of them starting at head.
+  std::vector<void *> items;
+  int head;
+  int count;
+  bool closed;
+  // senders wait with their item in wait_data, receivers get theirs there.
+  Thread_Queue senders;
+  Thread_Queue receivers;
+};
+
+// added helper funcs declarations implemented at the end.
+User_Thread *wake_waiter (Thread_Queue *wait_queue, void *data, int result);
+void set_owner (uthread_mutex *mutex, const User_Thread *thread);
+bool is_locked (const uthread_mutex *mutex);
+bool is_owner (const uthread_mutex *mutex, const User_Thread *thread);
+bool take_sender (uthread_chan *chan, void **item);
+int lock_mutex (uthread_mutex *mutex);
+int unlock_mutex (uthread_mutex *mutex);
+
+uthread_mutex *uthread_mutex_create ()
+{
+  try
+  {
+    auto *mutex = new uthread_mutex;
+    set_owner (mutex, nullptr);
+    return mutex;
+  }
+  catch (const std::exception &)
+  {
+    std::cerr << SYNC_ALLOC_ERR << std::endl;
+    return nullptr;
+  }
+}
+
+int uthread_mutex_destroy (uthread_mutex *mutex)
+{
+  if (mutex == nullptr)
+  {
+    std::cerr << NULL_ERR << std::endl;
+    return FAILURE;
+  }
+  if (is_locked (mutex) || !mutex->waiters.empty ())
+  {
+    std::cerr << PRIMITIVE_BUSY_ERR << std::endl;
+    return FAILURE;
+  }
+  delete mutex;
+  return SUCCESS;
+}
+
+int uthread_mutex_lock (uthread_mutex *mutex)
+{
+  if (mutex == nullptr)
+  {
+    std::cerr << NULL_ERR << std::endl;
+    return FAILURE;
+  }
+  block_alarm_signal ();
+  int ret = lock_mutex (mutex);
+  unblock_alarm_signal ();
+  return ret;
+}
+
+int uthread_mutex_trylock (uthread_mutex *mutex)
+{
+  if (mutex == nullptr)
+  {
+    std::cerr << NULL_ERR << std::endl;
+    return FAILURE;
+  }
+  block_alarm_signal ();
+  User_Thread *self = current_thread ();
+  mutex->lock.lock ();
+  int ret = SUCCESS;
+  if (!is_locked (mutex))
+  {
+    set_owner (mutex, self);
+  }
+  else if (is_owner (mutex, self))
+  {
+    std::cerr << MUTEX_RELOCK_ERR << std::endl;
+    ret = FAILURE;
+  }
+  else
+  {
+    ret = WOULD_BLOCK;
+  }
+  mutex->lock.unlock ();
+  unblock_alarm_signal ();
+  return ret;
+}
+
+int uthread_mutex_unlock (uthread_mutex *mutex)
+{
+  if (mutex == nullptr)
+  {
+    std::cerr << NULL_ERR << std::endl;
+    return FAILURE;
+  }
+  block_alarm_signal ();
+  int ret = unlock_mutex (mutex);
+  reschedule_if_outranked ();
+  unblock_alarm_signal ();
+  return ret;
+}
+
+uthread_cond *uthread_cond_create ()
+{
+  try
+  {
+    return new uthread_cond;
+  }
+  catch (const std::exception &)
+  {
+    std::cerr << SYNC_ALLOC_ERR << std::endl;
+    return nullptr;
+  }
+}
+
+int uthread_cond_destroy (uthread_cond *cond)
+{
+  if (cond == nullptr)
+  {
+    std::cerr << NULL_ERR << std::endl;
+    return FAILURE;
+  }
+  if (!cond->waiters.empty ())
+  {
+    std::cerr << PRIMITIVE_BUSY_ERR << std::endl;
+    return FAILURE;
+  }
+  delete cond;
+  return SUCCESS;
+}
+
+int uthread_cond_wait (uthread_cond *cond, uthread_mutex *mutex)
+{
+  if (cond == nullptr || mutex == nullptr)
+  {
+    std::cerr << NULL_ERR << std::endl;
+    return FAILURE;
+  }
+  block_alarm_signal ();
+  // holding the cond lock across the unlock means no signal can slip in
+  // between releasing the mutex and parking.
+  cond->lock.lock ();
+  if (unlock_mutex (mutex) == FAILURE)
+  {
+    cond->lock.unlock ();
+    unblock_alarm_signal ();
+    return FAILURE;
+  }
+  park_thread (&cond->waiters, &cond->lock);
+  block_alarm_signal ();
+  int ret = lock_mutex (mutex);
+  unblock_alarm_signal ();
+  return ret;
+}
+
+int uthread_cond_signal (uthread_cond *cond)
+{
+  if (cond == nullptr)
+  {
+    std::cerr << NULL_ERR << std::endl;
+    return FAILURE;
+  }
+  block_alarm_signal ();
+  cond->lock.lock ();
+  wake_waiter (&cond->waiters, nullptr, SUCCESS);
+  cond->lock.unlock ();
+  reschedule_if_outranked ();
+  unblock_alarm_signal ();
+  return SUCCESS;
+}
+
+int uthread_cond_broadcast (uthread_cond *cond)
+{
+  if (cond == nullptr)
+  {
+    std::cerr << NULL_ERR << std::endl;
+    return FAILURE;
+  }
+  block_alarm_signal ();
+  cond->lock.lock ();
+  while (wake_waiter (&cond->waiters, nullptr, SUCCESS) != nullptr)
+  {}
+  cond->lock.unlock ();
+  reschedule_if_outranked ();
+  unblock_alarm_signal ();
+  return SUCCESS;
+}
+
+uthread_sem *uthread_sem_create (int value)
+{
+  if (value < 0)
+  {
+    std::cerr << INCORRECT_SEM_VALUE_ERR << std::endl;
+    return nullptr;
+  }
+  try
+  {
+    auto *sem = new uthread_sem;
+    sem->value = value;
+    return sem;
+  }
+  catch (const std::exception &)
+  {
+    std::cerr << SYNC_ALLOC_ERR << std::endl;
+    return nullptr;
+  }
+}
+
+int uthread_sem_destroy (uthread_sem *sem)
+{
+  if (sem == nullptr)
+  {
+    std::cerr << NULL_ERR << std::endl;
+    return FAILURE;
+  }
+  if (!sem->waiters.empty ())
+  {
+    std::cerr << PRIMITIVE_BUSY_ERR << std::endl;
+    return FAILURE;
+  }
+  delete sem;
+  return SUCCESS;
+}
+
+int uthread_sem_wait (uthread_sem *sem)
+{
+  if (sem == nullptr)
+  {
+    std::cerr << NULL_ERR << std::endl;
+    return FAILURE;
+  }
+  block_alarm_signal ();
+  sem->lock.lock ();
+  if (sem->value > 0)
+  {
+    sem->value--;
+    sem->lock.unlock ();
+  }
+  else
+  {
+    // a post hands its unit over without touching value.
+    park_thread (&sem->waiters, &sem->lock);
+  }
+  unblock_alarm_signal ();
+  return SUCCESS;
+}
+
+int uthread_sem_trywait (uthread_sem *sem)
+{
+  if (sem == nullptr)
+  {
+    std::cerr << NULL_ERR << std::endl;
+    return FAILURE;
+  }
+  block_alarm_signal ();
+  sem->lock.lock ();
+  int ret = WOULD_BLOCK;
+  if (sem->value > 0)
+  {
+    sem->value--;
+    ret = SUCCESS;
+  }
+  sem->lock.unlock ();
+  unblock_alarm_signal ();
+  return ret;
+}
+
+int uthread_sem_post (uthread_sem *sem)
+{
+  if (sem == nullptr)
+  {
+    std::cerr << NULL_ERR << std::endl;
+    return FAILURE;
+  }
+  block_alarm_signal ();
+  sem->lock.lock ();
+  if (wake_waiter (&sem->waiters, nullptr, SUCCESS) == nullptr)
+  {
+    sem->value++;
+  }
+  sem->lock.unlock ();
+  reschedule_if_outranked ();
+  unblock_alarm_signal ();
+  return SUCCESS;
+}
+
+uthread_chan *uthread_chan_create (int capacity)
+{
+  if (capacity < 0)
+  {
+    std::cerr << INCORRECT_CHAN_CAPACITY_ERR << std::endl;
+    return nullptr;
+  }
+  try
+  {
+    auto *chan = new uthread_chan;
+    chan->items.resize (capacity);
+    chan->head = 0;
+    chan->count = 0;
+    chan->closed = false;
+    return chan;
+  }
+  catch (const std::exception &)
+  {
+    std::cerr << SYNC_ALLOC_ERR << std::endl;
+    return nullptr;
+  }
+}
+
+int uthread_chan_destroy (uthread_chan *chan)
+{
+  if (chan == nullptr)
+  {
+    std::cerr << NULL_ERR << std::endl;
+    return FAILURE;
+  }
+  if (!chan->senders.empty () || !chan->receivers.empty ())
+  {
+    std::cerr << PRIMITIVE_BUSY_ERR << std::endl;
+    return FAILURE;
+  }
+  delete chan;
+  return SUCCESS;
+}
+
+int uthread_chan_send (uthread_chan *chan, void *item)
+{
+  if (chan == nullptr)
+  {
+    std::cerr << NULL_ERR << std::endl;
+    return FAILURE;
+  }
+  block_alarm_signal ();
+  chan->lock.lock ();
+  if (chan->closed)
+  {
+    chan->lock.unlock ();
+    std::cerr << CHAN_CLOSED_ERR << std::endl;
+    unblock_alarm_signal ();
+    return FAILURE;
+  }
+  // a waiting receiver means the ring is empty, skip it.
+  if (wake_waiter (&chan->receivers, item, SUCCESS) != nullptr)
+  {
+    chan->lock.unlock ();
+    reschedule_if_outranked ();
+    unblock_alarm_signal ();
+    return SUCCESS;
+  }
+  int capacity = (int) chan->items.size ();
+  if (chan->count < capacity)
+  {
+    chan->items[(chan->head + chan->count) % capacity] = item;
+    chan->count++;
+    chan->lock.unlock ();
+    unblock_alarm_signal ();
+    return SUCCESS;
+  }
+  User_Thread *self = current_thread ();
+  self->wait_data = item;
+  park_thread (&chan->senders, &chan->lock);
+  int ret = self->wait_result;
+  if (ret == FAILURE)
+  {
+    std::cerr << CHAN_CLOSED_ERR << std::endl;
+  }
+  unblock_alarm_signal ();
+  return ret;
+}
+
+int uthread_chan_recv (uthread_chan *chan, void **item)
+{
+  if (chan == nullptr || item == nullptr)
+  {
+    std::cerr << NULL_ERR << std::endl;
+    return FAILURE;
+  }
+  block_alarm_signal ();
+  int ret = chan_receive (chan, item, nullptr);
+  unblock_alarm_signal ();
+  return ret;
+}
+
+int chan_receive (uthread_chan *chan, void **item, User_Thread *waiter)
+{
+  chan->lock.lock ();
+  int capacity = (int) chan->items.size ();
+  if (chan->count > 0)
+  {
+    *item = chan->items[chan->head];
+    chan->head = (chan->head + 1) % capacity;
+    chan->count--;
+    // the freed slot goes to the longest waiting sender.
+    void *sent;
+    if (take_sender (chan, &sent))
+    {
+      chan->items[(chan->head + chan->count) % capacity] = sent;
+      chan->count++;
+    }
+    chan->lock.unlock ();
+    reschedule_if_outranked ();
+    return SUCCESS;
+  }
+  // an empty ring with waiting senders is an unbuffered channel.
+  if (take_sender (chan, item))
+  {
+    chan->lock.unlock ();
+    reschedule_if_outranked ();
+    return SUCCESS;
+  }
+  if (chan->closed)
+  {
+    chan->lock.unlock ();
+    return CHANNEL_CLOSED;
+  }
+  if (waiter != nullptr)
+  {
+    waiter->waiting = true;
+    chan->receivers.push_back (waiter);
+    chan->lock.unlock ();
+    return WAIT_QUEUED;
+  }
+  User_Thread *self = current_thread ();
+  park_thread (&chan->receivers, &chan->lock);
+  int ret = self->wait_result;
+  if (ret == SUCCESS)
+  {
+    *item = self->wait_data;
+  }
+  return ret;
+}
+
+int uthread_chan_close (uthread_chan *chan)
+{
+  if (chan == nullptr)
+  {
+    std::cerr << NULL_ERR << std::endl;
+    return FAILURE;
+  }
+  block_alarm_signal ();
+  chan->lock.lock ();
+  chan->closed = true;
+  while (wake_waiter (&chan->receivers, nullptr, CHANNEL_CLOSED) != nullptr)
+  {}
+  while (wake_waiter (&chan->senders, nullptr, FAILURE) != nullptr)
+  {}
+  chan->lock.unlock ();
+  reschedule_if_outranked ();
+  unblock_alarm_signal ();
+  return SUCCESS;
+}
+
+/**
+ * Wakes the longest waiting thread on wait_queue that is still alive, handing
+ * it data and result first. The caller must hold the lock guarding the queue.
+ * @return the woken thread, or nullptr if no thread was waiting.
+ */
+User_Thread *wake_waiter (Thread_Queue *wait_queue, void *data, int result)
+{
+  User_Thread *thread;
+  while ((thread = wait_queue->pop_front ()) != nullptr)
+  {
+    thread->wait_data = data;
+    thread->wait_result = result;
+    if (unpark_thread (thread))
+    {
+      return thread;
+    }
+  }
+  return nullptr;
+}
+
+/**
+ * Takes the item of the longest waiting sender that is still alive and wakes
+ * it. The caller must hold the channel lock.
+ * @return true if a sender was waiting.
+ */
+bool take_sender (uthread_chan *chan, void **item)
+{
+  User_Thread *sender;
+  while ((sender = chan->senders.pop_front ()) != nullptr)
+  {
+    void *sent = sender->wait_data;
+    sender->wait_result = SUCCESS;
+    if (unpark_thread (sender))
+    {
+      *item = sent;
+      return true;
+    }
+  }
+  return false;
+}
+
+/**
+ * Locks the mutex, the caller must have SIGVTALRM blocked.
+ * @return On success, 0. On failure, -1.
+ */
+int lock_mutex (uthread_mutex *mutex)
+{
+  User_Thread *self = current_thread ();
+  mutex->lock.lock ();
+  if (!is_locked (mutex))
+  {
+    set_owner (mutex, self);
+    mutex->lock.unlock ();
+    return SUCCESS;
+  }
+  if (is_owner (mutex, self))
+  {
+    mutex->lock.unlock ();
+    std::cerr << MUTEX_RELOCK_ERR << std::endl;
+    return FAILURE;
+  }
+  // unlock_mutex makes us the owner before waking us.
+  park_thread (&mutex->waiters, &mutex->lock);
+  return SUCCESS;
+}
+
+/**
+ * Unlocks the mutex, handing it to the longest waiting thread, the caller must
+ * have SIGVTALRM blocked.
+ * @return On success, 0. On failure, -1.
+ */
+int unlock_mutex (uthread_mutex *mutex)
+{
+  User_Thread *self = current_thread ();
+  mutex->lock.lock ();
+  if (!is_owner (mutex, self))
+  {
+    mutex->lock.unlock ();
+    std::cerr << MUTEX_NOT_OWNER_ERR << std::endl;
+    return FAILURE;
+  }
+  // the owner is set before the waiter is woken, once awake it may run on
+  // and terminate without taking the lock again.
+  User_Thread *next;
+  while ((next = mutex->waiters.pop_front ()) != nullptr)
+  {
+    next->wait_data = nullptr;
+    next->wait_result = SUCCESS;
+    set_owner (mutex, next);
+    if (unpark_thread (next))
+    {
+      break;
+    }
+  }
+  if (next == nullptr)
+  {
+    set_owner (mutex, nullptr);
+  }
+  mutex->lock.unlock ();
+  return SUCCESS;
+}
+
+/**
+ * Makes thread the holder of the mutex, or unlocks it for nullptr. The caller
+ * must hold the mutex lock.
+ */
+void set_owner (uthread_mutex *mutex, const User_Thread *thread)
+{
+  mutex->owner_tid = thread != nullptr ? thread->get_tid () : -1;
+  mutex->owner_generation = thread != nullptr ? thread->get_generation () : 0;
+}
+
+/**
+ * @return true if some thread holds the mutex. The caller must hold the mutex
+ * lock.
+ */
+bool is_locked (const uthread_mutex *mutex)
+{
+  return mutex->owner_generation != 0;
+}
+
+/**
+ * @return true if thread holds the mutex, false as well for a new thread that
+ * got the tid or the control block of a holder which terminated. The caller
+ * must hold the mutex lock.
+ */
+bool is_owner (const uthread_mutex *mutex, const User_Thread *thread)
+{
+  return mutex->owner_tid == thread->get_tid ()
+         && mutex->owner_generation == thread->get_generation ();
+}
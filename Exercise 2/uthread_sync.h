@@ -0,0 +1,177 @@
+/*
+ * User-Level Threads Library (uthreads) - synchronization primitives.
+ *
+ * A thread that has to wait on one of these primitives is parked on the
+ * primitive's own wait queue and does not run, or use up quantums, until the
+ * primitive hands it what it waited for. Waiters are woken in FIFO order.
+ * The primitives work in both the 1:1 and the M:N mode of the library, and must
+ * only be used after uthread_init or uthread_init_config.
+ */
+#ifndef _UTHREAD_SYNC_H
+#define _UTHREAD_SYNC_H
+
+typedef struct uthread_mutex uthread_mutex;
+typedef struct uthread_cond uthread_cond;
+typedef struct uthread_sem uthread_sem;
+typedef struct uthread_chan uthread_chan;
+
+
+/**
+ * @brief Creates an unlocked mutex.
+ *
+ * @return On success, return the new mutex. On failure, return nullptr.
+*/
+uthread_mutex *uthread_mutex_create();
+
+/**
+ * @brief Frees a mutex. It is an error to destroy a mutex that is locked.
+ *
+ * @return On success, return 0. On failure, return -1.
+*/
+int uthread_mutex_destroy(uthread_mutex *mutex);
+
+/**
+ * @brief Locks the mutex, waiting while another thread holds it.
+ *
+ * The mutex is not recursive: it is an error to lock a mutex the calling thread already holds.
+ * Unlocking hands the mutex directly to the thread that has waited the longest.
+ *
+ * @return On success, return 0. On failure, return -1.
+*/
+int uthread_mutex_lock(uthread_mutex *mutex);
+
+/**
+ * @brief Locks the mutex if no thread holds it, without waiting.
+ *
+ * @return On success, return 0. If another thread holds the mutex, return 1. On failure, return -1.
+*/
+int uthread_mutex_trylock(uthread_mutex *mutex);
+
+/**
+ * @brief Unlocks the mutex. It is an error to unlock a mutex the calling thread does not hold.
+ *
+ * @return On success, return 0. On failure, return -1.
+*/
+int uthread_mutex_unlock(uthread_mutex *mutex);
+
+
+/**
+ * @brief Creates a condition variable.
+ *
+ * @return On success, return the new condition variable. On failure, return nullptr.
+*/
+uthread_cond *uthread_cond_create();
+
+/**
+ * @brief Frees a condition variable. It is an error to destroy a condition variable threads are waiting on.
+ *
+ * @return On success, return 0. On failure, return -1.
+*/
+int uthread_cond_destroy(uthread_cond *cond);
+
+/**
+ * @brief Unlocks the mutex and waits on the condition variable, as one atomic step.
+ *
+ * The mutex must be held by the calling thread. It is locked again before the function returns. As with
+ * pthread_cond_wait, callers should re-check their condition in a loop.
+ *
+ * @return On success, return 0. On failure, return -1.
+*/
+int uthread_cond_wait(uthread_cond *cond, uthread_mutex *mutex);
+
+/**
+ * @brief Wakes the thread that has waited the longest on the condition variable, if any.
+ *
+ * @return On success, return 0. On failure, return -1.
+*/
+int uthread_cond_signal(uthread_cond *cond);
+
+/**
+ * @brief Wakes every thread waiting on the condition variable.
+ *
+ * @return On success, return 0. On failure, return -1.
+*/
+int uthread_cond_broadcast(uthread_cond *cond);
+
+
+/**
+ * @brief Creates a counting semaphore with the given non-negative initial value.
+ *
+ * @return On success, return the new semaphore. On failure, return nullptr.
+*/
+uthread_sem *uthread_sem_create(int value);
+
+/**
+ * @brief Frees a semaphore. It is an error to destroy a semaphore threads are waiting on.
+ *
+ * @return On success, return 0. On failure, return -1.
+*/
+int uthread_sem_destroy(uthread_sem *sem);
+
+/**
+ * @brief Decrements the semaphore, waiting while its value is 0.
+ *
+ * @return On success, return 0. On failure, return -1.
+*/
+int uthread_sem_wait(uthread_sem *sem);
+
+/**
+ * @brief Decrements the semaphore if its value is positive, without waiting.
+ *
+ * @return On success, return 0. If the value is 0, return 1. On failure, return -1.
+*/
+int uthread_sem_trywait(uthread_sem *sem);
+
+/**
+ * @brief Increments the semaphore. If threads are waiting, the longest waiting one takes the unit instead.
+ *
+ * @return On success, return 0. On failure, return -1.
+*/
+int uthread_sem_post(uthread_sem *sem);
+
+
+/**
+ * @brief Creates a bounded multi-producer multi-consumer channel of pointers.
+ *
+ * A channel holds up to capacity items. A capacity of 0 makes an unbuffered channel, on which every send waits for a
+ * receiver to take its item.
+ *
+ * @return On success, return the new channel. On failure, return nullptr.
+*/
+uthread_chan *uthread_chan_create(int capacity);
+
+/**
+ * @brief Frees a channel. It is an error to destroy a channel threads are waiting on.
+ *
+ * @return On success, return 0. On failure, return -1.
+*/
+int uthread_chan_destroy(uthread_chan *chan);
+
+/**
+ * @brief Sends an item, waiting while the channel is full.
+ *
+ * If a receiver is waiting, the item is handed to it directly. It is an error to send on a closed channel, including
+ * a channel that gets closed while the sender waits.
+ *
+ * @return On success, return 0. On failure, return -1.
+*/
+int uthread_chan_send(uthread_chan *chan, void *item);
+
+/**
+ * @brief Receives the oldest item into *item, waiting while the channel is empty.
+ *
+ * Items sent before the channel was closed are still received after it is closed.
+ *
+ * @return On success, return 0. If the channel is closed and empty, return 1. On failure, return -1.
+*/
+int uthread_chan_recv(uthread_chan *chan, void **item);
+
+/**
+ * @brief Closes the channel. Waiting receivers return 1 and waiting senders fail. Closing twice is harmless.
+ *
+ * @return On success, return 0. On failure, return -1.
+*/
+int uthread_chan_close(uthread_chan *chan);
+
+
+#endif
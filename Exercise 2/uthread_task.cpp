@@ -0,0 +1,275 @@
+#include "uthread_task.h"
+#include "user_thread.h"
+#include "thread_queue.h"
+#include "spin_lock.h"
+#include "uthreads_internal.h"
+#include <sys/epoll.h>
+#include <functional>
+#include <queue>
+#include <vector>
+#include <iostream>
+
+/*
+ * All tasks run on the executor, a uthread that resumes ready tasks one after
+ * the other and parks on executor_queue when none is ready. A task that waits
+ * on a channel or a file descriptor is represented on the wait queue of the
+ * primitive by a Task_Waiter, a User_Thread with no stack whose on_wake makes
+ * the task ready again, so the primitives wake tasks and uthreads alike.
+ * The ready tasks and the pool of waiters are guarded by task_lock, which is
+ * only taken with SIGVTALRM blocked. The sleeping tasks are only touched by
+ * the executor, and need no lock.
+ */
+
+using uthread::detail::schedule_task;
+
+struct Task_Waiter : User_Thread
+{
+  std::coroutine_handle<> handle;
+  // where a channel item and the result of the wait go, null for fd waits.
+  void **item;
+  int *result;
+
+  Task_Waiter () : User_Thread (-1, nullptr, 0), item (nullptr),
+                   result (nullptr)
+  {}
+};
+
+struct Sleeping_Task
+{
+  int wake_quantum;
+  std::coroutine_handle<> handle;
+
+  bool operator> (const Sleeping_Task &other) const
+  {
+    return wake_quantum > other.wake_quantum;
+  }
+};
+
+// added helper funcs declarations implemented at the end.
+void executor_main ();
+void wake_sleeping_tasks ();
+void queue_ready_task (std::coroutine_handle<> handle);
+Task_Waiter *take_waiter (std::coroutine_handle<> handle, void **item,
+                          int *result);
+void task_wake (User_Thread *thread);
+
+Spin_Lock task_lock;
+bool executor_started = false;
+Thread_Queue executor_queue;
+// the executor swaps ready_tasks with running_tasks, so both keep their
+// capacity and resuming tasks allocates nothing in steady state.
+std::vector<std::coroutine_handle<> > ready_tasks;
+std::vector<std::coroutine_handle<> > running_tasks;
+std::vector<Task_Waiter *> free_waiters;
+std::priority_queue<Sleeping_Task, std::vector<Sleeping_Task>,
+                    std::greater<Sleeping_Task> > sleeping_tasks;
+
+namespace uthread
+{
+namespace detail
+{
+
+int spawn_task (std::coroutine_handle<> handle)
+{
+  block_alarm_signal ();
+  task_lock.lock ();
+  if (executor_started)
+  {
+    queue_ready_task (handle);
+    task_lock.unlock ();
+    unblock_alarm_signal ();
+    return SUCCESS;
+  }
+  executor_started = true;
+  task_lock.unlock ();
+  unblock_alarm_signal ();
+  // spawned outside task_lock, uthread_spawn may switch threads.
+  if (uthread_spawn (&executor_main) < 0)
+  {
+    block_alarm_signal ();
+    task_lock.lock ();
+    executor_started = false;
+    task_lock.unlock ();
+    unblock_alarm_signal ();
+    return FAILURE;
+  }
+  schedule_task (handle);
+  return SUCCESS;
+}
+
+void schedule_task (std::coroutine_handle<> handle)
+{
+  block_alarm_signal ();
+  task_lock.lock ();
+  queue_ready_task (handle);
+  task_lock.unlock ();
+  unblock_alarm_signal ();
+}
+
+void sleep_task (std::coroutine_handle<> handle, int quantums)
+{
+  if (quantums <= 0)
+  {
+    schedule_task (handle);
+    return;
+  }
+  sleeping_tasks.push ({uthread_get_total_quantums () + quantums, handle});
+}
+
+bool recv_task (std::coroutine_handle<> handle, uthread_chan *chan,
+                void **item, int *result)
+{
+  if (chan == nullptr || item == nullptr)
+  {
+    std::cerr << NULL_ERR << std::endl;
+    *result = FAILURE;
+    return false;
+  }
+  block_alarm_signal ();
+  Task_Waiter *waiter = take_waiter (handle, item, result);
+  int ret = chan_receive (chan, item, waiter);
+  if (ret != WAIT_QUEUED)
+  {
+    // the waiter was never queued, and the task goes on right away.
+    *result = ret;
+    task_lock.lock ();
+    free_waiters.push_back (waiter);
+    task_lock.unlock ();
+  }
+  unblock_alarm_signal ();
+  return ret == WAIT_QUEUED;
+}
+
+void wait_fd_task (std::coroutine_handle<> handle, int fd, bool write)
+{
+  block_alarm_signal ();
+  Task_Waiter *waiter = take_waiter (handle, nullptr, nullptr);
+  queue_fd_waiter (fd, write ? EPOLLOUT : EPOLLIN, waiter);
+  unblock_alarm_signal ();
+}
+
+} // namespace detail
+} // namespace uthread
+
+/**
+ * The entry point of the executor. Sleeping tasks are checked once a quantum,
+ * by sleeping a quantum whenever no task is ready.
+ */
+void executor_main ()
+{
+  while (true)
+  {
+    if (!sleeping_tasks.empty ())
+    {
+      wake_sleeping_tasks ();
+    }
+    block_alarm_signal ();
+    task_lock.lock ();
+    running_tasks.swap (ready_tasks);
+    if (running_tasks.empty () && sleeping_tasks.empty ())
+    {
+      park_thread (&executor_queue, &task_lock);
+    }
+    else
+    {
+      task_lock.unlock ();
+    }
+    unblock_alarm_signal ();
+    if (running_tasks.empty ())
+    {
+      if (!sleeping_tasks.empty ())
+      {
+        uthread_sleep (1);
+      }
+      continue;
+    }
+    for (std::coroutine_handle<> handle : running_tasks)
+    {
+      handle.resume ();
+    }
+    running_tasks.clear ();
+  }
+}
+
+/**
+ * Makes every sleeping task whose wake up quantum has started ready.
+ */
+void wake_sleeping_tasks ()
+{
+  int now = uthread_get_total_quantums ();
+  if (sleeping_tasks.top ().wake_quantum > now)
+  {
+    return;
+  }
+  block_alarm_signal ();
+  task_lock.lock ();
+  while (!sleeping_tasks.empty () && sleeping_tasks.top ().wake_quantum <= now)
+  {
+    queue_ready_task (sleeping_tasks.top ().handle);
+    sleeping_tasks.pop ();
+  }
+  task_lock.unlock ();
+  unblock_alarm_signal ();
+}
+
+/**
+ * Queues handle on the executor and wakes the executor if it is parked. The
+ * caller must hold task_lock.
+ */
+void queue_ready_task (std::coroutine_handle<> handle)
+{
+  ready_tasks.push_back (handle);
+  User_Thread *executor = executor_queue.pop_front ();
+  if (executor != nullptr)
+  {
+    unpark_thread (executor);
+  }
+}
+
+/**
+ * Takes a waiter from the pool, or allocates one, and points it at handle.
+ * Must be called with SIGVTALRM blocked.
+ */
+Task_Waiter *take_waiter (std::coroutine_handle<> handle, void **item,
+                          int *result)
+{
+  Task_Waiter *waiter = nullptr;
+  task_lock.lock ();
+  if (!free_waiters.empty ())
+  {
+    waiter = free_waiters.back ();
+    free_waiters.pop_back ();
+  }
+  task_lock.unlock ();
+  if (waiter == nullptr)
+  {
+    waiter = new Task_Waiter ();
+    waiter->on_wake = &task_wake;
+  }
+  waiter->handle = handle;
+  waiter->item = item;
+  waiter->result = result;
+  return waiter;
+}
+
+/**
+ * The on_wake of every waiter: hands the result of the wait to the task and
+ * makes it ready. Called by unpark_thread, under the lock of the primitive
+ * the waiter was queued on.
+ */
+void task_wake (User_Thread *thread)
+{
+  auto *waiter = static_cast<Task_Waiter *> (thread);
+  if (waiter->result != nullptr)
+  {
+    *waiter->result = waiter->wait_result;
+    if (waiter->wait_result == SUCCESS && waiter->item != nullptr)
+    {
+      *waiter->item = waiter->wait_data;
+    }
+  }
+  task_lock.lock ();
+  queue_ready_task (waiter->handle);
+  free_waiters.push_back (waiter);
+  task_lock.unlock ();
+}
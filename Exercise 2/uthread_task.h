@@ -0,0 +1,385 @@
+/*
+ * User-Level Threads Library (uthreads) - stackless coroutine tasks.
+ *
+ * A uthread::task is a C++20 coroutine. It has no stack of its own, only the
+ * heap frame the compiler allocates for it, so millions of them fit where a
+ * few thousand uthreads would. Tasks run on the task executor, a uthread the
+ * library spawns when the first task is spawned, so they share the CPU with
+ * the stackful uthreads through the same scheduler and ready queue: the
+ * executor runs whenever a task is ready, and gets preempted like any other
+ * uthread.
+ * A task waits by co_await-ing one of the awaiters below, which suspend the
+ * task instead of the executor. A task must not call uthread functions that
+ * wait (uthread_sleep, uthread_chan_recv, uthread_read, ...), since those
+ * would stop every task on the executor.
+ * Include this header from C++20 code only. The functions work in both the 1:1
+ * and the M:N mode of the library, and must only be used after uthread_init or
+ * uthread_init_config.
+ */
+#ifndef _UTHREAD_TASK_H
+#define _UTHREAD_TASK_H
+
+#if __cplusplus < 202002L
+#error "uthread_task.h requires C++20 coroutines, compile with -std=c++20"
+#endif
+
+#include "uthread_sync.h"
+#include <coroutine>
+#include <exception>
+#include <optional>
+#include <utility>
+
+namespace uthread
+{
+
+template <typename T = void>
+class task;
+
+namespace detail
+{
+
+/*
+ * The library side of the awaiters, implemented in uthread_task.cpp.
+ */
+
+// spawns the executor if needed and queues handle on it. returns 0 on success
+// and -1 if the executor could not be spawned.
+int spawn_task (std::coroutine_handle<> handle);
+
+// queues handle at the tail of the executor's ready tasks.
+void schedule_task (std::coroutine_handle<> handle);
+
+// resumes handle once quantums more quantums have started.
+void sleep_task (std::coroutine_handle<> handle, int quantums);
+
+// receives from chan into item and result, as uthread_chan_recv would.
+// returns true if the task has to wait, in which case it is resumed once item
+// and result are set.
+bool recv_task (std::coroutine_handle<> handle, uthread_chan *chan,
+                void **item, int *result);
+
+// resumes handle once fd is readable, or writable if write is set.
+void wait_fd_task (std::coroutine_handle<> handle, int fd, bool write);
+
+struct promise_base
+{
+  // the task awaiting this one, resumed when it finishes.
+  std::coroutine_handle<> continuation;
+  std::exception_ptr exception;
+  // spawned tasks free themselves when they finish.
+  bool detached = false;
+
+  // tasks are lazy, they start when spawned or awaited.
+  std::suspend_always initial_suspend () noexcept
+  {
+    return {};
+  }
+
+  struct final_awaiter
+  {
+    bool await_ready () noexcept
+    {
+      return false;
+    }
+
+    template <typename Promise>
+    std::coroutine_handle<>
+    await_suspend (std::coroutine_handle<Promise> handle) noexcept
+    {
+      promise_base &promise = handle.promise ();
+      if (promise.detached)
+      {
+        // nobody can catch it, as with a std::thread.
+        if (promise.exception)
+        {
+          std::terminate ();
+        }
+        handle.destroy ();
+        return std::noop_coroutine ();
+      }
+      if (promise.continuation)
+      {
+        return promise.continuation;
+      }
+      return std::noop_coroutine ();
+    }
+
+    void await_resume () noexcept
+    {}
+  };
+
+  final_awaiter final_suspend () noexcept
+  {
+    return {};
+  }
+
+  void unhandled_exception () noexcept
+  {
+    exception = std::current_exception ();
+  }
+};
+
+template <typename T>
+struct promise : promise_base
+{
+  std::optional<T> value;
+
+  task<T> get_return_object ();
+
+  template <typename U>
+  void return_value (U &&result)
+  {
+    value.emplace (std::forward<U> (result));
+  }
+
+  T take_result ()
+  {
+    if (exception)
+    {
+      std::rethrow_exception (exception);
+    }
+    return std::move (*value);
+  }
+};
+
+template <>
+struct promise<void> : promise_base
+{
+  task<void> get_return_object ();
+
+  void return_void () noexcept
+  {}
+
+  void take_result ()
+  {
+    if (exception)
+    {
+      std::rethrow_exception (exception);
+    }
+  }
+};
+
+} // namespace detail
+
+/**
+ * A coroutine returning T. Awaiting a task from another task runs it, and
+ * resumes the awaiting task with its result once it finishes (a join). A task
+ * that is never awaited or spawned never runs.
+ */
+template <typename T>
+class task
+{
+
+ public:
+  using promise_type = detail::promise<T>;
+
+  explicit task (std::coroutine_handle<promise_type> handle) : handle (handle)
+  {}
+
+  task (task &&other) noexcept : handle (std::exchange (other.handle, nullptr))
+  {}
+
+  task &operator= (task &&other) noexcept
+  {
+    if (this != &other)
+    {
+      if (handle)
+      {
+        handle.destroy ();
+      }
+      handle = std::exchange (other.handle, nullptr);
+    }
+    return *this;
+  }
+
+  task (const task &) = delete;
+
+  task &operator= (const task &) = delete;
+
+  ~task ()
+  {
+    if (handle)
+    {
+      handle.destroy ();
+    }
+  }
+
+  auto operator co_await () noexcept
+  {
+    struct join_awaiter
+    {
+      std::coroutine_handle<promise_type> handle;
+
+      bool await_ready () noexcept
+      {
+        return handle.done ();
+      }
+
+      std::coroutine_handle<>
+      await_suspend (std::coroutine_handle<> awaiting) noexcept
+      {
+        handle.promise ().continuation = awaiting;
+        return handle;
+      }
+
+      T await_resume ()
+      {
+        return handle.promise ().take_result ();
+      }
+    };
+    return join_awaiter {handle};
+  }
+
+  // gives up ownership of the coroutine frame.
+  std::coroutine_handle<promise_type> release () noexcept
+  {
+    return std::exchange (handle, nullptr);
+  }
+
+ private:
+  std::coroutine_handle<promise_type> handle;
+};
+
+namespace detail
+{
+
+template <typename T>
+task<T> promise<T>::get_return_object ()
+{
+  return task<T> (std::coroutine_handle<promise<T> >::from_promise (*this));
+}
+
+inline task<void> promise<void>::get_return_object ()
+{
+  return task<void> (std::coroutine_handle<promise<void> >::from_promise (*this));
+}
+
+struct sleep_awaiter
+{
+  int quantums;
+
+  bool await_ready () noexcept
+  {
+    return false;
+  }
+
+  void await_suspend (std::coroutine_handle<> handle)
+  {
+    sleep_task (handle, quantums);
+  }
+
+  void await_resume () noexcept
+  {}
+};
+
+struct recv_awaiter
+{
+  uthread_chan *chan;
+  void **item;
+  int result;
+
+  bool await_ready () noexcept
+  {
+    return false;
+  }
+
+  bool await_suspend (std::coroutine_handle<> handle)
+  {
+    return recv_task (handle, chan, item, &result);
+  }
+
+  int await_resume () noexcept
+  {
+    return result;
+  }
+};
+
+struct fd_awaiter
+{
+  int fd;
+  bool write;
+
+  bool await_ready () noexcept
+  {
+    return false;
+  }
+
+  void await_suspend (std::coroutine_handle<> handle)
+  {
+    wait_fd_task (handle, fd, write);
+  }
+
+  void await_resume () noexcept
+  {}
+};
+
+} // namespace detail
+
+/**
+ * @brief Runs the task on the task executor, detached: its frame is freed when it finishes.
+ *
+ * The executor is a uthread spawned by the first call, so it counts against max_threads. A detached task that ends
+ * with an exception calls std::terminate.
+ *
+ * @return On success, return 0. On failure, return -1.
+*/
+inline int spawn (task<void> &&t)
+{
+  std::coroutine_handle<detail::promise<void> > handle = t.release ();
+  handle.promise ().detached = true;
+  if (detail::spawn_task (handle) != 0)
+  {
+    handle.destroy ();
+    return -1;
+  }
+  return 0;
+}
+
+/**
+ * @brief co_await uthread::sleep(n) suspends the task until n more quantums have started.
+ *
+ * While tasks sleep the executor checks on them once a quantum, so a task is resumed within a quantum of its wake up.
+ * uthread::sleep(0) moves the task to the tail of the executor's ready tasks.
+*/
+inline detail::sleep_awaiter sleep (int quantums)
+{
+  return detail::sleep_awaiter {quantums};
+}
+
+/**
+ * @brief co_await uthread::yield() moves the task to the tail of the executor's ready tasks.
+*/
+inline detail::sleep_awaiter yield ()
+{
+  return detail::sleep_awaiter {0};
+}
+
+/**
+ * @brief co_await uthread::recv(chan, &item) receives an item from chan, suspending the task while chan is empty.
+ *
+ * @return As uthread_chan_recv: 0 on success, 1 if chan is closed and empty, -1 on failure.
+*/
+inline detail::recv_awaiter recv (uthread_chan *chan, void **item)
+{
+  return detail::recv_awaiter {chan, item, 0};
+}
+
+/**
+ * @brief co_await uthread::readable(fd) suspends the task until the reactor sees fd readable.
+*/
+inline detail::fd_awaiter readable (int fd)
+{
+  return detail::fd_awaiter {fd, false};
+}
+
+/**
+ * @brief co_await uthread::writable(fd) suspends the task until the reactor sees fd writable.
+*/
+inline detail::fd_awaiter writable (int fd)
+{
+  return detail::fd_awaiter {fd, true};
+}
+
+} // namespace uthread
+
+#endif
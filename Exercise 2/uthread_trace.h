@@ -0,0 +1,46 @@
+/*
+ * User-Level Threads Library (uthreads) - tracing and runtime metrics.
+ *
+ * Tracing is compiled into the library only when it is built with -DUTHREAD_TRACE ('make TRACE=1'). The library then
+ * records every spawn, terminate, block, resume, sleep, wait, switch-in and switch-out, with a time stamp counter
+ * reading, into a lock-free ring buffer of the last TRACE_RING_SIZE events, and keeps runtime metrics per thread.
+ * Without it the functions below fail, and the scheduler contains no tracing code at all.
+ */
+#ifndef _UTHREAD_TRACE_H
+#define _UTHREAD_TRACE_H
+
+#define TRACE_RING_SIZE 65536 /* number of trace events kept, a power of 2 */
+
+/**
+ * Runtime metrics of a single thread, as returned by uthread_get_metrics.
+ */
+typedef struct {
+    long cpu_usecs;  /* time spent running, including the current quantum of a running thread */
+    long wait_usecs; /* time spent ready to run in a run queue */
+    int switches;    /* number of times the thread was switched in */
+    int preemptions; /* number of times the thread was switched out at the end of its quantum */
+} uthread_metrics;
+
+
+/**
+ * @brief Fills metrics with the runtime metrics of the thread with ID tid.
+ *
+ * It is an error to call this function when tracing is not compiled in, or if no thread with ID tid exists.
+ *
+ * @return On success, return 0. On failure, return -1.
+*/
+int uthread_get_metrics(int tid, uthread_metrics *metrics);
+
+/**
+ * @brief Writes the events in the trace ring to path as Chrome trace_event JSON, for chrome://tracing or Perfetto.
+ *
+ * Every uthread shows up as a thread of its own, with a slice for each time it ran and instant events for the rest.
+ * Events that are still being written by another worker are skipped.
+ * It is an error to call this function when tracing is not compiled in, or if path cannot be written.
+ *
+ * @return On success, return 0. On failure, return -1.
+*/
+int uthread_trace_dump(const char *path);
+
+
+#endif
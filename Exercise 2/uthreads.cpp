@@ -1,523 +1,1239 @@
-#include "uthreads.h"
-#include "user_thread.h"
-#include <deque>
-#include <vector>
-#include <iostream>
-#include <map>
-
-// constants.
-#define FAILURE (-1)
-#define SUCCESS 0
-#define AVAILABLE true
-#define TAKEN false
-#define INIT_ERR "thread library error: quantums must be positive."
-#define SC_SET_TIMER_ERR "system error: the setitimer system call has failed."
-#define MAX_THREADS_ERR "thread library error: maximum amount of threads \
-achieved."
-#define MEM_ALLOC_ERR "thread library error: failed to allocate memory when \
-spawning a new thread."
-#define NULL_ERR "thread library error: provided null argument."
-#define INCORRECT_TID_ERR "thread library error: thread id is not valid."
-#define NONEXISTENT_THREAD_ERR "thread library error: thread with the \
-provided id does not exist."
-#define SC_MASK_ERR "system error: the sigprocmask system call has failed."
-#define SC_SIG_ACTION_ERR "system error: the sigaction system call has failed."
-#define SC_SIGSETJMP_ERR "system error: the sigsetjmp system call has failed."
-#define SC_SIGLONGJMP_ERR "system error: the siglongjmp system call has \
-failed."
-#define BLOCK_MAIN_ERR "thread library error: the main thread should not be \
-blocked."
-#define INCORRECT_SLEEP_QUANTUMS_ERR "thread library error: sleep num of \
-quantums must be positive."
-#define SLEEP_MAIN_THREAD_ERR "thread library error: the main thread should \
-not be asleep."
-
-// added helper funcs declarations implemented at the end.
-int available_tid ();
-void reset_timer ();
-bool is_tid_valid (int tid);
-bool does_thread_exist (int tid);
-void clear_memory (int cond);
-void self_termination_context_switch ();
-void timer_handler (int sig);
-void block_alarm_signal ();
-void unblock_alarm_signal ();
-void wake_sleepy_threads ();
-void check_delete_thread ();
-
-std::deque<User_Thread *> ready_queue;
-std::map<int, User_Thread *> threads;
-int total_threads = 1;
-int total_ran_quantums = 0;
-struct itimerval timer;
-struct sigaction sa = {0};
-User_Thread *main_thread;
-User_Thread *cur_thread;
-User_Thread *thread_to_term = nullptr;
-bool existing_tids[MAX_THREAD_NUM] = {AVAILABLE};
-bool need_to_exit = false;
-
-void timer_handler (int sig)
-{
-  block_alarm_signal ();
-  check_delete_thread ();
-  if (cur_thread->get_status () == READY && cur_thread->get_sleep_time () == 0)
-  {
-    ready_queue.push_back (cur_thread);
-  }
-//  std::cout<< "Threads in the ready queue BEFORE waking sleepies: ";
-//  for(auto it = ready_queue.begin() ; it!=ready_queue.end(); ++it){
-//    if((*it) != nullptr){
-//      std::cout << (*it)->get_tid();
-//    }
-//  }
-  if (cur_thread != nullptr)
-  {
-    int ret = sigsetjmp(cur_thread->env, 1);
-    if (ret < 0)
-    {
-      std::cerr << SC_SIGSETJMP_ERR << std::endl;
-      clear_memory (1);
-    }
-    if (ret == 0)
-    {
-      cur_thread = ready_queue.front ();
-      ready_queue.pop_front ();
-      cur_thread->inc_quantums_ran ();
-      wake_sleepy_threads ();
-      total_ran_quantums++;
-      reset_timer ();
-      unblock_alarm_signal ();
-      siglongjmp (cur_thread->env, 1);
-      std::cerr << SC_SIGLONGJMP_ERR << std::endl;
-      clear_memory (1);
-    }
-    if(need_to_exit){
-      clear_memory (0);
-    }
-  }
-  unblock_alarm_signal ();
-}
-
-void wake_sleepy_threads ()
-{
-  auto it = threads.begin ();
-  while (it != threads.end ())
-  {
-    if (it->second->get_sleep_time () == 1 && it->second->get_status () != BLOCKED)
-    {
-      if (it->second->get_tid () != cur_thread->get_tid ())
-      {
-        it->second->set_status (READY);
-        ready_queue.push_back (it->second);
-      }
-    }
-    // decrement sleep time by 1
-    if (it->second->get_sleep_time () > 0)
-    {
-      it->second->set_sleep_time (it->second->get_sleep_time () - 1);
-    }
-    ++it;
-  }
-}
-
-void reset_timer ()
-{
-  // start a virtual timer. it counts down whenever this process is executing.
-  if (setitimer (ITIMER_VIRTUAL, &timer, nullptr) < 0)
-  {
-    std::cerr << SC_SET_TIMER_ERR << std::endl;
-    clear_memory (1);
-  }
-}
-
-int uthread_init (int quantum_usecs)
-{
-  if (quantum_usecs <= 0)
-  {
-    std::cerr << INIT_ERR << std::endl;
-    return FAILURE;
-  }
-  sa = {0};
-  for (bool &existing_tid: existing_tids)
-  {
-    existing_tid = AVAILABLE;
-  }
-  // init the timer with input intervals.
-  timer.it_value.tv_sec = quantum_usecs / 1000000;
-  timer.it_value.tv_usec = quantum_usecs % 1000000;
-  timer.it_interval = timer.it_value;
-  sa.sa_handler = &timer_handler;
-  if (sigaction (SIGVTALRM, &sa, nullptr) < 0)
-  {
-    std::cerr << SC_SIG_ACTION_ERR << std::endl;
-    clear_memory (1);
-  }
-  main_thread = new User_Thread (0, nullptr);
-  threads.insert({0,main_thread});
-  cur_thread = main_thread;
-  existing_tids[0] = TAKEN;
-  reset_timer ();
-  timer_handler (0);
-  return SUCCESS;
-}
-
-int uthread_spawn (thread_entry_point entry_point)
-{
-  block_alarm_signal ();
-  check_delete_thread ();
-  if (entry_point == nullptr)
-  {
-    std::cerr << NULL_ERR << std::endl;
-    unblock_alarm_signal ();
-    return FAILURE;
-  }
-  if (total_threads == MAX_THREAD_NUM)
-  {
-    std::cerr << MAX_THREADS_ERR << std::endl;
-    unblock_alarm_signal ();
-    return FAILURE;
-  }
-  int available_next_tid = available_tid ();
-  // debugging
-  if (available_next_tid < 0)
-  {
-    std::cout << "ERROR LOOKING FOR AVAILABLE TID, CHECK CODE\n";
-    unblock_alarm_signal ();
-    return FAILURE;
-  }
-  User_Thread *thread;
-  // try to allocate memory to a new thread.
-  try
-  {
-    thread = new User_Thread (available_next_tid, entry_point);
-  }
-  catch (const std::exception &)
-  {
-    delete thread;
-    std::cerr << MEM_ALLOC_ERR << std::endl;
-    unblock_alarm_signal ();
-    return FAILURE;
-  }
-  threads.insert({available_next_tid,thread});
-  ready_queue.push_back (thread);
-  existing_tids[available_next_tid] = TAKEN;
-  total_threads++;
-  unblock_alarm_signal ();
-  return available_next_tid;
-}
-
-int uthread_terminate (int tid)
-{
-  block_alarm_signal ();
-
-  check_delete_thread ();
-
-  if (!is_tid_valid (tid))
-  {
-    std::cerr << INCORRECT_TID_ERR << std::endl;
-    unblock_alarm_signal ();
-    return FAILURE;
-  }
-
-  if (!does_thread_exist (tid))
-  {
-    std::cerr << NONEXISTENT_THREAD_ERR << std::endl;
-    unblock_alarm_signal ();
-    return FAILURE;
-  }
-
-  if (tid == 0)
-  {
-    if(cur_thread->get_tid() != 0){
-      cur_thread = main_thread;
-      need_to_exit = true;
-      siglongjmp (cur_thread->env, 1);
-    }
-    clear_memory (0);
-    return SUCCESS;
-  }
-  existing_tids[tid] = AVAILABLE;
-  total_threads--;
-  if (tid == cur_thread->get_tid ())
-  {
-    cur_thread->set_status (BLOCKED);
-    thread_to_term = cur_thread;
-    cur_thread = nullptr;
-    threads.erase (tid);
-    self_termination_context_switch ();
-    return SUCCESS;
-  }
-
-  // search and erase from the ready_queue
-  for (auto it = ready_queue.begin (); it != ready_queue.end ();)
-  {
-    if ((*it)->get_tid () == tid)
-    {
-      it = ready_queue.erase (it);
-    }
-    else
-    {
-      ++it;  // Only increment if no erasure occurred
-    }
-  }
-  // delete and erase from threads map
-  auto it = threads.find (tid);
-  if (it != threads.end ())
-  {
-    threads.erase (it);
-    delete (it->second);
-  }
-  unblock_alarm_signal ();
-  return SUCCESS;
-}
-
-int uthread_block (int tid)
-{
-  block_alarm_signal ();
-  check_delete_thread ();
-  if (!is_tid_valid (tid))
-  {
-    std::cerr << INCORRECT_TID_ERR << std::endl;
-    unblock_alarm_signal ();
-    return FAILURE;
-  }
-
-  if (!does_thread_exist (tid))
-  {
-    std::cerr << NONEXISTENT_THREAD_ERR << std::endl;
-    unblock_alarm_signal ();
-    return FAILURE;
-  }
-
-  if (tid == 0)
-  {
-    std::cerr << BLOCK_MAIN_ERR << std::endl;
-    unblock_alarm_signal ();
-    return FAILURE;
-  }
-  auto it = threads.find (tid);
-  if (it != threads.end () && it->second != nullptr)
-  {
-
-    it->second->set_status (BLOCKED);
-  }
-
-  // if thread to block is the current running thread
-  if (cur_thread->get_tid () == tid)
-  {
-    cur_thread->set_status (BLOCKED);
-    timer_handler (0);
-    unblock_alarm_signal ();
-    return SUCCESS;
-  }
-
-  for (auto it = ready_queue.begin (); it != ready_queue.end (); ++it)
-  {
-    if ((*it)->get_tid () == tid)
-    {
-      (*it)->set_status (BLOCKED);
-      ready_queue.erase (it);
-      unblock_alarm_signal ();
-      return SUCCESS;
-    }
-  }
-  unblock_alarm_signal ();
-  return FAILURE;
-}
-
-int uthread_resume (int tid)
-{
-  block_alarm_signal ();
-  check_delete_thread ();
-  if (!is_tid_valid (tid))
-  {
-    std::cerr << INCORRECT_TID_ERR << std::endl;
-    unblock_alarm_signal ();
-    return FAILURE;
-  }
-
-  if (!does_thread_exist (tid))
-  {
-    std::cerr << NONEXISTENT_THREAD_ERR << std::endl;
-    unblock_alarm_signal ();
-    return FAILURE;
-  }
-
-  auto it = threads.find (tid);
-  if (it != threads.end () && it->second != nullptr)
-  {
-    if(it->second->get_status() == BLOCKED && it->second->get_sleep_time()
-    == 0){
-      ready_queue.push_back (it->second);
-    }
-    it->second->set_status (READY);
-  }
-  unblock_alarm_signal ();
-  return SUCCESS;
-}
-
-int uthread_sleep (int num_quantums)
-{
-  block_alarm_signal ();
-  //check_delete_thread();
-  if (num_quantums < 0)
-  {
-    std::cerr << INCORRECT_SLEEP_QUANTUMS_ERR << std::endl;
-    unblock_alarm_signal ();
-    return FAILURE;
-  }
-  if (cur_thread->get_tid () == 0)
-  {
-    std::cerr << SLEEP_MAIN_THREAD_ERR << std::endl;
-    unblock_alarm_signal ();
-    return FAILURE;
-  }
-  cur_thread->set_status (SLEEPY);
-  cur_thread->set_sleep_time (num_quantums);
-  // search and erase from the ready_queue
-  for (auto it = ready_queue.begin (); it != ready_queue.end ();)
-  {
-    if ((*it)->get_tid () == cur_thread->get_tid ())
-    {
-      it = ready_queue.erase (it);
-    }
-    else
-    {
-      ++it;  // Only increment if no erasure occurred
-    }
-  }
-  timer_handler (0);
-  unblock_alarm_signal ();
-  return SUCCESS;
-
-}
-
-int uthread_get_tid ()
-{
-  return cur_thread->get_tid ();
-}
-
-int uthread_get_total_quantums ()
-{
-  return total_ran_quantums;
-}
-
-int uthread_get_quantums (int tid)
-{
-  block_alarm_signal ();
-  check_delete_thread ();
-  if (!is_tid_valid (tid))
-  {
-    std::cerr << INCORRECT_TID_ERR << std::endl;
-    unblock_alarm_signal ();
-    return FAILURE;
-  }
-
-  if (!does_thread_exist (tid))
-  {
-    std::cerr << NONEXISTENT_THREAD_ERR << std::endl;
-    unblock_alarm_signal ();
-    return FAILURE;
-  }
-  unblock_alarm_signal ();
-  auto it = threads.find (tid);
-  if (it != threads.end () && it->second != nullptr)
-  {
-    return it->second->get_quantums_ran ();
-  }
-  return FAILURE;
-}
-
-int available_tid ()
-{
-  for (int tid = 0; tid < MAX_THREAD_NUM; tid++)
-  {
-    if (existing_tids[tid])
-    {
-      return tid;
-    }
-  }
-  return FAILURE;
-}
-
-bool is_tid_valid (int tid)
-{
-  return 0 <= tid && tid < MAX_THREAD_NUM;
-}
-
-bool does_thread_exist (int tid)
-{
-  return existing_tids[tid] == TAKEN;
-}
-
-void clear_memory (int cond)
-{
-  ready_queue.clear ();  // clear ready the container.
-  auto it = threads.begin ();
-  while (it != threads.end ())
-  {
-    if (it->second != nullptr && it->second->get_tid () != 0)
-    {
-      delete it->second;
-    }
-    ++it;
-  }
-  threads.clear ();
-  delete main_thread;
-  delete thread_to_term;
-  exit (cond);
-}
-
-void self_termination_context_switch ()
-{
-  cur_thread = ready_queue.front ();
-  ready_queue.pop_front ();
-  cur_thread->inc_quantums_ran ();
-  total_ran_quantums++;
-  reset_timer ();
-  unblock_alarm_signal ();
-  siglongjmp (cur_thread->env, 1);
-  std::cerr << SC_SIGLONGJMP_ERR << std::endl;
-  clear_memory (1);
-}
-
-void block_alarm_signal ()
-{
-  sigset_t set;
-  sigemptyset (&set);
-  sigaddset (&set, SIGVTALRM);
-  if (sigprocmask (SIG_BLOCK, &set, nullptr) == -1)
-  {
-    std::cerr << SC_MASK_ERR << std::endl;
-    clear_memory (1);
-  }
-}
-
-void unblock_alarm_signal ()
-{
-  sigset_t set;
-  sigemptyset (&set);
-  sigaddset (&set, SIGVTALRM);
-  if (sigprocmask (SIG_UNBLOCK, &set, nullptr) == -1)
-  {
-    std::cerr << SC_MASK_ERR << std::endl;
-    clear_memory (1);
-  }
-}
-
-void check_delete_thread ()
-{
-  if (thread_to_term != nullptr)
-  {
-    threads.erase (thread_to_term->get_tid ());
-    delete thread_to_term;
-    thread_to_term = nullptr;
-  }
-}
-
-
-
-
-
-
+#include "uthreads.h"
+#include "user_thread.h"
+#include "thread_queue.h"
+#include "sleep_wheel.h"
+#include "uthreads_internal.h"
+#include "mn_scheduler.h"
+#include "spin_lock.h"
+#include "tracer.h"
+#include "uthread_trace.h"
+#include "thread_stack.h"
+#include "schedule_log.h"
+#include <vector>
+#include <queue>
+#include <functional>
+#include <iostream>
+#include <climits>
+#include <algorithm>
+#include <pthread.h>
+
+// added helper funcs declarations implemented at the end.
+int available_tid ();
+void release_tid (int tid);
+void reset_timer ();
+void arm_timer_if_stopped ();
+int thread_quantum (User_Thread *thread);
+void adapt_quantum (User_Thread *thread, bool used_up);
+int thread_level (User_Thread *thread);
+void push_ready (User_Thread *thread);
+void erase_ready (User_Thread *thread);
+bool is_ready (const User_Thread *thread);
+User_Thread *pop_ready ();
+User_Thread *pick_next_thread ();
+void demote_thread (User_Thread *thread);
+void boost_ready_threads ();
+void preempt_if_outranked ();
+bool is_tid_valid (int tid);
+bool does_thread_exist (int tid);
+void clear_memory (int cond);
+void context_switch (bool preempted, bool restart_timer);
+void switch_to_next_thread (bool restart_timer);
+void self_termination_context_switch ();
+void timer_handler (int sig);
+void block_alarm_signal ();
+void unblock_alarm_signal ();
+void wake_sleepy_threads (int quantum);
+void check_delete_thread ();
+
+// threads are indexed by their tid, a nullptr entry marks an available tid.
+// the table grows on demand up to max_threads.
+std::vector<User_Thread *> threads;
+// tids released by terminated threads below threads.size (), smallest first.
+std::priority_queue<int, std::vector<int>, std::greater<int> > free_tids;
+// one READY queue per priority level, bit i of ready_levels is set iff
+// ready_queues[i] is not empty, so the next thread is found in O(1).
+Thread_Queue ready_queues[UTHREAD_NUM_PRIORITIES];
+unsigned int ready_levels = 0;
+int ready_count = 0;
+// sleeping threads by their wake up quantum, so each quantum only visits the
+// threads due in it.
+Sleep_Wheel sleep_wheel;
+int max_threads = MAX_THREAD_NUM;
+int stack_size = STACK_SIZE;
+uthread_policy policy = UTHREAD_POLICY_RR;
+int quantum_usecs;
+int boost_quantums = MLFQ_BOOST_QUANTUMS;
+int boost_epoch = 0;
+bool tickless = false;
+bool adaptive = false;
+// no timer and no signal masking, threads only switch when they ask to.
+bool cooperative = false;
+// no timer either, quantums run out on the virtual time of uthread_tick.
+bool deterministic = false;
+long virtual_usecs = 0;
+// the virtual time charged to the running thread in its current quantum.
+int quantum_used_usecs = 0;
+int total_threads = 1;
+int total_ran_quantums = 0;
+struct itimerval timer;
+// false while the tickless mode has stopped the timer.
+bool timer_armed = false;
+struct sigaction sa = {0};
+User_Thread *main_thread;
+User_Thread *cur_thread;
+User_Thread *thread_to_term = nullptr;
+bool need_to_exit = false;
+// set when uthread_init_config asked for more than one worker, every call is
+// then handed to the M:N scheduler.
+bool mn_mode = false;
+
+void timer_handler (int sig)
+{
+  if (sig == SIGVTALRM && cur_thread != nullptr
+      && cur_thread->preempt_deferred)
+  {
+    cur_thread->preempt_pending = true;
+    return;
+  }
+  context_switch (sig == SIGVTALRM, true);
+}
+
+/**
+ * Puts the running thread back in the ready queue if it can still run and
+ * runs the next thread. restart_timer gives the next thread a fresh quantum,
+ * without it the next thread runs out the current one.
+ */
+void context_switch (bool preempted, bool restart_timer)
+{
+  block_alarm_signal ();
+  check_delete_thread ();
+  TRACE_EVENT (preempted ? TRACE_PREEMPT : TRACE_SWITCH_OUT, cur_thread);
+  if (preempted)
+  {
+    demote_thread (cur_thread);
+  }
+  adapt_quantum (cur_thread, preempted);
+  if (cur_thread->is_runnable ())
+  {
+    push_ready (cur_thread);
+  }
+  // the signal mask never changes in the cooperative mode, saving it would
+  // only cost a system call on every switch.
+  int ret = sigsetjmp(cur_thread->env, !cooperative);
+  if (ret < 0)
+  {
+    std::cerr << SC_SIGSETJMP_ERR << std::endl;
+    clear_memory (1);
+  }
+  if (ret == 0)
+  {
+    switch_to_next_thread (restart_timer);
+  }
+  if (need_to_exit)
+  {
+    clear_memory (0);
+  }
+  unblock_alarm_signal ();
+}
+
+void switch_to_next_thread (bool restart_timer)
+{
+  total_ran_quantums++;
+  if (policy == UTHREAD_POLICY_MLFQ
+      && total_ran_quantums % boost_quantums == 0)
+  {
+    boost_ready_threads ();
+  }
+  wake_sleepy_threads (total_ran_quantums);
+  if (io_pending ())
+  {
+    poll_io (0);
+  }
+  // every thread is waiting: wait for I/O until the next sleeper is due, and
+  // let the quantums up to it pass idle at once. with neither, nothing can
+  // ever run again.
+  while (ready_levels == 0)
+  {
+    if (sleep_wheel.empty () && !io_pending ())
+    {
+      // we may be on the stack of a thread, exit without freeing it.
+      std::cerr << DEADLOCK_ERR << std::endl;
+      exit (1);
+    }
+    // the wheel may only have sleepers to cascade by then, and nobody to wake,
+    // in which case the loop goes on to its next event.
+    int idle_quantums = 0;
+    if (!sleep_wheel.empty ())
+    {
+      idle_quantums = sleep_wheel.next_event () - total_ran_quantums;
+    }
+    if (io_pending ())
+    {
+      long timeout_ms = -1;
+      if (!sleep_wheel.empty ())
+      {
+        timeout_ms = ((long) idle_quantums * quantum_usecs + 999) / 1000;
+      }
+      poll_io ((int) std::min (timeout_ms, (long) INT_MAX));
+      if (ready_levels != 0)
+      {
+        break;
+      }
+    }
+    total_ran_quantums += idle_quantums;
+    virtual_usecs += (long) idle_quantums * quantum_usecs;
+    wake_sleepy_threads (total_ran_quantums);
+  }
+  cur_thread = deterministic ? pick_next_thread () : pop_ready ();
+  TRACE_EVENT (TRACE_SWITCH_IN, cur_thread);
+  cur_thread->inc_quantums_ran ();
+  if (deterministic)
+  {
+    log_quantum (total_ran_quantums, virtual_usecs, cur_thread->get_tid ());
+  }
+  if (restart_timer)
+  {
+    quantum_used_usecs = 0;
+    reset_timer ();
+  }
+  unblock_alarm_signal ();
+  siglongjmp (cur_thread->env, 1);
+  std::cerr << SC_SIGLONGJMP_ERR << std::endl;
+  clear_memory (1);
+}
+
+void wake_sleepy_threads (int quantum)
+{
+  User_Thread *thread;
+  while ((thread = sleep_wheel.pop_due (quantum)) != nullptr)
+  {
+    thread->set_wake_quantum (0);
+    // a thread that was blocked while asleep stays blocked.
+    if (thread->is_runnable ())
+    {
+      push_ready (thread);
+    }
+  }
+}
+
+void reset_timer ()
+{
+  if (cooperative)
+  {
+    return;
+  }
+  // a lone thread with nobody due to wake up has nobody to yield to.
+  timer_armed = !(tickless && ready_levels == 0 && sleep_wheel.empty ()
+                  && !io_pending ());
+  timer = {};
+  if (timer_armed)
+  {
+    int usecs = thread_quantum (cur_thread);
+    timer.it_value.tv_sec = usecs / 1000000;
+    timer.it_value.tv_usec = usecs % 1000000;
+    timer.it_interval = timer.it_value;
+  }
+  // start a virtual timer. it counts down whenever this process is executing.
+  if (setitimer (ITIMER_VIRTUAL, &timer, nullptr) < 0)
+  {
+    std::cerr << SC_SET_TIMER_ERR << std::endl;
+    clear_memory (1);
+  }
+}
+
+void arm_timer_if_stopped ()
+{
+  // cur_thread is nullptr while a terminated thread switches away.
+  if (!timer_armed && cur_thread != nullptr)
+  {
+    reset_timer ();
+  }
+}
+
+int thread_quantum (User_Thread *thread)
+{
+  // the MLFQ gives lower levels longer quantums.
+  if (policy == UTHREAD_POLICY_MLFQ)
+  {
+    return quantum_usecs << thread->get_level ();
+  }
+  if (!adaptive)
+  {
+    return quantum_usecs;
+  }
+  long usecs = (long) quantum_usecs << thread->get_quantum_shift ();
+  if (ready_count > 0)
+  {
+    long share = (long) quantum_usecs * ADAPTIVE_LATENCY_QUANTUMS / ready_count;
+    usecs = std::min (usecs, std::max (share, (long) quantum_usecs
+                                              / ADAPTIVE_MAX_SHRINK));
+  }
+  return (int) std::max (std::min (usecs, (long) INT_MAX), 1L);
+}
+
+void adapt_quantum (User_Thread *thread, bool used_up)
+{
+  // cpu bound threads get longer quantums, the others go back to the base.
+  int shift = thread->get_quantum_shift ();
+  if (!used_up)
+  {
+    thread->set_quantum_shift (0);
+  }
+  else if (shift < ADAPTIVE_MAX_SHIFT
+           && ((long) quantum_usecs << (shift + 1)) <= INT_MAX)
+  {
+    thread->set_quantum_shift (shift + 1);
+  }
+}
+
+int uthread_init (int quantum_usecs)
+{
+  // every field left zero takes its default.
+  uthread_config config = {};
+  config.quantum_usecs = quantum_usecs;
+  config.max_threads = MAX_THREAD_NUM;
+  config.stack_size = STACK_SIZE;
+  return uthread_init_config (&config);
+}
+
+int uthread_init_config (const uthread_config *config)
+{
+  if (config == nullptr)
+  {
+    std::cerr << NULL_ERR << std::endl;
+    return FAILURE;
+  }
+  if (config->quantum_usecs <= 0)
+  {
+    std::cerr << INIT_ERR << std::endl;
+    return FAILURE;
+  }
+  if ((0 < config->stack_size && config->stack_size < MIN_STACK_SIZE)
+      || config->policy < UTHREAD_POLICY_RR
+      || config->policy > UTHREAD_POLICY_MLFQ
+      || config->stack_mode < UTHREAD_STACK_PLAIN
+      || config->stack_mode > UTHREAD_STACK_LEARNED
+      || (config->workers > 1
+          && (config->policy != UTHREAD_POLICY_RR || config->cooperative
+              || config->deterministic)))
+  {
+    std::cerr << INIT_CONFIG_ERR << std::endl;
+    return FAILURE;
+  }
+  max_threads = config->max_threads > 0 ? config->max_threads : MAX_THREAD_NUM;
+  stack_size = config->stack_size > 0 ? config->stack_size : STACK_SIZE;
+  policy = config->policy;
+  boost_quantums = config->boost_quantums > 0 ? config->boost_quantums
+                                              : MLFQ_BOOST_QUANTUMS;
+  quantum_usecs = config->quantum_usecs;
+  TRACE_INIT ();
+  tickless = config->tickless != 0;
+  adaptive = config->adaptive != 0;
+  deterministic = config->deterministic != 0;
+  cooperative = config->cooperative != 0 || deterministic;
+  if (deterministic)
+  {
+    init_schedule_log (config->seed);
+  }
+  init_stacks (config->stack_mode);
+  if (config->workers > 1)
+  {
+    mn_mode = true;
+    return mn_init (config->workers, quantum_usecs, max_threads, stack_size);
+  }
+  if (!cooperative)
+  {
+    sa = {0};
+    sa.sa_handler = &timer_handler;
+    if (sigaction (SIGVTALRM, &sa, nullptr) < 0)
+    {
+      std::cerr << SC_SIG_ACTION_ERR << std::endl;
+      clear_memory (1);
+    }
+  }
+  main_thread = new User_Thread (0, nullptr, 0);
+  threads.push_back (main_thread);
+  cur_thread = main_thread;
+  TRACE_EVENT (TRACE_SWITCH_IN, main_thread);
+  reset_timer ();
+  timer_handler (0);
+  return SUCCESS;
+}
+
+int uthread_spawn (thread_entry_point entry_point)
+{
+  if (entry_point == nullptr)
+  {
+    std::cerr << NULL_ERR << std::endl;
+    return FAILURE;
+  }
+  int tid;
+  if (spawn_threads (entry_point, nullptr, nullptr, 1, &tid) < 0)
+  {
+    return FAILURE;
+  }
+  return tid;
+}
+
+int uthread_spawn_arg (uthread_start_routine start_routine, void *arg)
+{
+  if (start_routine == nullptr)
+  {
+    std::cerr << NULL_ERR << std::endl;
+    return FAILURE;
+  }
+  int tid;
+  if (spawn_threads (&run_start_routine, start_routine, &arg, 1, &tid) < 0)
+  {
+    return FAILURE;
+  }
+  return tid;
+}
+
+int uthread_spawn_n (uthread_start_routine start_routine, void **args,
+                     int count, int *tids)
+{
+  if (start_routine == nullptr || tids == nullptr)
+  {
+    std::cerr << NULL_ERR << std::endl;
+    return FAILURE;
+  }
+  if (count <= 0)
+  {
+    std::cerr << INCORRECT_SPAWN_COUNT_ERR << std::endl;
+    return FAILURE;
+  }
+  return spawn_threads (&run_start_routine, start_routine, args, count, tids);
+}
+
+int spawn_threads (thread_entry_point entry_point,
+                   uthread_start_routine start_routine, void **args,
+                   int count, int *tids)
+{
+  if (mn_mode)
+  {
+    return mn_spawn (entry_point, start_routine, args, count, tids);
+  }
+  block_alarm_signal ();
+  check_delete_thread ();
+  if (total_threads > max_threads - count)
+  {
+    std::cerr << MAX_THREADS_ERR << std::endl;
+    unblock_alarm_signal ();
+    return FAILURE;
+  }
+  // allocate every thread before any of them is queued, so that a failure
+  // can be undone.
+  int size = spawn_stack_size (stack_owner (entry_point, start_routine),
+                               stack_size);
+  int spawned = 0;
+  int tid = FAILURE;
+  try
+  {
+    for (; spawned < count; spawned++)
+    {
+      tid = available_tid ();
+      threads[tid] = new User_Thread (tid, entry_point, size, start_routine,
+                                      args != nullptr ? args[spawned]
+                                                      : nullptr);
+      tids[spawned] = tid;
+      tid = FAILURE;
+    }
+    reserve_join_slots ((int) threads.size ());
+  }
+  catch (const std::exception &)
+  {
+    if (tid != FAILURE)
+    {
+      release_tid (tid);
+    }
+    for (int i = 0; i < spawned; i++)
+    {
+      delete threads[tids[i]];
+      threads[tids[i]] = nullptr;
+      release_tid (tids[i]);
+    }
+    std::cerr << MEM_ALLOC_ERR << std::endl;
+    unblock_alarm_signal ();
+    return FAILURE;
+  }
+  for (int i = 0; i < count; i++)
+  {
+    reset_join_slot (tids[i], start_routine != nullptr);
+    TRACE_EVENT (TRACE_SPAWN, threads[tids[i]]);
+    push_ready (threads[tids[i]]);
+  }
+  total_threads += count;
+  preempt_if_outranked ();
+  unblock_alarm_signal ();
+  return SUCCESS;
+}
+
+int uthread_terminate (int tid)
+{
+  // destructors may call into the library, so they run before anything is
+  // locked or changed, and only for a tid that names a thread. should one of
+  // them block, the thread may end and its tid be reused meanwhile, which the
+  // generation tells apart.
+  uint64_t generation = 0;
+  if (tid != 0 && thread_generation (tid, &generation))
+  {
+    run_key_destructors (tid, generation);
+  }
+  if (mn_mode)
+  {
+    return mn_terminate (tid, generation);
+  }
+  block_alarm_signal ();
+
+  check_delete_thread ();
+
+  if (!is_tid_valid (tid))
+  {
+    std::cerr << INCORRECT_TID_ERR << std::endl;
+    unblock_alarm_signal ();
+    return FAILURE;
+  }
+
+  if (!does_thread_exist (tid))
+  {
+    std::cerr << NONEXISTENT_THREAD_ERR << std::endl;
+    unblock_alarm_signal ();
+    return FAILURE;
+  }
+
+  if (tid == 0)
+  {
+    if(cur_thread->get_tid() != 0){
+      cur_thread = main_thread;
+      need_to_exit = true;
+      siglongjmp (cur_thread->env, 1);
+    }
+    clear_memory (0);
+    return SUCCESS;
+  }
+  User_Thread *thread = threads[tid];
+  if (thread->get_generation () != generation)
+  {
+    std::cerr << NONEXISTENT_THREAD_ERR << std::endl;
+    unblock_alarm_signal ();
+    return FAILURE;
+  }
+  threads[tid] = nullptr;
+  if (!end_join_slot (tid, thread->exit_result))
+  {
+    release_tid (tid);
+    total_threads--;
+  }
+  TRACE_EVENT (TRACE_TERMINATE, thread);
+  if (thread == cur_thread)
+  {
+    TRACE_EVENT (TRACE_SWITCH_OUT, thread);
+    cur_thread->set_status (BLOCKED);
+    thread_to_term = cur_thread;
+    cur_thread = nullptr;
+    self_termination_context_switch ();
+    return SUCCESS;
+  }
+
+  // unlink from the ready queue, the sleep wheel or a wait queue.
+  if (is_ready (thread))
+  {
+    erase_ready (thread);
+  }
+  else if (thread->is_sleeping ())
+  {
+    sleep_wheel.erase (thread);
+  }
+  else if (thread->queue != nullptr)
+  {
+    thread->queue->erase (thread);
+    if (thread->waiting_fd >= 0)
+    {
+      drop_fd_waiter (thread->waiting_fd);
+    }
+  }
+  delete thread;
+  unblock_alarm_signal ();
+  return SUCCESS;
+}
+
+int uthread_block (int tid)
+{
+  if (mn_mode)
+  {
+    return mn_block (tid);
+  }
+  block_alarm_signal ();
+  check_delete_thread ();
+  if (!is_tid_valid (tid))
+  {
+    std::cerr << INCORRECT_TID_ERR << std::endl;
+    unblock_alarm_signal ();
+    return FAILURE;
+  }
+
+  if (!does_thread_exist (tid))
+  {
+    std::cerr << NONEXISTENT_THREAD_ERR << std::endl;
+    unblock_alarm_signal ();
+    return FAILURE;
+  }
+
+  if (tid == 0)
+  {
+    std::cerr << BLOCK_MAIN_ERR << std::endl;
+    unblock_alarm_signal ();
+    return FAILURE;
+  }
+  User_Thread *thread = threads[tid];
+  thread->set_status (BLOCKED);
+  TRACE_EVENT (TRACE_BLOCK, thread);
+
+  // if thread to block is the current running thread
+  if (thread == cur_thread)
+  {
+    timer_handler (0);
+    unblock_alarm_signal ();
+    return SUCCESS;
+  }
+
+  // a sleeping thread keeps its place in the sleep wheel.
+  if (is_ready (thread))
+  {
+    erase_ready (thread);
+  }
+  unblock_alarm_signal ();
+  return SUCCESS;
+}
+
+int uthread_resume (int tid)
+{
+  if (mn_mode)
+  {
+    return mn_resume (tid);
+  }
+  block_alarm_signal ();
+  check_delete_thread ();
+  if (!is_tid_valid (tid))
+  {
+    std::cerr << INCORRECT_TID_ERR << std::endl;
+    unblock_alarm_signal ();
+    return FAILURE;
+  }
+
+  if (!does_thread_exist (tid))
+  {
+    std::cerr << NONEXISTENT_THREAD_ERR << std::endl;
+    unblock_alarm_signal ();
+    return FAILURE;
+  }
+
+  User_Thread *thread = threads[tid];
+  if (thread->get_status () == BLOCKED)
+  {
+    thread->set_status (READY);
+    TRACE_EVENT (TRACE_RESUME, thread);
+    if (thread->is_runnable ())
+    {
+      push_ready (thread);
+      preempt_if_outranked ();
+    }
+  }
+  unblock_alarm_signal ();
+  return SUCCESS;
+}
+
+int uthread_sleep (int num_quantums)
+{
+  if (mn_mode)
+  {
+    return mn_sleep (num_quantums);
+  }
+  block_alarm_signal ();
+  //check_delete_thread();
+  if (num_quantums < 0)
+  {
+    std::cerr << INCORRECT_SLEEP_QUANTUMS_ERR << std::endl;
+    unblock_alarm_signal ();
+    return FAILURE;
+  }
+  if (cur_thread->get_tid () == 0)
+  {
+    std::cerr << SLEEP_MAIN_THREAD_ERR << std::endl;
+    unblock_alarm_signal ();
+    return FAILURE;
+  }
+  // sleeping for zero quantums just gives up the rest of the quantum.
+  if (num_quantums > 0)
+  {
+    int wake_quantum = total_ran_quantums + num_quantums;
+    cur_thread->set_wake_quantum (wake_quantum);
+    sleep_wheel.insert (cur_thread);
+    TRACE_EVENT (TRACE_SLEEP, cur_thread);
+  }
+  timer_handler (0);
+  unblock_alarm_signal ();
+  return SUCCESS;
+
+}
+
+int uthread_yield ()
+{
+  if (mn_mode)
+  {
+    return mn_yield ();
+  }
+  block_alarm_signal ();
+  check_delete_thread ();
+  // with nobody to yield to, keep running. in the cooperative mode only a
+  // switch lets the quantums pass, so a yield with sleepers or pending I/O
+  // always switches to let them wake up.
+  bool outranked = ready_levels != 0
+                   && __builtin_ctz (ready_levels) <= thread_level (cur_thread);
+  if (outranked || (cooperative && (!sleep_wheel.empty () || io_pending ())))
+  {
+    context_switch (false, false);
+  }
+  unblock_alarm_signal ();
+  return SUCCESS;
+}
+
+int uthread_tick (int usecs)
+{
+  if (!deterministic)
+  {
+    std::cerr << DETERMINISTIC_ERR << std::endl;
+    return FAILURE;
+  }
+  if (usecs < 0)
+  {
+    std::cerr << INCORRECT_TICK_ERR << std::endl;
+    return FAILURE;
+  }
+  check_delete_thread ();
+  virtual_usecs += usecs;
+  quantum_used_usecs = (int) std::min ((long) quantum_used_usecs + usecs,
+                                       (long) INT_MAX);
+  // the point where the timer would have gone off.
+  if (quantum_used_usecs >= thread_quantum (cur_thread))
+  {
+    context_switch (true, true);
+  }
+  return SUCCESS;
+}
+
+int uthread_schedule_dump (const char *path)
+{
+  if (!deterministic)
+  {
+    std::cerr << DETERMINISTIC_ERR << std::endl;
+    return FAILURE;
+  }
+  if (path == nullptr)
+  {
+    std::cerr << NULL_ERR << std::endl;
+    return FAILURE;
+  }
+  return write_schedule_log (path);
+}
+
+int uthread_schedule_replay (const char *path)
+{
+  if (!deterministic)
+  {
+    std::cerr << DETERMINISTIC_ERR << std::endl;
+    return FAILURE;
+  }
+  if (path == nullptr)
+  {
+    std::cerr << NULL_ERR << std::endl;
+    return FAILURE;
+  }
+  return read_schedule_log (path);
+}
+
+int uthread_set_priority (int tid, int priority)
+{
+  if (mn_mode)
+  {
+    return mn_set_priority (tid, priority);
+  }
+  block_alarm_signal ();
+  check_delete_thread ();
+  if (!is_tid_valid (tid))
+  {
+    std::cerr << INCORRECT_TID_ERR << std::endl;
+    unblock_alarm_signal ();
+    return FAILURE;
+  }
+
+  if (!does_thread_exist (tid))
+  {
+    std::cerr << NONEXISTENT_THREAD_ERR << std::endl;
+    unblock_alarm_signal ();
+    return FAILURE;
+  }
+
+  if (priority < 0 || priority >= UTHREAD_NUM_PRIORITIES)
+  {
+    std::cerr << INCORRECT_PRIORITY_ERR << std::endl;
+    unblock_alarm_signal ();
+    return FAILURE;
+  }
+  User_Thread *thread = threads[tid];
+  bool queued = is_ready (thread);
+  if (queued)
+  {
+    erase_ready (thread);
+  }
+  thread->set_priority (priority);
+  thread->set_level (priority, boost_epoch);
+  if (queued)
+  {
+    push_ready (thread);
+  }
+  preempt_if_outranked ();
+  unblock_alarm_signal ();
+  return SUCCESS;
+}
+
+int uthread_get_tid ()
+{
+  if (mn_mode)
+  {
+    return mn_get_tid ();
+  }
+  return cur_thread->get_tid ();
+}
+
+int uthread_get_total_quantums ()
+{
+  if (mn_mode)
+  {
+    return mn_get_total_quantums ();
+  }
+  return total_ran_quantums;
+}
+
+int uthread_get_quantums (int tid)
+{
+  if (mn_mode)
+  {
+    return mn_get_quantums (tid);
+  }
+  block_alarm_signal ();
+  check_delete_thread ();
+  if (!is_tid_valid (tid))
+  {
+    std::cerr << INCORRECT_TID_ERR << std::endl;
+    unblock_alarm_signal ();
+    return FAILURE;
+  }
+
+  if (!does_thread_exist (tid))
+  {
+    std::cerr << NONEXISTENT_THREAD_ERR << std::endl;
+    unblock_alarm_signal ();
+    return FAILURE;
+  }
+  int quantums = threads[tid]->get_quantums_ran ();
+  unblock_alarm_signal ();
+  return quantums;
+}
+
+int uthread_get_metrics (int tid, uthread_metrics *metrics)
+{
+  if (mn_mode)
+  {
+    return mn_get_metrics (tid, metrics);
+  }
+  if (metrics == nullptr)
+  {
+    std::cerr << NULL_ERR << std::endl;
+    return FAILURE;
+  }
+  block_alarm_signal ();
+  check_delete_thread ();
+  if (!is_tid_valid (tid))
+  {
+    std::cerr << INCORRECT_TID_ERR << std::endl;
+    unblock_alarm_signal ();
+    return FAILURE;
+  }
+
+  if (!does_thread_exist (tid))
+  {
+    std::cerr << NONEXISTENT_THREAD_ERR << std::endl;
+    unblock_alarm_signal ();
+    return FAILURE;
+  }
+  int ret = read_metrics (threads[tid], metrics);
+  unblock_alarm_signal ();
+  return ret;
+}
+
+int uthread_stack_usage (int tid)
+{
+  if (mn_mode)
+  {
+    return mn_stack_usage (tid);
+  }
+  block_alarm_signal ();
+  check_delete_thread ();
+  if (!is_tid_valid (tid))
+  {
+    std::cerr << INCORRECT_TID_ERR << std::endl;
+    unblock_alarm_signal ();
+    return FAILURE;
+  }
+
+  if (!does_thread_exist (tid))
+  {
+    std::cerr << NONEXISTENT_THREAD_ERR << std::endl;
+    unblock_alarm_signal ();
+    return FAILURE;
+  }
+  User_Thread *thread = threads[tid];
+  int usage = tid != 0 ? stack_usage (thread->stack, thread->get_stack_size ())
+                       : FAILURE;
+  if (usage == FAILURE)
+  {
+    std::cerr << STACK_USAGE_ERR << std::endl;
+  }
+  unblock_alarm_signal ();
+  return usage;
+}
+
+int available_tid ()
+{
+  if (!free_tids.empty ())
+  {
+    int tid = free_tids.top ();
+    free_tids.pop ();
+    return tid;
+  }
+  // every tid below the table size is taken, grow the table by one.
+  threads.push_back (nullptr);
+  return (int) threads.size () - 1;
+}
+
+int thread_level (User_Thread *thread)
+{
+  switch (policy)
+  {
+    case UTHREAD_POLICY_PRIORITY:
+      return thread->get_priority ();
+    case UTHREAD_POLICY_MLFQ:
+      // a level computed before the last boost is stale.
+      if (thread->get_boost_epoch () != boost_epoch)
+      {
+        thread->set_level (thread->get_priority (), boost_epoch);
+      }
+      return thread->get_level ();
+    default:
+      return 0;
+  }
+}
+
+void push_ready (User_Thread *thread)
+{
+  int level = thread_level (thread);
+  ready_queues[level].push_back (thread);
+  TRACE_EVENT (TRACE_READY, thread);
+  ready_levels |= 1u << level;
+  ready_count++;
+  arm_timer_if_stopped ();
+}
+
+void erase_ready (User_Thread *thread)
+{
+  Thread_Queue *queue = thread->queue;
+  queue->erase (thread);
+  ready_count--;
+  if (queue->empty ())
+  {
+    ready_levels &= ~(1u << (queue - ready_queues));
+  }
+}
+
+bool is_ready (const User_Thread *thread)
+{
+  return ready_queues <= thread->queue
+         && thread->queue < ready_queues + UTHREAD_NUM_PRIORITIES;
+}
+
+User_Thread *pop_ready ()
+{
+  int level = __builtin_ctz (ready_levels);
+  User_Thread *thread = ready_queues[level].pop_front ();
+  ready_count--;
+  if (ready_queues[level].empty ())
+  {
+    ready_levels &= ~(1u << level);
+  }
+  return thread;
+}
+
+/**
+ * Picks the next thread in the deterministic mode: the thread of the replayed
+ * log while it is followed, else a pseudo-random thread of the highest ready
+ * level when a seed was given, else the thread the policy picks.
+ */
+User_Thread *pick_next_thread ()
+{
+  if (replaying (total_ran_quantums))
+  {
+    int tid = replayed_tid (total_ran_quantums);
+    if (tid >= 0 && does_thread_exist (tid) && is_ready (threads[tid]))
+    {
+      erase_ready (threads[tid]);
+      return threads[tid];
+    }
+    std::cerr << REPLAY_DIVERGED_ERR << " quantum: " << total_ran_quantums
+              << std::endl;
+    stop_replay ();
+  }
+  if (!seeded ())
+  {
+    return pop_ready ();
+  }
+  Thread_Queue &queue = ready_queues[__builtin_ctz (ready_levels)];
+  User_Thread *thread = queue.front ();
+  for (size_t skip = next_random () % queue.size (); skip > 0; skip--)
+  {
+    thread = thread->queue_next;
+  }
+  erase_ready (thread);
+  return thread;
+}
+
+void demote_thread (User_Thread *thread)
+{
+  if (policy == UTHREAD_POLICY_MLFQ)
+  {
+    int level = thread_level (thread);
+    if (level < UTHREAD_NUM_PRIORITIES - 1)
+    {
+      thread->set_level (level + 1, boost_epoch);
+    }
+  }
+}
+
+void boost_ready_threads ()
+{
+  // threads outside the ready queues pick up the new epoch lazily through
+  // thread_level, only the queued ones need to move now.
+  boost_epoch++;
+  for (int level = 1; level < UTHREAD_NUM_PRIORITIES; level++)
+  {
+    for (size_t i = ready_queues[level].size (); i > 0; i--)
+    {
+      User_Thread *thread = ready_queues[level].front ();
+      erase_ready (thread);
+      push_ready (thread);
+    }
+  }
+}
+
+void preempt_if_outranked ()
+{
+  if (policy != UTHREAD_POLICY_RR && (!cooperative || deterministic)
+      && ready_levels != 0
+      && __builtin_ctz (ready_levels) < thread_level (cur_thread))
+  {
+    timer_handler (0);
+  }
+}
+
+User_Thread *current_thread ()
+{
+  if (mn_mode)
+  {
+    return mn_current_thread ();
+  }
+  return cur_thread;
+}
+
+void park_thread (Thread_Queue *wait_queue, Spin_Lock *lock)
+{
+  if (mn_mode)
+  {
+    mn_park_thread (wait_queue, lock);
+    return;
+  }
+  cur_thread->waiting = true;
+  TRACE_EVENT (TRACE_WAIT, cur_thread);
+  wait_queue->push_back (cur_thread);
+  lock->unlock ();
+  timer_handler (0);
+}
+
+bool unpark_thread (User_Thread *thread)
+{
+  if (thread->on_wake != nullptr)
+  {
+    thread->waiting = false;
+    thread->on_wake (thread);
+    return true;
+  }
+  if (mn_mode)
+  {
+    return mn_unpark_thread (thread);
+  }
+  // a terminated thread has already left its wait queue.
+  thread->waiting = false;
+  if (thread->is_runnable ())
+  {
+    push_ready (thread);
+  }
+  return true;
+}
+
+bool thread_generation (int tid, uint64_t *generation)
+{
+  if (mn_mode)
+  {
+    return mn_thread_generation (tid, generation);
+  }
+  block_alarm_signal ();
+  bool exists = is_tid_valid (tid) && does_thread_exist (tid);
+  if (exists)
+  {
+    *generation = threads[tid]->get_generation ();
+  }
+  unblock_alarm_signal ();
+  return exists;
+}
+
+bool take_thread_values (int tid, uint64_t generation, void **values)
+{
+  if (mn_mode)
+  {
+    return mn_take_thread_values (tid, generation, values);
+  }
+  block_alarm_signal ();
+  if (!is_tid_valid (tid) || !does_thread_exist (tid)
+      || threads[tid]->get_generation () != generation)
+  {
+    unblock_alarm_signal ();
+    return false;
+  }
+  User_Thread *thread = threads[tid];
+  std::copy (thread->specific, thread->specific + UTHREAD_KEYS_MAX, values);
+  std::fill (thread->specific, thread->specific + UTHREAD_KEYS_MAX, nullptr);
+  unblock_alarm_signal ();
+  return true;
+}
+
+void defer_preemption ()
+{
+  current_thread ()->preempt_deferred = true;
+}
+
+void allow_preemption ()
+{
+  User_Thread *self = current_thread ();
+  self->preempt_deferred = false;
+  if (self->preempt_pending)
+  {
+    // delivered once the handler returns, as the deferred tick would have been.
+    self->preempt_pending = false;
+    pthread_kill (pthread_self (), SIGVTALRM);
+  }
+}
+
+void reschedule_if_outranked ()
+{
+  if (!mn_mode)
+  {
+    preempt_if_outranked ();
+  }
+}
+
+void release_tid (int tid)
+{
+  free_tids.push (tid);
+}
+
+void release_thread_tid (int tid)
+{
+  if (mn_mode)
+  {
+    mn_release_tid (tid);
+    return;
+  }
+  release_tid (tid);
+  total_threads--;
+}
+
+bool is_tid_valid (int tid)
+{
+  return 0 <= tid && tid < max_threads;
+}
+
+bool does_thread_exist (int tid)
+{
+  return tid < (int) threads.size () && threads[tid] != nullptr;
+}
+
+void clear_memory (int cond)
+{
+  for (User_Thread *thread: threads)
+  {
+    if (thread != nullptr && thread->get_tid () != 0)
+    {
+      delete thread;
+    }
+  }
+  threads.clear ();
+  delete main_thread;
+  delete thread_to_term;
+  exit (cond);
+}
+
+void self_termination_context_switch ()
+{
+  switch_to_next_thread (true);
+}
+
+void block_alarm_signal ()
+{
+  if (cooperative)
+  {
+    return;
+  }
+  sigset_t set;
+  sigemptyset (&set);
+  sigaddset (&set, SIGVTALRM);
+  if (sigprocmask (SIG_BLOCK, &set, nullptr) == -1)
+  {
+    std::cerr << SC_MASK_ERR << std::endl;
+    clear_memory (1);
+  }
+}
+
+void unblock_alarm_signal ()
+{
+  if (cooperative)
+  {
+    return;
+  }
+  sigset_t set;
+  sigemptyset (&set);
+  sigaddset (&set, SIGVTALRM);
+  if (sigprocmask (SIG_UNBLOCK, &set, nullptr) == -1)
+  {
+    std::cerr << SC_MASK_ERR << std::endl;
+    clear_memory (1);
+  }
+}
+
+void check_delete_thread ()
+{
+  if (thread_to_term != nullptr)
+  {
+    delete thread_to_term;
+    thread_to_term = nullptr;
+  }
+}
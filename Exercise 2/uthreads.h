@@ -7,11 +7,58 @@
 #define _UTHREADS_H
 
 
-#define MAX_THREAD_NUM 100 /* maximal number of threads */
-#define STACK_SIZE 409600 /* stack size per thread (in bytes) */
+#define MAX_THREAD_NUM 100 /* default maximal number of threads */
+#define STACK_SIZE 409600 /* default stack size per thread (in bytes) */
+#define MIN_STACK_SIZE 8192 /* smallest stack size a thread may be given */
+#define UTHREAD_NUM_PRIORITIES 8 /* number of priority levels, 0 is the highest */
+#define MLFQ_BOOST_QUANTUMS 100 /* default quantums between two MLFQ priority boosts */
+#define ADAPTIVE_MAX_SHIFT 3 /* an adaptive quantum grows up to quantum_usecs << ADAPTIVE_MAX_SHIFT */
+#define ADAPTIVE_LATENCY_QUANTUMS 8 /* under contention, every ready thread runs within this many base quantums */
+#define ADAPTIVE_MAX_SHRINK 4 /* an adaptive quantum shrinks down to quantum_usecs / ADAPTIVE_MAX_SHRINK */
+#define STACK_GUARD_PAGES 4 /* inaccessible pages below every painted stack */
+#define STACK_MARGIN 8192 /* bytes a learned stack gets on top of the usage seen for its entry point */
 
 typedef void (*thread_entry_point)(void);
 
+typedef void *(*uthread_start_routine)(void *);
+
+/**
+ * Scheduling policies selectable through uthread_init_config.
+ */
+typedef enum {
+    UTHREAD_POLICY_RR = 0,       /* a single round-robin queue, priorities are ignored */
+    UTHREAD_POLICY_PRIORITY = 1, /* strict priority, round-robin among threads of the same priority */
+    UTHREAD_POLICY_MLFQ = 2      /* multi-level feedback queue */
+} uthread_policy;
+
+/**
+ * Stack modes selectable through uthread_init_config.
+ */
+typedef enum {
+    UTHREAD_STACK_PLAIN = 0,   /* stack_size bytes from the heap, nothing tracked */
+    UTHREAD_STACK_PAINTED = 1, /* guarded and painted stacks, see uthread_stack_usage */
+    UTHREAD_STACK_LEARNED = 2  /* painted stacks sized from the usage seen for the same entry point */
+} uthread_stack_mode;
+
+/**
+ * Library configuration accepted by uthread_init_config.
+ * Fields holding a non-positive value fall back to their default.
+ */
+typedef struct {
+    int quantum_usecs; /* length of a quantum in micro-seconds, must be positive */
+    int max_threads;   /* maximal number of concurrent threads, main included (default MAX_THREAD_NUM) */
+    int stack_size;    /* stack size of every spawned thread in bytes (default STACK_SIZE) */
+    uthread_policy policy; /* scheduling policy (default UTHREAD_POLICY_RR) */
+    int boost_quantums; /* MLFQ only: quantums between priority boosts (default MLFQ_BOOST_QUANTUMS) */
+    int workers;       /* kernel threads running uthreads (default 1), see uthread_init_config */
+    int tickless;      /* 1:1 only: non-zero stops the timer while a single thread can run (default 0) */
+    int adaptive;      /* 1:1 only: non-zero adapts each thread's quantum to its behavior (default 0) */
+    int cooperative;   /* 1:1 only: non-zero never preempts, threads switch only when they give up the CPU (default 0) */
+    uthread_stack_mode stack_mode; /* how thread stacks are allocated (default UTHREAD_STACK_PLAIN) */
+    int deterministic; /* 1:1 only: non-zero runs on virtual time, see uthread_tick (default 0) */
+    unsigned int seed; /* deterministic only: non-zero picks among the READY threads pseudo-randomly (default 0) */
+} uthread_config;
+
 /* External interface */
 
 
@@ -29,14 +76,81 @@ typedef void (*thread_entry_point)(void);
 */
 int uthread_init(int quantum_usecs);
 
+/**
+ * @brief initializes the thread library with explicit limits.
+ *
+ * Behaves like uthread_init(config->quantum_usecs), but the thread limit and the stack size of spawned threads are
+ * taken from config instead of MAX_THREAD_NUM and STACK_SIZE. The internal thread tables start small and grow on
+ * demand, so a large max_threads costs nothing until threads are actually spawned.
+ *
+ * With workers > 1 the library runs in M:N mode: the calling kernel thread and workers - 1 additional pthreads each
+ * run uthreads from a local run queue, and a worker that runs out of threads steals from the others. Every worker
+ * preempts its own thread with a per-worker timer that counts the CPU time of that worker, so a quantum is
+ * quantum_usecs of CPU time on one core. uthreads may migrate between workers. spawn, terminate, block, resume,
+ * sleep and the query functions keep their semantics, and a quantum counts as started whenever any worker starts
+ * one. M:N mode only supports UTHREAD_POLICY_RR, and the library must not be used from kernel threads of your own.
+ *
+ * With tickless set, the timer is stopped whenever the running thread is the only one that can run and no thread
+ * sleeps or waits for I/O, so a lone thread is not interrupted, and it is started again as soon as another thread
+ * becomes ready. Quantums that run untimed still count as a single quantum.
+ * With adaptive set, a thread that uses up its whole quantum gets twice as long the next time, up to
+ * quantum_usecs << ADAPTIVE_MAX_SHIFT, and a thread that gives up the CPU early goes back to quantum_usecs. When many
+ * threads are ready the quantum shrinks so that all of them run within ADAPTIVE_LATENCY_QUANTUMS base quantums, down
+ * to quantum_usecs / ADAPTIVE_MAX_SHRINK. UTHREAD_POLICY_MLFQ keeps its own quantum per level and ignores adaptive.
+ *
+ * With cooperative set, the library installs no SIGVTALRM handler, starts no timer and never masks signals. A thread
+ * runs until it yields, blocks, sleeps, waits or terminates, and a higher priority thread that becomes READY waits
+ * for that as well. Every switch starts a new quantum, so sleeping threads count switches instead of time.
+ *
+ * With stack_mode UTHREAD_STACK_PAINTED, every stack is mapped with STACK_GUARD_PAGES inaccessible pages below it
+ * and filled with a known pattern at spawn. A thread that runs into the guard pages ends the process with a
+ * diagnostic naming the thread instead of silently corrupting memory, and uthread_stack_usage reports how deep each
+ * stack has been used. UTHREAD_STACK_LEARNED also remembers, whenever a thread ends, the deepest use seen for its
+ * entry point, and spawns later threads of that entry point with a stack of that size plus a quarter plus
+ * STACK_MARGIN bytes, never more than stack_size. Painting touches every page of a stack at spawn.
+ *
+ * With deterministic set, the library runs as in the cooperative mode, and quantums also end on virtual time: a thread
+ * that has been charged a whole quantum through uthread_tick is preempted there, as the timer would have done. Time
+ * passes only through uthread_tick and idle quantums, so a program that makes the same calls gets the same schedule
+ * on every run, however fast it runs. I/O readiness is the only outside input. A non-zero seed replaces the order
+ * among the READY threads of the highest level with a pseudo-random pick drawn from the seed, so that different seeds
+ * explore different interleavings and each seed reproduces its own. Every quantum is logged, see
+ * uthread_schedule_dump.
+ *
+ * It is an error to pass a null config, a non-positive quantum, a positive stack_size below MIN_STACK_SIZE, or a
+ * policy other than UTHREAD_POLICY_RR, cooperative or deterministic together with workers > 1.
+ *
+ * @return On success, return 0. On failure, return -1.
+*/
+int uthread_init_config(const uthread_config *config);
+
+/**
+ * @brief Sets the priority of the thread with ID tid, 0 being the highest and UTHREAD_NUM_PRIORITIES - 1 the lowest.
+ *
+ * Every thread, including main, starts with priority 0. The priority only matters under the non round-robin
+ * policies:
+ * - UTHREAD_POLICY_PRIORITY always runs a READY thread of the highest priority. Threads of equal priority share the
+ *   CPU round-robin.
+ * - UTHREAD_POLICY_MLFQ treats the priority as the top level of the thread. A thread running at level L gets a
+ *   quantum of (quantum_usecs << L) and is demoted one level whenever it uses its whole quantum. Threads that give up
+ *   the CPU earlier keep their level. Every boost_quantums quantums all threads return to their top level, so that
+ *   demoted threads cannot starve.
+ * Under both policies, a thread that becomes READY with a higher priority than the RUNNING thread preempts it at
+ * once. Picking the next thread takes constant time regardless of the number of threads.
+ * It is an error to pass a priority outside [0, UTHREAD_NUM_PRIORITIES).
+ *
+ * @return On success, return 0. On failure, return -1.
+*/
+int uthread_set_priority(int tid, int priority);
+
 /**
  * @brief Creates a new thread, whose entry point is the function entry_point with the signature
  * void entry_point(void).
  *
  * The thread is added to the end of the READY threads list.
  * The uthread_spawn function should fail if it would cause the number of concurrent threads to exceed the
- * limit (MAX_THREAD_NUM).
- * Each thread should be allocated with a stack of size STACK_SIZE bytes.
+ * limit (MAX_THREAD_NUM, or the max_threads given to uthread_init_config).
+ * Each thread should be allocated with a stack of size STACK_SIZE bytes (or the configured stack_size).
  * It is an error to call this function with a null entry_point.
  *
  * @return On success, return the ID of the created thread. On failure, return -1.
@@ -44,6 +158,48 @@ int uthread_init(int quantum_usecs);
 int uthread_spawn(thread_entry_point entry_point);
 
 
+/**
+ * @brief Creates a new thread that runs start_routine(arg), and returns its ID.
+ *
+ * Behaves like uthread_spawn, except that the thread may return: returning from start_routine terminates the thread,
+ * as uthread_terminate on its own tid would, with the returned value as its result. The thread is joinable: once it
+ * ends, its tid stays taken, and counts against the thread limit, until uthread_join collects the result. Threads
+ * whose result nobody waits for belong in uthread_spawn. Under UTHREAD_STACK_LEARNED, stacks are learned per
+ * start_routine. It is an error to call this function with a null start_routine.
+ *
+ * @return On success, return the ID of the created thread. On failure, return -1.
+*/
+int uthread_spawn_arg(uthread_start_routine start_routine, void *arg);
+
+
+/**
+ * @brief Creates count threads that run start_routine, the i-th with args[i], and stores their IDs in tids.
+ *
+ * Does the work of count calls to uthread_spawn_arg in one critical section: all tids and stacks are allocated
+ * before any of the new threads can run, and either all count threads are created or none is. args may be null, in
+ * which case every thread gets a null argument. It is an error to pass a null start_routine or tids, a non-positive
+ * count, or a count that would exceed the thread limit.
+ *
+ * @return On success, return 0. On failure, return -1.
+*/
+int uthread_spawn_n(uthread_start_routine start_routine, void **args, int count, int *tids);
+
+
+/**
+ * @brief Waits until the thread with ID tid ends, and stores its result in result unless result is null.
+ *
+ * The calling thread waits without taking quantums. The result of a thread of uthread_spawn_arg or uthread_spawn_n
+ * is the value its start routine returned, and null if it was terminated by uthread_terminate. A thread of
+ * uthread_spawn has no result and can only be joined while it exists. Joining a thread of uthread_spawn_arg that has
+ * already ended returns at once and frees its tid. Several threads may wait for the same thread, and all of them get
+ * its result. It is an error to join the main thread, the calling thread, or a tid that has neither a thread nor an
+ * uncollected result.
+ *
+ * @return On success, return 0. On failure, return -1.
+*/
+int uthread_join(int tid, void **result);
+
+
 /**
  * @brief Terminates the thread with ID tid and deletes it from all relevant control structures.
  *
@@ -96,6 +252,70 @@ int uthread_resume(int tid);
 int uthread_sleep(int num_quantums);
 
 
+/**
+ * @brief Moves the RUNNING thread to the end of the READY queue and runs the next READY thread.
+ *
+ * Unlike uthread_sleep(0), the timer is left running, so the next thread gets the rest of the current time slice.
+ * A new quantum starts only if another thread runs: a thread that is the only one that can run keeps running without
+ * a switch. Under the other policies only a thread of the same or a higher level is run. Any thread, main included,
+ * may yield.
+ *
+ * @return On success, return 0. On failure, return -1.
+*/
+int uthread_yield();
+
+
+/**
+ * @brief Returns the high-water mark of the stack of the thread with ID tid in bytes.
+ *
+ * This is the deepest the thread has used its stack since it was spawned, found as the lowest byte of the stack that
+ * no longer holds the pattern painted at spawn. It is an error to call this function when the library was not
+ * initialized with a painted stack_mode, for the main thread, or if no thread with ID tid exists.
+ *
+ * @return On success, return the stack usage in bytes. On failure, return -1.
+*/
+int uthread_stack_usage(int tid);
+
+
+/**
+ * @brief Charges usecs micro-seconds of virtual time to the RUNNING thread.
+ *
+ * This is the clock of the deterministic mode. Threads call it at their preemption points, e.g. once per unit of
+ * simulated work, or a driver thread calls it to let time pass. Once the RUNNING thread has been charged its quantum,
+ * it is preempted as by the timer and a new quantum starts. It is an error to call this function outside the
+ * deterministic mode or with a negative usecs.
+ *
+ * @return On success, return 0. On failure, return -1.
+*/
+int uthread_tick(int usecs);
+
+
+/**
+ * @brief Writes the schedule log of the deterministic mode to path.
+ *
+ * The log is CSV with a quantum,time_usecs,tid header and one row per quantum since uthread_init_config: the quantum
+ * number, the virtual time at which it started and the tid of the thread that ran it. Quantums skipped while every
+ * thread slept have no row. It is an error to call this function outside the deterministic mode.
+ *
+ * @return On success, return 0. On failure, return -1.
+*/
+int uthread_schedule_dump(const char *path);
+
+
+/**
+ * @brief Replays a schedule log written by uthread_schedule_dump.
+ *
+ * From the next quantum on, the scheduler runs the thread the log names for each quantum instead of consulting the
+ * policy or the seed, which reproduces a logged interleaving even after changes that would alter the seeded picks.
+ * If the logged thread cannot run, e.g. because the program changed, an error is printed once and the scheduler
+ * goes back to its own picks. It is an error to call this function outside the deterministic mode or with a file
+ * that is not such a log.
+ *
+ * @return On success, return 0. On failure, return -1.
+*/
+int uthread_schedule_replay(const char *path);
+
+
 /**
  * @brief Returns the thread ID of the calling thread.
  *
@@ -0,0 +1,189 @@
+#ifndef _UTHREADS_INTERNAL_H_
+#define _UTHREADS_INTERNAL_H_
+
+#include "uthreads.h"
+#include <cstdint>
+
+// definitions shared by the translation units of the library, not part of
+// the public interface.
+
+// constants.
+#define FAILURE (-1)
+#define SUCCESS 0
+#define WAIT_QUEUED 2
+#define INIT_ERR "thread library error: quantums must be positive."
+#define INIT_CONFIG_ERR "thread library error: invalid library configuration."
+#define SC_SET_TIMER_ERR "system error: the setitimer system call has failed."
+#define MAX_THREADS_ERR "thread library error: maximum amount of threads \
+achieved."
+#define MEM_ALLOC_ERR "thread library error: failed to allocate memory when \
+spawning a new thread."
+#define NULL_ERR "thread library error: provided null argument."
+#define INCORRECT_TID_ERR "thread library error: thread id is not valid."
+#define NONEXISTENT_THREAD_ERR "thread library error: thread with the \
+provided id does not exist."
+#define SC_MASK_ERR "system error: the sigprocmask system call has failed."
+#define SC_SIG_ACTION_ERR "system error: the sigaction system call has failed."
+#define SC_SIGSETJMP_ERR "system error: the sigsetjmp system call has failed."
+#define SC_SIGLONGJMP_ERR "system error: the siglongjmp system call has \
+failed."
+#define BLOCK_MAIN_ERR "thread library error: the main thread should not be \
+blocked."
+#define INCORRECT_SLEEP_QUANTUMS_ERR "thread library error: sleep num of \
+quantums must be positive."
+#define SLEEP_MAIN_THREAD_ERR "thread library error: the main thread should \
+not be asleep."
+#define INCORRECT_PRIORITY_ERR "thread library error: priority is out of \
+range."
+#define SC_TIMER_CREATE_ERR "system error: the timer_create system call has \
+failed."
+#define SC_TIMER_SETTIME_ERR "system error: the timer_settime system call has \
+failed."
+#define SC_PTHREAD_CREATE_ERR "system error: the pthread_create call has \
+failed."
+#define DEADLOCK_ERR "thread library error: every thread is blocked or \
+waiting, deadlock."
+#define MUTEX_RELOCK_ERR "thread library error: the mutex is already locked \
+by the calling thread."
+#define MUTEX_NOT_OWNER_ERR "thread library error: the mutex is not locked by \
+the calling thread."
+#define PRIMITIVE_BUSY_ERR "thread library error: cannot destroy a \
+synchronization primitive that is in use."
+#define INCORRECT_SEM_VALUE_ERR "thread library error: semaphore value must \
+not be negative."
+#define INCORRECT_CHAN_CAPACITY_ERR "thread library error: channel capacity \
+must not be negative."
+#define SYNC_ALLOC_ERR "thread library error: failed to allocate memory for a \
+synchronization primitive."
+#define SC_EPOLL_ERR "system error: an epoll system call has failed."
+#define TRACE_DISABLED_ERR "thread library error: tracing is not compiled in, \
+build the library with -DUTHREAD_TRACE."
+#define TRACE_FILE_ERR "system error: failed to write the trace file."
+#define CHAN_CLOSED_ERR "thread library error: the channel is closed."
+#define SC_SIGALTSTACK_ERR "system error: the sigaltstack system call has \
+failed."
+#define STACK_USAGE_ERR "thread library error: stack usage is only known for \
+spawned threads with painted stacks."
+#define KEYS_EXHAUSTED_ERR "thread library error: all UTHREAD_KEYS_MAX keys \
+are in use."
+#define INCORRECT_KEY_ERR "thread library error: key is not valid."
+#define STACK_OVERFLOW_ERR "thread library error: a thread overflowed its \
+stack."
+#define DETERMINISTIC_ERR "thread library error: the call needs the \
+deterministic mode."
+#define INCORRECT_TICK_ERR "thread library error: ticks must not be negative."
+#define SCHEDULE_FILE_ERR "system error: failed to access the schedule log."
+#define SCHEDULE_FORMAT_ERR "thread library error: the schedule log is \
+malformed."
+#define JOIN_SELF_ERR "thread library error: a thread cannot join itself or the \
+main thread."
+#define INCORRECT_SPAWN_COUNT_ERR "thread library error: the number of \
+threads to spawn must be positive."
+#define REPLAY_DIVERGED_ERR "thread library error: the schedule left the \
+replayed log, which is no longer followed."
+
+// masks SIGVTALRM for the calling kernel thread, exits on failure.
+void block_alarm_signal ();
+
+void unblock_alarm_signal ();
+
+class User_Thread;
+class Thread_Queue;
+class Spin_Lock;
+struct uthread_chan;
+
+// scheduler hooks for the synchronization primitives, in either mode.
+
+// the calling thread. safe to call with SIGVTALRM unblocked.
+User_Thread *current_thread ();
+
+// puts the calling thread on wait_queue and gives up the CPU until
+// unpark_thread. lock guards wait_queue, it must be held on entry and is
+// released once the thread is on the queue.
+void park_thread (Thread_Queue *wait_queue, Spin_Lock *lock);
+
+// makes a thread taken off a wait queue runnable again. returns false if the
+// thread was terminated while it waited, in which case it is freed and the
+// caller should wake another thread instead.
+bool unpark_thread (User_Thread *thread);
+
+// stores the generation of the thread with ID tid, see User_Thread. returns
+// false, without an error, if no such thread exists.
+bool thread_generation (int tid, uint64_t *generation);
+
+// copies the key values of the thread with ID tid and generation to values
+// and clears them. returns false, without an error, if no such thread exists.
+bool take_thread_values (int tid, uint64_t generation, void **values);
+
+// runs the key destructors of the thread with ID tid and generation, see
+// uthread_key.h.
+void run_key_destructors (int tid, uint64_t generation);
+
+// defers the preemption of the calling thread until allow_preemption, which
+// then gives up the CPU if a tick of the timer arrived in between. a thread
+// that blocks or yields still switches out. safe to call with SIGVTALRM
+// unblocked.
+void defer_preemption ();
+
+void allow_preemption ();
+
+// spawns count threads, running entry_point, or start_routine with args[i]
+// (null args for none) when start_routine is set, and stores their tids. all
+// or none are created.
+int spawn_threads (thread_entry_point entry_point,
+                   uthread_start_routine start_routine, void **args,
+                   int count, int *tids);
+
+// the entry point of threads with a start routine, see uthread_join.cpp.
+void run_start_routine ();
+
+// join support, implemented in uthread_join.cpp. all must be called with
+// SIGVTALRM blocked, and the scheduler calls them under its thread table lock.
+
+// makes room for the join state of every tid below count, throws
+// std::bad_alloc on failure.
+void reserve_join_slots (int count);
+
+// resets the join state of a newly spawned thread. a joinable thread keeps its
+// tid after it ends until it is joined.
+void reset_join_slot (int tid, bool joinable);
+
+// records that the thread with ID tid ended with result, and hands result to
+// every thread joining it. returns true if the tid must stay taken until
+// uthread_join collects result, false if it can be reused at once.
+bool end_join_slot (int tid, void *result);
+
+// hands a tid kept by end_join_slot back to the scheduler.
+void release_thread_tid (int tid);
+
+// the waits of the coroutine tasks. instead of parking the calling thread,
+// they queue waiter, a stackless stand-in whose on_wake is called by
+// unpark_thread. must be called with SIGVTALRM blocked.
+
+// receives from chan as uthread_chan_recv does, or queues waiter and returns
+// WAIT_QUEUED, in which case the item arrives in waiter->wait_data.
+int chan_receive (uthread_chan *chan, void **item, User_Thread *waiter);
+
+// queues waiter until fd is ready for direction, EPOLLIN or EPOLLOUT.
+void queue_fd_waiter (int fd, uint32_t direction, User_Thread *waiter);
+
+// gives up the CPU if unpark_thread woke a thread that outranks the caller.
+// call after releasing every primitive lock.
+void reschedule_if_outranked ();
+
+// the I/O reactor, polled by the schedulers.
+
+// true while some file descriptor has waiting threads.
+bool io_pending ();
+
+// called once a thread terminated while parked on fd by the reactor, and, in
+// the 1:1 mode, taken off its wait queue. unregisters fd from epoll unless
+// other threads still wait on it. must be called with SIGVTALRM blocked.
+void drop_fd_waiter (int fd);
+
+// wakes the threads whose file descriptors are ready, waiting up to
+// timeout_ms for one (-1 waits forever). returns at once if another worker is
+// polling. must be called with SIGVTALRM blocked.
+void poll_io (int timeout_ms);
+
+#endif //_UTHREADS_INTERNAL_H_
@@ -0,0 +1,107 @@
+#include "work_stealing_deque.h"
+
+#define INITIAL_DEQUE_CAPACITY 64
+
+Work_Stealing_Deque::Work_Stealing_Deque () : top (0), bottom (0)
+{
+  Ring *initial = new Ring;
+  initial->capacity = INITIAL_DEQUE_CAPACITY;
+  initial->slots = new std::atomic<User_Thread *>[INITIAL_DEQUE_CAPACITY];
+  ring.store (initial, std::memory_order_relaxed);
+}
+
+Work_Stealing_Deque::~Work_Stealing_Deque ()
+{
+  retired.push_back (ring.load (std::memory_order_relaxed));
+  for (Ring *old: retired)
+  {
+    delete[] old->slots;
+    delete old;
+  }
+}
+
+Work_Stealing_Deque::Ring *
+Work_Stealing_Deque::grow (Ring *old, long bottom, long top)
+{
+  Ring *bigger = new Ring;
+  bigger->capacity = old->capacity * 2;
+  bigger->slots = new std::atomic<User_Thread *>[bigger->capacity];
+  for (long i = top; i < bottom; i++)
+  {
+    bigger->slots[i % bigger->capacity].store (
+        old->slots[i % old->capacity].load (std::memory_order_relaxed),
+        std::memory_order_relaxed);
+  }
+  retired.push_back (old);
+  this->ring.store (bigger, std::memory_order_release);
+  return bigger;
+}
+
+void Work_Stealing_Deque::push (User_Thread *thread)
+{
+  long b = bottom.load (std::memory_order_relaxed);
+  long t = top.load (std::memory_order_acquire);
+  Ring *r = ring.load (std::memory_order_relaxed);
+  if (b - t > r->capacity - 1)
+  {
+    r = grow (r, b, t);
+  }
+  r->slots[b % r->capacity].store (thread, std::memory_order_relaxed);
+  std::atomic_thread_fence (std::memory_order_release);
+  bottom.store (b + 1, std::memory_order_relaxed);
+}
+
+User_Thread *Work_Stealing_Deque::pop ()
+{
+  long b = bottom.load (std::memory_order_relaxed) - 1;
+  Ring *r = ring.load (std::memory_order_relaxed);
+  bottom.store (b, std::memory_order_relaxed);
+  std::atomic_thread_fence (std::memory_order_seq_cst);
+  long t = top.load (std::memory_order_relaxed);
+  User_Thread *thread = nullptr;
+  if (t <= b)
+  {
+    thread = r->slots[b % r->capacity].load (std::memory_order_relaxed);
+    if (t == b)
+    {
+      // the last element, race the thieves for it.
+      if (!top.compare_exchange_strong (t, t + 1, std::memory_order_seq_cst,
+                                        std::memory_order_relaxed))
+      {
+        thread = nullptr;
+      }
+      bottom.store (b + 1, std::memory_order_relaxed);
+    }
+  }
+  else
+  {
+    bottom.store (b + 1, std::memory_order_relaxed);
+  }
+  return thread;
+}
+
+User_Thread *Work_Stealing_Deque::steal ()
+{
+  long t = top.load (std::memory_order_acquire);
+  std::atomic_thread_fence (std::memory_order_seq_cst);
+  long b = bottom.load (std::memory_order_acquire);
+  if (t >= b)
+  {
+    return nullptr;
+  }
+  Ring *r = ring.load (std::memory_order_acquire);
+  User_Thread *thread = r->slots[t % r->capacity].load
+      (std::memory_order_relaxed);
+  if (!top.compare_exchange_strong (t, t + 1, std::memory_order_seq_cst,
+                                    std::memory_order_relaxed))
+  {
+    return nullptr;
+  }
+  return thread;
+}
+
+bool Work_Stealing_Deque::empty () const
+{
+  return bottom.load (std::memory_order_relaxed)
+         <= top.load (std::memory_order_relaxed);
+}
@@ -0,0 +1,58 @@
+#ifndef _WORK_STEALING_DEQUE_H_
+#define _WORK_STEALING_DEQUE_H_
+
+#include <atomic>
+#include <vector>
+
+class User_Thread;
+
+/**
+ * A Chase-Lev work-stealing deque of threads (Chase & Lev, SPAA 2005, with the
+ * C11 memory orderings of Le et al., PPoPP 2013).
+ * Only the owning worker may push and pop, at the bottom end. Any worker,
+ * including the owner, may steal from the top end, so an owner that pushes
+ * and steals from its own deque gets a FIFO run queue.
+ * The ring doubles when full. Replaced rings are kept until destruction,
+ * since a concurrent thief may still be reading from them.
+ */
+class Work_Stealing_Deque
+{
+
+ public:
+  // constructor
+  Work_Stealing_Deque ();
+
+  // destructor
+  ~Work_Stealing_Deque ();
+
+  Work_Stealing_Deque (const Work_Stealing_Deque &) = delete;
+
+  Work_Stealing_Deque &operator= (const Work_Stealing_Deque &) = delete;
+
+  // owner only.
+  void push (User_Thread *thread);
+
+  // owner only, returns nullptr when empty.
+  User_Thread *pop ();
+
+  // returns nullptr when empty or when another worker won the race.
+  User_Thread *steal ();
+
+  bool empty () const;
+
+ private:
+  struct Ring
+  {
+    long capacity;
+    std::atomic<User_Thread *> *slots;
+  };
+
+  Ring *grow (Ring *ring, long bottom, long top);
+
+  std::atomic<long> top;
+  std::atomic<long> bottom;
+  std::atomic<Ring *> ring;
+  std::vector<Ring *> retired;
+};
+
+#endif //_WORK_STEALING_DEQUE_H_
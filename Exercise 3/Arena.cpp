@@ -0,0 +1,63 @@
+#include "Arena.h"
+#include <algorithm>
+#include <cstdlib>
+#include <cstdio>
+
+// every allocation is aligned for any fundamental type.
+static const size_t ALIGNMENT = alignof(std::max_align_t);
+
+Arena::Arena()
+		: next(nullptr)
+		, left(0)
+{ }
+
+
+Arena::~Arena()
+{
+	for (const std::pair<uintptr_t, size_t>& block : blocks) {
+		free(reinterpret_cast<char*>(block.first));
+	}
+}
+
+
+void* Arena::allocate(size_t size)
+{
+	size = (size + ALIGNMENT - 1) & ~(ALIGNMENT - 1);
+	if (size > ARENA_BLOCK_SIZE / 2) {
+		// a large allocation gets a block of its own, and the current
+		// block stays in use.
+		return add_block(size);
+	}
+	if (size > left) {
+		next = add_block(ARENA_BLOCK_SIZE);
+		left = ARENA_BLOCK_SIZE;
+	}
+	void* allocation = next;
+	next += size;
+	left -= size;
+	return allocation;
+}
+
+
+bool Arena::owns(const void* pointer) const
+{
+	uintptr_t address = reinterpret_cast<uintptr_t>(pointer);
+	auto after = std::upper_bound(blocks.begin(), blocks.end(),
+			std::make_pair(address, SIZE_MAX));
+	return after != blocks.begin()
+			&& address - (after - 1)->first < (after - 1)->second;
+}
+
+
+char* Arena::add_block(size_t size)
+{
+	char* block = static_cast<char*>(malloc(size));
+	if (block == nullptr) {
+		fprintf(stderr, "[[Arena]] error on malloc");
+		exit(1);
+	}
+	// blocks are added rarely, once per ARENA_BLOCK_SIZE bytes at most.
+	std::pair<uintptr_t, size_t> span(reinterpret_cast<uintptr_t>(block), size);
+	blocks.insert(std::upper_bound(blocks.begin(), blocks.end(), span), span);
+	return block;
+}
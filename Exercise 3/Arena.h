@@ -0,0 +1,34 @@
+#ifndef ARENA_H
+#define ARENA_H
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+// a bump allocator. allocations are never freed one by one, all the memory
+// goes back at once when the arena is destroyed. not thread safe.
+
+#define ARENA_BLOCK_SIZE 65536
+
+class Arena {
+public:
+	Arena();
+	~Arena();
+	void* allocate(size_t size);
+	// whether pointer points into memory allocate handed out, in
+	// O(log blocks).
+	bool owns(const void* pointer) const;
+
+private:
+	Arena(const Arena&);
+	Arena& operator=(const Arena&);
+
+	char* add_block(size_t size);
+
+	// the start and size of every block, by address.
+	std::vector<std::pair<uintptr_t, size_t> > blocks;
+	char* next;
+	size_t left;
+};
+
+#endif //ARENA_H
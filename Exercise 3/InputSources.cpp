@@ -0,0 +1,153 @@
+#include "InputSources.h"
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <cstdio>
+#include <cstring>
+
+MmapLineSource::MmapLineSource(const char* path, size_t chunkBytes)
+		: data(nullptr)
+		, size(0)
+		, chunkBytes(std::max<size_t>(chunkBytes, 1))
+		, nextOffset(0)
+{
+	fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		fprintf(stderr, "[[MmapLineSource]] error on open");
+		exit(1);
+	}
+	struct stat st;
+	if (fstat(fd, &st) != 0) {
+		fprintf(stderr, "[[MmapLineSource]] error on fstat");
+		exit(1);
+	}
+	size = st.st_size;
+	if (size == 0) {
+		// an empty file has no lines and nothing to map.
+		return;
+	}
+	void* mapped = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+	if (mapped == MAP_FAILED) {
+		fprintf(stderr, "[[MmapLineSource]] error on mmap");
+		exit(1);
+	}
+	data = static_cast<char*>(mapped);
+	madvise(data, size, MADV_SEQUENTIAL);
+}
+
+
+MmapLineSource::~MmapLineSource()
+{
+	if (data != nullptr) {
+		munmap(data, size);
+	}
+	close(fd);
+}
+
+
+size_t MmapLineSource::total() const
+{
+	return size;
+}
+
+
+bool MmapLineSource::next(InputVec& chunk, size_t* consumed)
+{
+	chunk.clear();
+	size_t begin = nextOffset.fetch_add(chunkBytes);
+	if (begin >= size) {
+		return false;
+	}
+	size_t end = std::min(begin + chunkBytes, size);
+	*consumed = end - begin;
+
+	// a line starts at offset 0 or right after a '\n', and belongs to the
+	// chunk it starts in, however far it goes past the chunk.
+	size_t line = begin;
+	if (line > 0 && data[line - 1] != '\n') {
+		const char* newline = static_cast<const char*>(
+				memchr(data + line, '\n', end - line));
+		line = newline == nullptr ? end : newline - data + 1;
+	}
+	while (line < end) {
+		const char* newline = static_cast<const char*>(
+				memchr(data + line, '\n', size - line));
+		size_t lineEnd = newline == nullptr ? size : newline - data;
+		chunk.emplace_back(new LineKey(line),
+				new LineValue(data + line, lineEnd - line));
+		line = lineEnd + 1;
+	}
+	return true;
+}
+
+
+void MmapLineSource::release(InputVec& chunk)
+{
+	if (!chunk.empty()) {
+		// the pages stay in the file, and are read again should a chunk
+		// next to this one need them. a chunk also reads the ends of its
+		// neighbours, and faulting one page in maps the pages around it, so
+		// the pages of the neighbours go too.
+		const LineValue* first = static_cast<const LineValue*>(
+				chunk.front().second);
+		const LineValue* last = static_cast<const LineValue*>(
+				chunk.back().second);
+		size_t begin = first->data - data;
+		size_t end = last->data + last->length - data;
+		begin = begin > chunkBytes ? begin - chunkBytes : 0;
+		end = std::min(end + chunkBytes, size);
+		uintptr_t pageSize = sysconf(_SC_PAGESIZE);
+		uintptr_t from = (uintptr_t) (data + begin) & ~(pageSize - 1);
+		uintptr_t to = (uintptr_t) (data + end) & ~(pageSize - 1);
+		if (from < to) {
+			madvise((void*) from, to - from, MADV_DONTNEED);
+		}
+	}
+	InputSource::release(chunk);
+}
+
+
+GeneratorSource::GeneratorSource(std::function<bool(InputPair&)> generator,
+		size_t chunkPairs)
+		: generator(generator)
+		, chunkPairs(std::max<size_t>(chunkPairs, 1))
+		, mutex(PTHREAD_MUTEX_INITIALIZER)
+		, exhausted(false)
+{ }
+
+
+GeneratorSource::~GeneratorSource()
+{
+	if (pthread_mutex_destroy(&mutex) != 0) {
+		fprintf(stderr, "[[GeneratorSource]] error on pthread_mutex_destroy");
+		exit(1);
+	}
+}
+
+
+bool GeneratorSource::next(InputVec& chunk, size_t* consumed)
+{
+	chunk.clear();
+	if (pthread_mutex_lock(&mutex) != 0) {
+		fprintf(stderr, "[[GeneratorSource]] error on pthread_mutex_lock");
+		exit(1);
+	}
+	InputPair pair;
+	while (!exhausted && chunk.size() < chunkPairs) {
+		if (generator(pair)) {
+			chunk.push_back(pair);
+		} else {
+			exhausted = true;
+		}
+	}
+	if (pthread_mutex_unlock(&mutex) != 0) {
+		fprintf(stderr, "[[GeneratorSource]] error on pthread_mutex_unlock");
+		exit(1);
+	}
+	*consumed = chunk.size();
+	return !chunk.empty();
+}
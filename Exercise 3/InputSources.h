@@ -0,0 +1,79 @@
+#ifndef INPUTSOURCES_H
+#define INPUTSOURCES_H
+#include "MapReduceClient.h"
+#include <pthread.h>
+#include <atomic>
+#include <cstddef>
+#include <functional>
+
+// ready made input sources for startMapReduceJobSource.
+
+#define LINE_CHUNK_BYTES 65536
+#define GENERATOR_CHUNK_PAIRS 1024
+
+// the key of a line of a MmapLineSource, its offset in the file.
+class LineKey : public K1 {
+public:
+	explicit LineKey(size_t offset) : offset(offset) { }
+	bool operator<(const K1 &other) const override {
+		return offset < static_cast<const LineKey&>(other).offset;
+	}
+
+	size_t offset;
+};
+
+// the text of a line of a MmapLineSource without its '\n', pointing into the
+// mapped file, so it is valid only until the line is released.
+class LineValue : public V1 {
+public:
+	LineValue(const char* data, size_t length) : data(data), length(length) { }
+
+	const char* data;
+	size_t length;
+};
+
+// the lines of a file, mapped read only. a chunk is the lines that start in
+// the next chunkBytes of the file, claimed with an atomic add, and the pages
+// of a chunk are given back once it is released. the total is the size of
+// the file.
+class MmapLineSource : public InputSource {
+public:
+	explicit MmapLineSource(const char* path,
+		size_t chunkBytes = LINE_CHUNK_BYTES);
+	~MmapLineSource();
+	size_t total() const override;
+	bool next(InputVec& chunk, size_t* consumed) override;
+	void release(InputVec& chunk) override;
+
+private:
+	MmapLineSource(const MmapLineSource&);
+	MmapLineSource& operator=(const MmapLineSource&);
+
+	int fd;
+	char* data;
+	size_t size;
+	size_t chunkBytes;
+	std::atomic<size_t> nextOffset;
+};
+
+// the pairs a generator makes. generator sets its argument to the next pair
+// and returns true, or returns false once there are none left. it is called
+// under a lock, chunkPairs times per chunk at most. the total is unknown.
+class GeneratorSource : public InputSource {
+public:
+	explicit GeneratorSource(std::function<bool(InputPair&)> generator,
+		size_t chunkPairs = GENERATOR_CHUNK_PAIRS);
+	~GeneratorSource();
+	bool next(InputVec& chunk, size_t* consumed) override;
+
+private:
+	GeneratorSource(const GeneratorSource&);
+	GeneratorSource& operator=(const GeneratorSource&);
+
+	std::function<bool(InputPair&)> generator;
+	size_t chunkPairs;
+	pthread_mutex_t mutex;
+	bool exhausted;
+};
+
+#endif //INPUTSOURCES_H
@@ -1,6 +1,7 @@
 #ifndef MAPREDUCECLIENT_H
 #define MAPREDUCECLIENT_H
 
+#include <cstddef> //size_t
 #include <vector>  //std::vector
 #include <utility> //std::pair
 
@@ -64,5 +65,74 @@ public:
 	virtual void reduce(const IntermediateVec* pairs, void* context) const = 0;
 };
 
+// a client whose pairs of one K2 key can be combined before the shuffle,
+// e.g. into a partial count. the framework combines the pairs each thread
+// emitted, after its sort and whenever its buffer grows large during map.
+class MapReduceCombinerClient : public MapReduceClient {
+public:
+	// gets the (K2, V2) pairs of a single K2 key emitted by one thread and
+	// calls emit2(K2, V2, context) with that key any number of times (usually
+	// once) to replace them. like reduce, frees what it does not emit.
+	virtual void combine(const IntermediateVec* pairs, void* context) const = 0;
+};
+
+// writes (K2, V2) pairs to bytes and reads them back, for the jobs that spill
+// their pairs to disk once they outgrow a memory budget, see JobConfig.
+class MapReduceSerializer {
+public:
+	virtual ~MapReduceSerializer() {}
+
+	// the number of bytes serialize writes for the pair, at least 1.
+	virtual size_t size(const K2* key, const V2* value) const = 0;
+
+	// writes the pair to the size(key, value) bytes at buffer.
+	virtual void serialize(const K2* key, const V2* value,
+		char* buffer) const = 0;
+
+	// reads a pair serialize wrote at buffer into new objects, and returns
+	// the number of bytes it read.
+	virtual size_t deserialize(const char* buffer, K2** key,
+		V2** value) const = 0;
+
+	// frees a pair the framework has written out, or has read back only to
+	// look at its key. the pairs reduce gets are freed by reduce, as always.
+	// a key or value that came from emit2_alloc is never passed here, null
+	// is passed in its place, and so is a null value. the copies read back
+	// of such parts are passed here once reduce is done with them, since
+	// reduce does not free them.
+	virtual void destroy(K2* key, V2* value) const {
+		delete key;
+		delete value;
+	}
+};
+
+// a source of (K1, V1) pairs that the threads of a job pull a chunk at a time
+// as they map, instead of an InputVec loaded up front. see InputSources.h
+// for ready made ones.
+class InputSource {
+public:
+	virtual ~InputSource() {}
+
+	// how much input there is, in any unit the chunks of next add up to
+	// exactly, for the job to report its map progress in. 0 when unknown.
+	virtual size_t total() const { return 0; }
+
+	// replaces the pairs in chunk with the next chunk of the input, which
+	// may be empty, and sets consumed to its share of total. returns false,
+	// and leaves chunk empty, once the input is exhausted. called by the
+	// threads of a job at once.
+	virtual bool next(InputVec& chunk, size_t* consumed) = 0;
+
+	// frees the pairs of a chunk once they are mapped, so map must not keep
+	// pointers to them.
+	virtual void release(InputVec& chunk) {
+		for (InputPair& pair : chunk) {
+			delete pair.first;
+			delete pair.second;
+		}
+		chunk.clear();
+	}
+};
+
 
 #endif //MAPREDUCECLIENT_H
@@ -0,0 +1,358 @@
+#ifndef MAPREDUCECORE_H
+#define MAPREDUCECORE_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+/*
+ * The parts of a job that the classic API of MapReduceFramework.cpp and the
+ * templates of MapReduceJob.h share: the map ranges threads claim input from,
+ * the sampling that cuts the key space into partitions, the k-way merges of
+ * the shuffle and of ordered output, and the placement of the output. They
+ * are templates over the pair type and its order, so the classic API runs
+ * them on pointer pairs ordered by the virtual operator<, and MapReduceJob on
+ * pairs stored inline and ordered by its Compare.
+ */
+
+// the bytes of a cache line. counters that different threads update sit on
+// lines of their own.
+#define CACHE_LINE_SIZE 64
+// a thread claims a 1/MAP_CHUNK_DIVISOR of what is left of its map range at a
+// time, so chunks start large and shrink towards the end of the range.
+#define MAP_CHUNK_DIVISOR 4
+// every sorted run offers this many samples per thread of the job, which
+// bounds the skew of the partitions around the splitters.
+#define SAMPLES_PER_PARTITION 8
+
+namespace mapreduce
+{
+namespace detail
+{
+
+// the input pairs a thread has left to map, [next, end) packed as next << 32
+// | end. the owner claims chunks from next, and thieves take halves from end,
+// both with a compare and swap.
+struct MapRange
+{
+    std::atomic<uint64_t> bounds;
+    char pad[CACHE_LINE_SIZE - sizeof (std::atomic<uint64_t>)];
+};
+
+// packs the bounds of a map range.
+inline uint64_t map_range (unsigned long next, unsigned long end)
+{
+  return (static_cast<uint64_t>(next) << 32) | static_cast<uint64_t>(end);
+}
+
+// splits size input pairs into one contiguous range per thread.
+inline void init_map_ranges (MapRange *ranges, int num_threads, size_t size)
+{
+  for (int i = 0; i < num_threads; i++)
+  {
+    ranges[i].bounds.store (map_range (size * i / num_threads,
+                                       size * (i + 1) / num_threads));
+  }
+}
+
+// takes the upper half of the largest range left among the other threads
+// and makes it the range of thread_id, whose own range is empty. returns
+// false when every range is empty.
+inline bool steal_map_range (MapRange *ranges, int num_threads, int thread_id)
+{
+  for (;;)
+  {
+    int victim = -1;
+    uint64_t victim_range = 0;
+    unsigned long most_left = 0;
+    for (int i = 0; i < num_threads; ++i)
+    {
+      uint64_t range = ranges[i].bounds.load ();
+      unsigned long next = range >> 32;
+      unsigned long end = range & 0xFFFFFFFF;
+      if (next < end && end - next > most_left)
+      {
+        victim = i;
+        victim_range = range;
+        most_left = end - next;
+      }
+    }
+    if (victim < 0)
+    {
+      return false;
+    }
+    unsigned long next = victim_range >> 32;
+    unsigned long end = victim_range & 0xFFFFFFFF;
+    unsigned long half = (end - next + 1) / 2;
+    if (ranges[victim].bounds.compare_exchange_strong (
+        victim_range, map_range (next, end - half)))
+    {
+      // a thief that read the old, empty range fails its compare and swap.
+      ranges[thread_id].bounds.store (map_range (end - half, end));
+      return true;
+    }
+  }
+}
+
+// claims the next chunk of input pairs for thread_id to map, [first, last),
+// from its own range or, once that is empty, from a range it steals.
+// returns false when no input is left anywhere.
+inline bool claim_map_chunk (MapRange *ranges, int num_threads, int thread_id,
+                             unsigned long *first, unsigned long *last)
+{
+  std::atomic<uint64_t> &bounds = ranges[thread_id].bounds;
+  for (;;)
+  {
+    uint64_t range = bounds.load ();
+    unsigned long next = range >> 32;
+    unsigned long end = range & 0xFFFFFFFF;
+    if (next >= end)
+    {
+      if (!steal_map_range (ranges, num_threads, thread_id))
+      {
+        return false;
+      }
+      continue;
+    }
+    unsigned long chunk = std::max<unsigned long> ((end - next)
+                                                   / MAP_CHUNK_DIVISOR, 1);
+    if (bounds.compare_exchange_weak (range, map_range (next + chunk, end)))
+    {
+      *first = next;
+      *last = next + chunk;
+      return true;
+    }
+  }
+}
+
+// a k-way merge of sorted runs of pairs: a binary min-heap of the heads of
+// the runs, ordered by less, costing O(log k) comparisons per pair.
+template <typename Pair, typename Less>
+class RunMerger
+{
+ public:
+  explicit RunMerger (Less less) : less (less)
+  {}
+
+  void add_run (Pair *first, Pair *last)
+  {
+    if (first != last)
+    {
+      heap.emplace_back (first, last);
+      std::push_heap (heap.begin (), heap.end (),
+                      [this] (const Run &r1, const Run &r2)
+                      {
+                          return head_greater (r1, r2);
+                      });
+    }
+  }
+
+  bool empty () const
+  {
+    return heap.empty ();
+  }
+
+  // the smallest pair among the heads. it may be moved from before pop.
+  Pair &top () const
+  {
+    return *heap.front ().first;
+  }
+
+  // moves past top. the run of top keeps its place at the root if it still
+  // has the smallest head, which is the common case for runs with long
+  // stretches of small keys.
+  void pop ()
+  {
+    if (++heap.front ().first == heap.front ().second)
+    {
+      heap.front () = heap.back ();
+      heap.pop_back ();
+    }
+    sift_down ();
+  }
+
+  const Less &order () const
+  {
+    return less;
+  }
+
+ private:
+  typedef std::pair<Pair *, Pair *> Run;
+
+  bool head_greater (const Run &r1, const Run &r2) const
+  {
+    return less (*r2.first, *r1.first);
+  }
+
+  void sift_down ()
+  {
+    size_t size = heap.size ();
+    size_t i = 0;
+    for (;;)
+    {
+      size_t child = 2 * i + 1;
+      if (child >= size)
+      {
+        return;
+      }
+      if (child + 1 < size && head_greater (heap[child], heap[child + 1]))
+      {
+        ++child;
+      }
+      if (!head_greater (heap[i], heap[child]))
+      {
+        return;
+      }
+      std::swap (heap[i], heap[child]);
+      i = child;
+    }
+  }
+
+  Less less;
+  std::vector<Run> heap;
+};
+
+// appends SAMPLES_PER_PARTITION keys per thread of the job, evenly spaced,
+// from a sorted run to samples.
+template <typename Pair, typename Key>
+void sample_run (const std::vector<Pair> &run, int num_threads,
+                 std::vector<Key> &samples)
+{
+  size_t wanted = (size_t) SAMPLES_PER_PARTITION * num_threads;
+  size_t step = std::max<size_t> (run.size () / wanted, 1);
+  for (size_t i = step / 2; i < run.size (); i += step)
+  {
+    samples.push_back (run[i].first);
+  }
+}
+
+// picks num_threads - 1 splitters from the samples of all the threads, the
+// same ones in every thread. samples_of (i) gives the samples of thread i.
+// partition p holds the keys from splitter p - 1, inclusive, up to splitter
+// p. there are none when there are no samples.
+template <typename Key, typename SamplesOf, typename KeyLess>
+std::vector<Key> choose_splitters (int num_threads, SamplesOf samples_of,
+                                   KeyLess less)
+{
+  std::vector<Key> samples;
+  for (int i = 0; i < num_threads; ++i)
+  {
+    const std::vector<Key> &thread_samples = samples_of (i);
+    samples.insert (samples.end (), thread_samples.begin (),
+                    thread_samples.end ());
+  }
+  std::sort (samples.begin (), samples.end (), less);
+
+  std::vector<Key> splitters;
+  if (samples.empty ())
+  {
+    return splitters;
+  }
+  for (int p = 1; p < num_threads; ++p)
+  {
+    splitters.push_back (samples[p * samples.size () / num_threads]);
+  }
+  return splitters;
+}
+
+// narrows the sorted run [*first, *last) to the pairs whose keys fall in
+// partition p.
+template <typename Pair, typename Key, typename KeyLess>
+void partition_slice (Pair **first, Pair **last,
+                      const std::vector<Key> &splitters, int p, KeyLess less)
+{
+  auto key_before = [&less] (const Pair &pair, const Key &key)
+  {
+      return less (pair.first, key);
+  };
+  if (p > 0 && !splitters.empty ())
+  {
+    *first = std::lower_bound (*first, *last, splitters[p - 1], key_before);
+  }
+  if ((size_t) p < splitters.size ())
+  {
+    *last = std::lower_bound (*first, *last, splitters[p], key_before);
+  }
+}
+
+// moves the pairs of merger into partition in order, ending a group at the
+// first pair whose key is greater than the key of the group, and calls
+// on_group (size) for every group. the group is compared by the pair moved
+// into the partition, since the one left in the run is moved from.
+template <typename Pair, typename Less, typename OnGroup>
+void merge_groups (RunMerger<Pair, Less> &merger, std::vector<Pair> &partition,
+                   std::vector<size_t> &group_ends, OnGroup on_group)
+{
+  while (!merger.empty ())
+  {
+    size_t group_begin = partition.size ();
+    do
+    {
+      partition.push_back (std::move (merger.top ()));
+      merger.pop ();
+    }
+    while (!merger.empty ()
+           && !merger.order () (partition[group_begin], merger.top ()));
+    group_ends.push_back (partition.size ());
+    on_group (partition.size () - group_begin);
+  }
+}
+
+// run by one thread once every thread has its output, output_of (i) giving
+// the output of thread i: appends the outputs to output merged by less when
+// ordered, sorted by less each, or else makes room at the end of output for
+// place_output. returns the size output had before.
+template <typename Pair, typename OutputOf, typename Less>
+size_t gather_output (int num_threads, OutputOf output_of,
+                      std::vector<Pair> &output, bool ordered, Less less)
+{
+  size_t base = output.size ();
+  size_t total = 0;
+  for (int i = 0; i < num_threads; ++i)
+  {
+    total += output_of (i).size ();
+  }
+  if (!ordered)
+  {
+    output.resize (base + total);
+    return base;
+  }
+  RunMerger<Pair, Less> merger (less);
+  for (int i = 0; i < num_threads; ++i)
+  {
+    std::vector<Pair> &thread_output = output_of (i);
+    merger.add_run (thread_output.data (),
+                    thread_output.data () + thread_output.size ());
+  }
+  output.reserve (base + total);
+  while (!merger.empty ())
+  {
+    output.push_back (std::move (merger.top ()));
+    merger.pop ();
+  }
+  return base;
+}
+
+// moves the output of thread_id to its place in output, made by
+// gather_output at base, after the outputs of the threads before it.
+template <typename Pair, typename OutputOf>
+void place_output (int thread_id, size_t base, OutputOf output_of,
+                   std::vector<Pair> &output)
+{
+  size_t offset = base;
+  for (int i = 0; i < thread_id; ++i)
+  {
+    offset += output_of (i).size ();
+  }
+  std::vector<Pair> &thread_output = output_of (thread_id);
+  std::move (thread_output.begin (), thread_output.end (),
+             output.begin () + offset);
+}
+
+} // namespace detail
+} // namespace mapreduce
+
+#endif //MAPREDUCECORE_H
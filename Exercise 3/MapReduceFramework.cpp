@@ -1,397 +1,1335 @@
-#include "MapReduceFramework.h"
-#include "Barrier.h"
-
-#include <pthread.h>
-#include <atomic>
-#include <semaphore.h>
-#include <iostream>
-#include <algorithm>
-
-void *thread_start_routine (void *arg);
-struct ThreadDataBlock;
-struct JobDataBlock;
-
-struct ThreadDataBlock
-{
-    int thread_id;
-    IntermediateVec *intermediate_vec;
-    JobDataBlock *job_context;
-};
-
-struct JobDataBlock
-{
-    const MapReduceClient *client;
-    bool waiting_for_job;
-
-    int num_of_threads;
-    pthread_t *threads;
-    struct ThreadDataBlock *threads_data_blocks;
-
-    const InputVec *input_vec;
-    std::vector<IntermediateVec *> *shuffled_sorted_vec;
-    OutputVec *output_vec;
-
-    std::atomic<uint64_t> *job_state;
-    std::atomic<int> *map_counter;
-    std::atomic<int> *total_intermediate_elems;
-    std::atomic<int> *total_shuffled_elems;
-
-    Barrier *barrier;
-    pthread_mutex_t *mutex_a;
-    sem_t *sem_b;
-
-    JobDataBlock () :
-        waiting_for_job (false),
-        job_state (new std::atomic<uint64_t> (static_cast<uint64_t>
-                                              (UNDEFINED_STAGE) << 62)),
-        map_counter (new std::atomic<int> (0)),
-        total_intermediate_elems (new std::atomic<int> (0)),
-        total_shuffled_elems (new std::atomic<int> (0)),
-        mutex_a (new pthread_mutex_t),
-        sem_b (new sem_t ())
-    {
-
-      if (pthread_mutex_init (mutex_a, nullptr) != 0)
-      {
-        std::cout << "system error: semaphore initialization failed." <<
-                  std::endl;
-        // resources are automatically freed and there are no memory leaks
-        // because we implemented it so that the destructor of JobDataBlock
-        // frees all the memory and it is called automatically when we exit.
-        exit (1);
-      }
-
-      if (sem_init (sem_b, 0, 1) != 0)
-      {
-        std::cout << "system error: semaphore initialization failed." <<
-                  std::endl;
-        // resources are automatically freed and there are no memory leaks
-        // because we implemented it so that the destructor of JobDataBlock
-        // frees all the memory and it is called automatically when we exit.
-        exit (1);
-      }
-
-    }
-
-    ~JobDataBlock ()
-    {
-      delete job_state;
-      delete shuffled_sorted_vec;
-      delete map_counter;
-      delete total_intermediate_elems;
-      delete total_shuffled_elems;
-      delete barrier;
-
-      for (int i = 0; i < num_of_threads; ++i)
-      {
-        delete threads_data_blocks[i].intermediate_vec;
-      }
-
-      delete[] threads;
-      delete[] threads_data_blocks;
-
-      if (pthread_mutex_destroy (mutex_a) != 0)
-      {
-        std::cout << "system error: mutex destruction failed." <<
-                  std::endl;
-        // resources are automatically freed and there are no memory leaks
-        // because we implemented it so that the destructor of JobDataBlock
-        // frees all the memory and it is called automatically when we exit.
-        exit (1);
-      }
-
-      if (sem_destroy (sem_b) != 0)
-      {
-        std::cout << "system error: semaphore destruction failed."
-                  << std::endl;
-        // resources are automatically freed and there are no memory leaks
-        // because we implemented it so that the destructor of JobDataBlock
-        // frees all the memory and it is called automatically when we exit.
-        exit (1);
-      }
-      delete mutex_a;
-      delete sem_b;
-    }
-};
-
-JobHandle startMapReduceJob (const MapReduceClient &client,
-                             const InputVec &inputVec, OutputVec &outputVec,
-                             int multiThreadLevel)
-{
-  auto job = new JobDataBlock ();
-  job->client = &client;
-  job->num_of_threads = multiThreadLevel;
-  job->threads = new pthread_t[multiThreadLevel];
-  job->threads_data_blocks = new ThreadDataBlock[multiThreadLevel];
-  job->input_vec = &inputVec;
-  job->output_vec = &outputVec;
-  job->barrier = new Barrier (multiThreadLevel);
-
-  for (int i = 0; i < multiThreadLevel; i++)
-  {
-    job->threads_data_blocks[i].thread_id = i;
-    job->threads_data_blocks[i].intermediate_vec = new IntermediateVec ();
-    job->threads_data_blocks[i].job_context = job;
-    if (pthread_create (job->threads + i, nullptr, thread_start_routine,
-                        &job->threads_data_blocks[i]) != 0)
-    {
-      std::cout << "system error: thread creation failed." << std::endl;
-      // resources are automatically freed and there are no memory leaks
-      // because we implemented it so that the destructor of JobDataBlock
-      // frees all the memory and it is called automatically when we exit.
-      exit (1);
-    }
-  }
-
-  return (JobHandle) job;
-}
-
-void *thread_start_routine (void *arg)
-{
-  auto *thread_context = (ThreadDataBlock *) arg;
-  JobDataBlock *job = thread_context->job_context;
-
-  uint64_t expected = static_cast<uint64_t>(UNDEFINED_STAGE) << 62;
-  uint64_t desired = (static_cast<uint64_t>(MAP_STAGE) << 62) |
-                     (static_cast<uint64_t>(job->input_vec->size ()) << 31);
-  job->job_state->compare_exchange_strong (expected, desired);
-
-  // running Map
-  unsigned long pre_count = (*(job->map_counter))++;
-  while (pre_count < job->input_vec->size ())
-  {
-    if (pre_count >= job->input_vec->size ()){
-      break;
-    }
-    InputPair pair = (*job->input_vec)[pre_count];
-    job->client->map (pair.first, pair.second, thread_context);
-    (*(job->job_state))++;
-    pre_count = (*(job->map_counter))++;
-    if (pre_count >= job->input_vec->size ())
-    {
-      break;
-    }
-  }
-
-  for (unsigned int i = 0; i < thread_context->intermediate_vec->size (); i++)
-  {
-    (*(job->total_intermediate_elems))++;
-  }
-
-  // running Sort
-  std::sort (thread_context->intermediate_vec->begin (),
-             thread_context->intermediate_vec->end (),
-             [] (IntermediatePair &p1, IntermediatePair &p2)
-             {
-                 return *(p1.first) < *(p2.first);
-             });
-
-  // running Shuffle
-  job->barrier->barrier ();
-
-  if (thread_context->thread_id == 0)
-  {
-    long intermediate_elems_shifted =
-        static_cast<long>(job->total_intermediate_elems->load ()) << 31;
-    long shuffle_stage_shifted = static_cast<long>(SHUFFLE_STAGE) << 62;
-    uint64_t combined_value = static_cast<uint64_t>(intermediate_elems_shifted
-                                                    | shuffle_stage_shifted);
-
-    job->job_state->store (combined_value);
-    auto *shuffled = new std::vector<IntermediateVec *> ();
-
-    for (;;)
-    {
-      K2 *max_key = nullptr;
-      bool any_data_left = false;
-
-      for (int i = 0; i < job->num_of_threads; ++i)
-      {
-        auto &intermediate_data = job->threads_data_blocks[i].intermediate_vec;
-
-        if (!intermediate_data->empty ())
-        {
-          any_data_left = true;
-          K2 *cur_key = intermediate_data->back ().first;
-
-          if (max_key == nullptr || *max_key < *cur_key)
-          {
-            max_key = cur_key;
-          }
-        }
-      }
-
-      if (!any_data_left)
-      {
-        break;
-      }
-
-      auto *data = new IntermediateVec ();
-
-      for (int i = 0; i < job->num_of_threads; ++i)
-      {
-        auto *intermediate_data = job->threads_data_blocks[i].intermediate_vec;
-
-        while (!intermediate_data->empty ())
-        {
-          K2 *cur_key = intermediate_data->back ().first;
-
-          if (!(*cur_key < *max_key) && !(*max_key < *cur_key))
-          {
-            data->push_back (intermediate_data->back ());
-            intermediate_data->pop_back ();
-            (*(job->job_state))++;
-          }
-          else
-          {
-            break;
-          }
-        }
-      }
-
-      shuffled->push_back (data);
-      (*(job->total_shuffled_elems))++;
-    }
-
-    job->shuffled_sorted_vec = shuffled;
-
-    long shuffled_elems_shifted = static_cast<long>
-    (job->total_shuffled_elems->load ()) << 31;
-    long reduce_stage_shifted = static_cast<long>(REDUCE_STAGE) << 62;
-    uint64_t combined_value_new = static_cast<uint64_t>
-    (shuffled_elems_shifted | reduce_stage_shifted);
-
-    job->job_state->store (combined_value_new);
-
-  }
-  job->barrier->barrier ();
-
-  // running Reduce
-  while (!job->shuffled_sorted_vec->empty ())
-  {
-    if (pthread_mutex_lock ((job->mutex_a)) != 0)
-    {
-      std::cout << "system error: mutex lock failed." << std::endl;
-      // resources are automatically freed and there are no memory leaks
-      // because we implemented it so that the destructor of JobDataBlock
-      // frees all the memory and it is called automatically when we exit.
-      exit (1);
-    }
-
-    if (job->shuffled_sorted_vec->empty ())
-    {
-      if (pthread_mutex_unlock (job->mutex_a) != 0)
-      {
-        std::cout << "system error: mutex unlock failed." << std::endl;
-        // resources are automatically freed and there are no memory leaks
-        // because we implemented it so that the destructor of JobDataBlock
-        // frees all the memory and it is called automatically when we exit.
-        exit (1);
-      }
-      break;
-    }
-
-    IntermediateVec *vec_pairs = job->shuffled_sorted_vec->back ();
-    job->shuffled_sorted_vec->pop_back ();
-
-    if (pthread_mutex_unlock (job->mutex_a) != 0)
-    {
-      std::cout << "system error: mutex unlock failed." << std::endl;
-      // resources are automatically freed and there are no memory leaks
-      // because we implemented it so that the destructor of JobDataBlock
-      // frees all the memory and it is called automatically when we exit.
-      exit (1);
-    }
-
-    job->client->reduce (vec_pairs, job);
-    (*(job->job_state))++;
-    delete vec_pairs;
-  }
-  return nullptr;
-}
-
-void emit2 (K2 *key, V2 *value, void *context)
-{
-  auto *thread_context = static_cast<ThreadDataBlock *>(context);
-  thread_context->intermediate_vec->emplace_back (key, value);
-}
-
-void emit3 (K3 *key, V3 *value, void *context)
-{
-  auto *job = static_cast<JobDataBlock *>(context);
-  if (sem_wait (job->sem_b) != 0)
-  {
-    std::cout << "system error: semaphore wait failed." << std::endl;
-    // resources are automatically freed and there are no memory leaks
-    // because we implemented it so that the destructor of JobDataBlock
-    // frees all the memory and it is called automatically when we exit.
-    exit (1);
-  }
-  job->output_vec->emplace_back (key, value);
-  if (sem_post (job->sem_b) != 0)
-  {
-    std::cout << "system error: semaphore post failed." << std::endl;
-    // resources are automatically freed and there are no memory leaks
-    // because we implemented it so that the destructor of JobDataBlock
-    // frees all the memory and it is called automatically when we exit.
-    exit (1);
-  }
-}
-
-void waitForJob (JobHandle job)
-{
-  auto *jobb = static_cast<JobDataBlock *>(job);
-  if (jobb == nullptr)
-  {
-    return;
-  }
-  if (jobb->waiting_for_job)
-  {
-    return;
-  }
-  else
-  {
-    jobb->waiting_for_job = true;
-  }
-  for (int i = 0; i < jobb->num_of_threads; i++)
-  {
-    if (pthread_join (jobb->threads[i], nullptr) != 0)
-    {
-      std::cout << "system error: thread join failed." << std::endl;
-      // resources are automatically freed and there are no memory leaks
-      // because we implemented it so that the destructor of JobDataBlock
-      // frees all the memory and it is called automatically when we exit.
-      exit (1);
-    }
-  }
-}
-
-void getJobState (JobHandle job, JobState *state)
-{
-  auto *jobb = static_cast<JobDataBlock *>(job);
-  uint64_t job_state = jobb->job_state->load ();
-  stage_t current_stage = static_cast<stage_t>(job_state >> 62);
-  state->stage = current_stage;
-  unsigned long total = job_state >> 31 & 0x7FFFFFFF;
-  unsigned long current = job_state & 0x7FFFFFFF;
-  state->percentage =
-      static_cast<float>(current) / static_cast<float>(total) * 100;
-}
-
-void closeJobHandle (JobHandle job)
-{
-  auto *jobb = static_cast<JobDataBlock *>(job);
-  if (jobb == nullptr)
-  {
-    return;
-  }
-  waitForJob (jobb);
-
-  // deleting jobb manually releases all the memory, it is not needed
-  // because we implemented a destructor but by doing so making sure the
-  // pointer itself is also freed. this is just a safe measure to make sure
-  // all the memory is freed.
-  delete jobb;
-}
-
-
+#include "MapReduceFramework.h"
+#include "Barrier.h"
+#include "Arena.h"
+#include "MapReduceCore.h"
+
+#include <pthread.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <atomic>
+#include <cstdlib>
+#include <iostream>
+#include <algorithm>
+#include <deque>
+#include <string>
+#include <vector>
+
+void *thread_start_routine (void *arg);
+void *worker_start_routine (void *arg);
+struct ThreadDataBlock;
+struct JobDataBlock;
+struct RuntimeDataBlock;
+JobDataBlock *create_job (const MapReduceClient &client,
+                          const InputVec &inputVec, OutputVec &outputVec,
+                          int multiThreadLevel);
+JobDataBlock *create_config_job (const MapReduceClient &client,
+                                 const InputVec &inputVec,
+                                 OutputVec &outputVec,
+                                 const JobConfig *config,
+                                 RuntimeDataBlock **runtime);
+void map_pair (ThreadDataBlock *thread_context, const InputPair &pair);
+void map_source (ThreadDataBlock *thread_context);
+RuntimeDataBlock *get_shared_runtime ();
+bool output_less (const OutputPair &p1, const OutputPair &p2);
+void submit_job (RuntimeDataBlock *runtime, JobDataBlock *job);
+void add_workers (RuntimeDataBlock *runtime, int count);
+void combine_run (ThreadDataBlock *thread_context);
+void sort_run (ThreadDataBlock *thread_context);
+void spill_run (ThreadDataBlock *thread_context);
+int create_spill_file ();
+void write_spill (int fd, const std::vector<char> &buffer);
+void map_spill_file (ThreadDataBlock *thread_context);
+void sample_spilled_runs (ThreadDataBlock *thread_context);
+void reduce_spilled (ThreadDataBlock *thread_context);
+struct SpilledRun;
+struct SpillCursor;
+size_t spilled_lower_bound (const MapReduceSerializer *serializer,
+                            const char *data, const SpilledRun &run,
+                            const K2 *bound);
+bool spilled_key_less (const MapReduceSerializer *serializer, const char *at,
+                       const K2 *bound, size_t *size);
+bool read_spilled_pair (const MapReduceSerializer *serializer,
+                        SpillCursor *cursor);
+void destroy_arena_parts (const MapReduceSerializer *serializer,
+                          const IntermediatePair &pair, char arena);
+bool cursor_greater (const SpillCursor &c1, const SpillCursor &c2);
+std::vector<K2 *> job_splitters (JobDataBlock *job);
+void merge_partition (ThreadDataBlock *thread_context,
+                      const std::vector<K2 *> &splitters);
+bool key_less (const IntermediatePair &p1, const IntermediatePair &p2);
+bool k2_less (const K2 *k1, const K2 *k2);
+uint64_t stage_value (stage_t stage, unsigned long total,
+                      unsigned long current);
+void advance_stage (JobDataBlock *job, stage_t stage, uint64_t next);
+
+using mapreduce::detail::MapRange;
+using mapreduce::detail::RunMerger;
+
+// the orders the merges of the shuffle and of ordered output go by.
+typedef bool (*IntermediateLess) (const IntermediatePair &p1,
+                                  const IntermediatePair &p2);
+typedef bool (*OutputLess) (const OutputPair &p1, const OutputPair &p2);
+
+// a thread of a combiner client combines its pairs during map once it holds
+// this many, or twice as many as its last combine left. a combine that keeps
+// more than half of the pairs ends the combines during map of that thread.
+#define COMBINE_THRESHOLD 4096
+// spill files are written through a buffer of this many bytes.
+#define SPILL_BUFFER_SIZE (1 << 20)
+// a merge gives back the pages of a spilled run it has read, this many bytes
+// of them at a time.
+#define SPILL_RELEASE_SIZE 65536
+// a spilled run keeps the offset of every SPILL_INDEX_STRIDE-th pair of it,
+// where the searches for the splitters end up scanning.
+#define SPILL_INDEX_STRIDE 64
+// every spilled pair starts with a byte of these flags, set for the parts of
+// it that emit2_alloc allocated. the framework frees what it reads back of
+// those, since the client never frees them.
+#define SPILL_ARENA_KEY 1
+#define SPILL_ARENA_VALUE 2
+
+// a sorted run a thread spilled: the pairs in [begin, end) of its spill file,
+// and the offset of every SPILL_INDEX_STRIDE-th of them.
+struct SpilledRun
+{
+    size_t begin;
+    size_t end;
+    std::vector<size_t> index;
+};
+
+// a slice of a spilled run being merged, holding its next pair read back.
+struct SpillCursor
+{
+    const char *next;
+    const char *end;
+    // where the pages the cursor has not given back start.
+    const char *kept;
+    IntermediatePair head;
+    // the SPILL_ARENA_* flags of head.
+    char head_arena;
+};
+
+struct ThreadDataBlock
+{
+    int thread_id;
+    IntermediateVec *intermediate_vec;
+    JobDataBlock *job_context;
+    // the size of intermediate_vec at which map combines it next.
+    size_t combine_at;
+
+    // keys sampled evenly from the sorted intermediate_vec of the thread.
+    std::vector<K2 *> samples;
+    // the pairs of the partition this thread shuffles and reduces, sorted,
+    // and where each group of equal keys in it ends.
+    IntermediateVec partition;
+    std::vector<size_t> group_ends;
+    // what emit2_alloc hands out, freed with the job.
+    Arena arena;
+    // what the thread emitted in reduce, copied to output_vec at the end.
+    OutputVec output;
+
+    // the bytes intermediate_vec counts against the memory budget.
+    size_t memory_used;
+    // the unnamed file the thread spills to, -1 until its first spill, and
+    // the runs in it. the file is mapped at spill_data once map is done.
+    int spill_fd;
+    size_t spill_size;
+    std::vector<SpilledRun> spilled_runs;
+    size_t spilled_pairs;
+    char *spill_data;
+    // the pairs read back from the spilled runs for their keys to be sampled.
+    IntermediateVec spill_samples;
+};
+
+// the counters of a job, one per cache line. the padding before the first
+// keeps it off the line of whatever the allocator put before the block.
+struct JobCounters
+{
+    char pad_0[CACHE_LINE_SIZE];
+    std::atomic<uint64_t> job_state;
+    char pad_1[CACHE_LINE_SIZE - sizeof (std::atomic<uint64_t>)];
+    std::atomic<int> total_intermediate_elems;
+    char pad_2[CACHE_LINE_SIZE - sizeof (std::atomic<int>)];
+    std::atomic<int> total_shuffled_elems;
+    char pad_3[CACHE_LINE_SIZE - sizeof (std::atomic<int>)];
+    std::atomic<uint64_t> input_consumed;
+    char pad_4[CACHE_LINE_SIZE - sizeof (std::atomic<uint64_t>)];
+
+    JobCounters () :
+        job_state (static_cast<uint64_t>(UNDEFINED_STAGE) << 62),
+        total_intermediate_elems (0),
+        total_shuffled_elems (0),
+        input_consumed (0)
+    {}
+};
+
+struct JobDataBlock
+{
+    const MapReduceClient *client;
+    // the client if it has a combine stage, null otherwise.
+    const MapReduceCombinerClient *combiner;
+    // set for the jobs of runOnWorkers, which run routine instead of
+    // map, shuffle and reduce.
+    void (*routine) (void *arg, int threadId);
+    void *routine_arg;
+
+    int num_of_threads;
+    struct ThreadDataBlock *threads_data_blocks;
+    // the number of threads of the job that are done, guarded by mutex_done.
+    int finished_threads;
+
+    const InputVec *input_vec;
+    // set for the jobs of startMapReduceJobSource, which pull their input
+    // from it instead of input_vec.
+    InputSource *input_source;
+    // the total the map stage reports its progress against, the input
+    // pairs or the total of input_source shifted right by map_shift to fit
+    // job_state, 0 when unknown.
+    unsigned long map_total;
+    int map_shift;
+    OutputVec *output_vec;
+    // the size of output_vec before the job appended to it.
+    size_t output_base;
+    bool order_output;
+
+    // set for a job with a memory budget, along with the bytes of pairs each
+    // of its threads may hold.
+    const MapReduceSerializer *serializer;
+    size_t thread_budget;
+    // set once any thread spilled. all the threads then spill what they
+    // have left and shuffle and reduce from the spill files.
+    std::atomic<bool> spilled;
+
+    JobCounters *counters;
+    std::atomic<uint64_t> *job_state;
+    std::atomic<int> *total_intermediate_elems;
+    std::atomic<int> *total_shuffled_elems;
+    // how much of the total of input_source the threads have pulled.
+    std::atomic<uint64_t> *input_consumed;
+    // one range per thread, see MapRange.
+    MapRange *map_ranges;
+
+    Barrier *barrier;
+    pthread_mutex_t *mutex_done;
+    pthread_cond_t *cv_done;
+
+    JobDataBlock () :
+        routine (nullptr),
+        routine_arg (nullptr),
+        finished_threads (0),
+        serializer (nullptr),
+        thread_budget (0),
+        spilled (false),
+        counters (new JobCounters ()),
+        job_state (&counters->job_state),
+        total_intermediate_elems (&counters->total_intermediate_elems),
+        total_shuffled_elems (&counters->total_shuffled_elems),
+        input_consumed (&counters->input_consumed),
+        map_ranges (nullptr),
+        mutex_done (new pthread_mutex_t),
+        cv_done (new pthread_cond_t)
+    {
+
+      if (pthread_mutex_init (mutex_done, nullptr) != 0
+          || pthread_cond_init (cv_done, nullptr) != 0)
+      {
+        std::cout << "system error: mutex initialization failed." <<
+                  std::endl;
+        exit (1);
+      }
+
+    }
+
+    ~JobDataBlock ()
+    {
+      delete counters;
+      delete[] map_ranges;
+      delete barrier;
+
+      for (int i = 0; i < num_of_threads; ++i)
+      {
+        ThreadDataBlock &thread = threads_data_blocks[i];
+        delete thread.intermediate_vec;
+        for (IntermediatePair &pair : thread.spill_samples)
+        {
+          serializer->destroy (pair.first, pair.second);
+        }
+        if (thread.spill_data != nullptr)
+        {
+          munmap (thread.spill_data, thread.spill_size);
+        }
+        if (thread.spill_fd >= 0)
+        {
+          close (thread.spill_fd);
+        }
+      }
+
+      delete[] threads_data_blocks;
+
+      if (pthread_mutex_destroy (mutex_done) != 0
+          || pthread_cond_destroy (cv_done) != 0)
+      {
+        std::cout << "system error: mutex destruction failed." <<
+                  std::endl;
+        exit (1);
+      }
+      delete mutex_done;
+      delete cv_done;
+    }
+};
+
+// a pool of worker threads. every job queues one entry per thread of it, and
+// a worker runs the entries in order, so the threads of a job all start before
+// any thread of a later job, and a job never waits on its own barrier for a
+// worker that is busy with a later job.
+struct RuntimeDataBlock
+{
+    // a growable runtime adds workers whenever the jobs queued and running
+    // need more threads than it has, a fixed one runs all its jobs on
+    // num_of_threads workers.
+    bool growable;
+    bool stopping;
+    int num_of_threads;
+    std::vector<pthread_t> workers;
+
+    // guarded by mutex. outstanding counts the job threads that are queued or
+    // running.
+    std::deque<ThreadDataBlock *> pending;
+    int outstanding;
+    pthread_mutex_t mutex;
+    pthread_cond_t cv_pending;
+
+    RuntimeDataBlock (int numThreads, bool growable) :
+        growable (growable),
+        stopping (false),
+        num_of_threads (numThreads),
+        outstanding (0),
+        mutex (PTHREAD_MUTEX_INITIALIZER),
+        cv_pending (PTHREAD_COND_INITIALIZER)
+    {}
+};
+
+// the runtime of startMapReduceJob, created by the first job and never ended.
+// it only grows: its workers wait for the next job once a job is done, and
+// are never joined, so they outlive every job and end with the process.
+RuntimeDataBlock *shared_runtime = nullptr;
+pthread_mutex_t shared_runtime_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+JobHandle startMapReduceJob (const MapReduceClient &client,
+                             const InputVec &inputVec, OutputVec &outputVec,
+                             int multiThreadLevel)
+{
+  JobDataBlock *job = create_job (client, inputVec, outputVec,
+                                  multiThreadLevel);
+  submit_job (get_shared_runtime (), job);
+  return (JobHandle) job;
+}
+
+JobHandle startMapReduceJobConfig (const MapReduceClient &client,
+                                   const InputVec &inputVec,
+                                   OutputVec &outputVec,
+                                   const JobConfig *config)
+{
+  RuntimeDataBlock *runtime;
+  JobDataBlock *job = create_config_job (client, inputVec, outputVec, config,
+                                         &runtime);
+  if (job == nullptr)
+  {
+    return nullptr;
+  }
+  submit_job (runtime, job);
+  return (JobHandle) job;
+}
+
+JobHandle startMapReduceJobSource (const MapReduceClient &client,
+                                   InputSource &source, OutputVec &outputVec,
+                                   const JobConfig *config)
+{
+  // the job maps nothing from its input_vec, the threads pull from source.
+  static const InputVec no_input;
+  RuntimeDataBlock *runtime;
+  JobDataBlock *job = create_config_job (client, no_input, outputVec, config,
+                                         &runtime);
+  if (job == nullptr)
+  {
+    return nullptr;
+  }
+  job->input_source = &source;
+  uint64_t total = source.total ();
+  while ((total >> job->map_shift) > 0x7FFFFFFF)
+  {
+    job->map_shift++;
+  }
+  job->map_total = total >> job->map_shift;
+  submit_job (runtime, job);
+  return (JobHandle) job;
+}
+
+RuntimeHandle createMapReduceRuntime (int numThreads)
+{
+  auto *runtime = new RuntimeDataBlock (numThreads, false);
+  add_workers (runtime, numThreads);
+  return (RuntimeHandle) runtime;
+}
+
+JobHandle startMapReduceJobOn (RuntimeHandle runtime,
+                               const MapReduceClient &client,
+                               const InputVec &inputVec, OutputVec &outputVec)
+{
+  auto *runtime_block = static_cast<RuntimeDataBlock *>(runtime);
+  JobDataBlock *job = create_job (client, inputVec, outputVec,
+                                  runtime_block->num_of_threads);
+  submit_job (runtime_block, job);
+  return (JobHandle) job;
+}
+
+void closeMapReduceRuntime (RuntimeHandle runtime)
+{
+  auto *runtime_block = static_cast<RuntimeDataBlock *>(runtime);
+  if (runtime_block == nullptr)
+  {
+    return;
+  }
+  pthread_mutex_lock (&runtime_block->mutex);
+  runtime_block->stopping = true;
+  pthread_cond_broadcast (&runtime_block->cv_pending);
+  pthread_mutex_unlock (&runtime_block->mutex);
+
+  for (pthread_t worker : runtime_block->workers)
+  {
+    if (pthread_join (worker, nullptr) != 0)
+    {
+      std::cout << "system error: thread join failed." << std::endl;
+      exit (1);
+    }
+  }
+  pthread_mutex_destroy (&runtime_block->mutex);
+  pthread_cond_destroy (&runtime_block->cv_pending);
+  delete runtime_block;
+}
+
+// the client of the jobs of runOnWorkers, which is never called.
+class RoutineClient : public MapReduceClient
+{
+ public:
+  void map (const K1 *key, const V1 *value, void *context) const override
+  {}
+
+  void reduce (const IntermediateVec *pairs, void *context) const override
+  {}
+};
+
+void runOnWorkers (int numThreads, void (*routine) (void *arg, int threadId),
+                   void *arg)
+{
+  // the job has nothing to map, but carries the threads of routine through
+  // the runtime like any other job.
+  static RoutineClient routine_client;
+  InputVec no_input;
+  OutputVec no_output;
+  JobDataBlock *job = create_job (routine_client, no_input, no_output,
+                                  numThreads);
+  job->routine = routine;
+  job->routine_arg = arg;
+  submit_job (get_shared_runtime (), job);
+  closeJobHandle (job);
+}
+
+/**
+ * Runs the threads of jobs, in the order they were queued, until the runtime
+ * is closed and nothing is left to run.
+ */
+void *worker_start_routine (void *arg)
+{
+  auto *runtime = static_cast<RuntimeDataBlock *>(arg);
+  for (;;)
+  {
+    pthread_mutex_lock (&runtime->mutex);
+    while (runtime->pending.empty () && !runtime->stopping)
+    {
+      pthread_cond_wait (&runtime->cv_pending, &runtime->mutex);
+    }
+    if (runtime->pending.empty ())
+    {
+      pthread_mutex_unlock (&runtime->mutex);
+      return nullptr;
+    }
+    ThreadDataBlock *thread_context = runtime->pending.front ();
+    runtime->pending.pop_front ();
+    pthread_mutex_unlock (&runtime->mutex);
+
+    JobDataBlock *job = thread_context->job_context;
+    if (job->routine != nullptr)
+    {
+      job->routine (job->routine_arg, thread_context->thread_id);
+    }
+    else
+    {
+      thread_start_routine (thread_context);
+    }
+
+    pthread_mutex_lock (&runtime->mutex);
+    runtime->outstanding--;
+    pthread_mutex_unlock (&runtime->mutex);
+
+    // the job may be freed as soon as mutex_done is released.
+    pthread_mutex_lock (job->mutex_done);
+    if (++job->finished_threads == job->num_of_threads)
+    {
+      pthread_cond_broadcast (job->cv_done);
+    }
+    pthread_mutex_unlock (job->mutex_done);
+  }
+}
+
+void *thread_start_routine (void *arg)
+{
+  auto *thread_context = (ThreadDataBlock *) arg;
+  JobDataBlock *job = thread_context->job_context;
+
+  uint64_t expected = static_cast<uint64_t>(UNDEFINED_STAGE) << 62;
+  uint64_t desired = (static_cast<uint64_t>(MAP_STAGE) << 62) |
+                     (static_cast<uint64_t>(job->map_total) << 31);
+  job->job_state->compare_exchange_strong (expected, desired);
+
+  // running Map, a chunk at a time, counting the progress once a chunk.
+  if (job->input_source != nullptr)
+  {
+    map_source (thread_context);
+  }
+  unsigned long first;
+  unsigned long last;
+  while (mapreduce::detail::claim_map_chunk (job->map_ranges,
+                                            job->num_of_threads,
+                                            thread_context->thread_id,
+                                            &first, &last))
+  {
+    for (unsigned long i = first; i < last; ++i)
+    {
+      map_pair (thread_context, (*job->input_vec)[i]);
+    }
+    (*(job->job_state)) += last - first;
+  }
+
+  // running Sort, and Combine, which keeps the run sorted.
+  sort_run (thread_context);
+  (*(job->total_intermediate_elems)) +=
+      (int) (thread_context->intermediate_vec->size ()
+             + thread_context->spilled_pairs);
+  thread_context->samples.clear ();
+  mapreduce::detail::sample_run (*thread_context->intermediate_vec,
+                                 job->num_of_threads,
+                                 thread_context->samples);
+
+  // running Shuffle. the splitters cut the key space into one range per
+  // thread, and every thread merges the slices of all the sorted runs that
+  // fall in its range. equal keys always land in the same range.
+  job->barrier->barrier ();
+
+  // the first thread past the barrier moves the job to the shuffle stage,
+  // before any thread counts a shuffled pair, even if the map progress fell
+  // short of map_total.
+  advance_stage (job, MAP_STAGE,
+                 stage_value (SHUFFLE_STAGE,
+                              job->total_intermediate_elems->load (), 0));
+
+  if (job->spilled.load ())
+  {
+    // the pairs outgrew the budget, so they all go to disk and the
+    // partitions are reduced as they are merged from there.
+    reduce_spilled (thread_context);
+  }
+  else
+  {
+    // every thread picks the same splitters from the same samples.
+    merge_partition (thread_context, job_splitters (job));
+    (*(job->total_shuffled_elems)) += (int) thread_context->group_ends.size ();
+    job->barrier->barrier ();
+
+    advance_stage (job, SHUFFLE_STAGE,
+                   stage_value (REDUCE_STAGE,
+                                job->total_shuffled_elems->load (), 0));
+
+    // running Reduce, on the groups of the partition this thread merged. one
+    // vector takes every group in turn, so reduce allocates nothing per key.
+    IntermediateVec vec_pairs;
+    auto group_begin = thread_context->partition.begin ();
+    for (size_t group_end : thread_context->group_ends)
+    {
+      vec_pairs.assign (group_begin,
+                        thread_context->partition.begin () + group_end);
+      job->client->reduce (&vec_pairs, thread_context);
+      (*(job->job_state))++;
+      group_begin = thread_context->partition.begin () + group_end;
+    }
+  }
+
+  // running Output. the buffers of the threads go to output_vec at once,
+  // each thread copying its own to its place, or merged by key.
+  if (job->order_output)
+  {
+    std::sort (thread_context->output.begin (), thread_context->output.end (),
+               output_less);
+  }
+  auto output_of = [job] (int i) -> OutputVec &
+  {
+      return job->threads_data_blocks[i].output;
+  };
+  job->barrier->barrier ();
+  if (thread_context->thread_id == 0)
+  {
+    job->output_base = mapreduce::detail::gather_output (
+        job->num_of_threads, output_of, *job->output_vec, job->order_output,
+        (OutputLess) output_less);
+  }
+  if (!job->order_output)
+  {
+    job->barrier->barrier ();
+    mapreduce::detail::place_output (thread_context->thread_id,
+                                     job->output_base, output_of,
+                                     *job->output_vec);
+  }
+  return nullptr;
+}
+
+void emit2 (K2 *key, V2 *value, void *context)
+{
+  auto *thread_context = static_cast<ThreadDataBlock *>(context);
+  thread_context->intermediate_vec->emplace_back (key, value);
+  const MapReduceSerializer *serializer =
+      thread_context->job_context->serializer;
+  if (serializer != nullptr)
+  {
+    thread_context->memory_used += sizeof (IntermediatePair)
+                                   + serializer->size (key, value);
+  }
+}
+
+void *emit2_alloc (size_t size, void *context)
+{
+  auto *thread_context = static_cast<ThreadDataBlock *>(context);
+  return thread_context->arena.allocate (size);
+}
+
+void emit3 (K3 *key, V3 *value, void *context)
+{
+  auto *thread_context = static_cast<ThreadDataBlock *>(context);
+  thread_context->output.emplace_back (key, value);
+}
+
+void waitForJob (JobHandle job)
+{
+  auto *jobb = static_cast<JobDataBlock *>(job);
+  if (jobb == nullptr)
+  {
+    return;
+  }
+  pthread_mutex_lock (jobb->mutex_done);
+  while (jobb->finished_threads < jobb->num_of_threads)
+  {
+    pthread_cond_wait (jobb->cv_done, jobb->mutex_done);
+  }
+  pthread_mutex_unlock (jobb->mutex_done);
+}
+
+void getJobState (JobHandle job, JobState *state)
+{
+  auto *jobb = static_cast<JobDataBlock *>(job);
+  if (jobb == nullptr)
+  {
+    // a job that never started.
+    state->stage = UNDEFINED_STAGE;
+    state->percentage = 0;
+    return;
+  }
+  uint64_t job_state = jobb->job_state->load ();
+  stage_t current_stage = static_cast<stage_t>(job_state >> 62);
+  state->stage = current_stage;
+  unsigned long total = job_state >> 31 & 0x7FFFFFFF;
+  unsigned long current = job_state & 0x7FFFFFFF;
+  // a stage of unknown size, like the map of a source without a total, is
+  // at 0 until it ends.
+  state->percentage =
+      total == 0 ? 0
+                 : static_cast<float>(current) / static_cast<float>(total) * 100;
+}
+
+void closeJobHandle (JobHandle job)
+{
+  auto *jobb = static_cast<JobDataBlock *>(job);
+  if (jobb == nullptr)
+  {
+    return;
+  }
+  waitForJob (jobb);
+
+  // deleting jobb manually releases all the memory, it is not needed
+  // because we implemented a destructor but by doing so making sure the
+  // pointer itself is also freed. this is just a safe measure to make sure
+  // all the memory is freed.
+  delete jobb;
+}
+
+
+
+/**
+ * Allocates a job of multiThreadLevel threads, ready to be submitted.
+ */
+JobDataBlock *create_job (const MapReduceClient &client,
+                          const InputVec &inputVec, OutputVec &outputVec,
+                          int multiThreadLevel)
+{
+  auto job = new JobDataBlock ();
+  job->client = &client;
+  job->order_output = false;
+  job->combiner = dynamic_cast<const MapReduceCombinerClient *>(&client);
+  job->num_of_threads = multiThreadLevel;
+  job->threads_data_blocks = new ThreadDataBlock[multiThreadLevel];
+  job->input_vec = &inputVec;
+  job->input_source = nullptr;
+  job->map_total = inputVec.size ();
+  job->map_shift = 0;
+  job->output_vec = &outputVec;
+  job->barrier = new Barrier (multiThreadLevel);
+  job->map_ranges = new MapRange[multiThreadLevel];
+  mapreduce::detail::init_map_ranges (job->map_ranges, multiThreadLevel,
+                                     inputVec.size ());
+
+  for (int i = 0; i < multiThreadLevel; i++)
+  {
+    job->threads_data_blocks[i].thread_id = i;
+    job->threads_data_blocks[i].intermediate_vec = new IntermediateVec ();
+    job->threads_data_blocks[i].job_context = job;
+    job->threads_data_blocks[i].combine_at = COMBINE_THRESHOLD;
+    job->threads_data_blocks[i].memory_used = 0;
+    job->threads_data_blocks[i].spill_fd = -1;
+    job->threads_data_blocks[i].spill_size = 0;
+    job->threads_data_blocks[i].spilled_pairs = 0;
+    job->threads_data_blocks[i].spill_data = nullptr;
+  }
+  return job;
+}
+
+/**
+ * Allocates a job as config says, and sets runtime to the runtime it is to be
+ * submitted to.
+ * @return - the job, or nullptr when config is not valid.
+ */
+JobDataBlock *create_config_job (const MapReduceClient &client,
+                                 const InputVec &inputVec,
+                                 OutputVec &outputVec,
+                                 const JobConfig *config,
+                                 RuntimeDataBlock **runtime)
+{
+  // pairs cannot be spilled without a serializer, so the budget would be
+  // ignored without a word.
+  if (config->memoryBudget > 0 && config->serializer == nullptr)
+  {
+    std::cout << "system error: a memory budget needs a serializer."
+              << std::endl;
+    return nullptr;
+  }
+  *runtime = static_cast<RuntimeDataBlock *>(config->runtime);
+  if (*runtime == nullptr)
+  {
+    *runtime = get_shared_runtime ();
+  }
+  JobDataBlock *job = create_job (client, inputVec, outputVec,
+                                  config->runtime == nullptr
+                                  ? config->multiThreadLevel
+                                  : (*runtime)->num_of_threads);
+  job->order_output = config->orderOutput;
+  if (config->memoryBudget > 0)
+  {
+    job->serializer = config->serializer;
+    job->thread_budget = std::max<size_t> (
+        config->memoryBudget / job->num_of_threads, 1);
+  }
+  return job;
+}
+
+/**
+ * Returns the runtime of startMapReduceJob, creating it on first use. It is
+ * never closed, see shared_runtime.
+ */
+RuntimeDataBlock *get_shared_runtime ()
+{
+  pthread_mutex_lock (&shared_runtime_mutex);
+  if (shared_runtime == nullptr)
+  {
+    shared_runtime = new RuntimeDataBlock (0, true);
+  }
+  pthread_mutex_unlock (&shared_runtime_mutex);
+  return shared_runtime;
+}
+
+/**
+ * Queues the threads of job on the workers of runtime, first growing a
+ * growable runtime to the number of job threads it will have outstanding.
+ */
+void submit_job (RuntimeDataBlock *runtime, JobDataBlock *job)
+{
+  pthread_mutex_lock (&runtime->mutex);
+  int missing = runtime->outstanding + job->num_of_threads
+                - (int) runtime->workers.size ();
+  if (runtime->growable && missing > 0)
+  {
+    add_workers (runtime, missing);
+  }
+  runtime->outstanding += job->num_of_threads;
+  for (int i = 0; i < job->num_of_threads; i++)
+  {
+    runtime->pending.push_back (&job->threads_data_blocks[i]);
+  }
+  pthread_cond_broadcast (&runtime->cv_pending);
+  pthread_mutex_unlock (&runtime->mutex);
+}
+
+/**
+ * Starts count more workers on runtime.
+ */
+void add_workers (RuntimeDataBlock *runtime, int count)
+{
+  for (int i = 0; i < count; i++)
+  {
+    pthread_t worker;
+    if (pthread_create (&worker, nullptr, worker_start_routine, runtime) != 0)
+    {
+      std::cout << "system error: thread creation failed." << std::endl;
+      exit (1);
+    }
+    runtime->workers.push_back (worker);
+  }
+}
+
+/**
+ * Maps one input pair, then combines or spills the pairs of the thread if
+ * they have grown enough.
+ */
+void map_pair (ThreadDataBlock *thread_context, const InputPair &pair)
+{
+  JobDataBlock *job = thread_context->job_context;
+  job->client->map (pair.first, pair.second, thread_context);
+  if (job->combiner != nullptr
+      && thread_context->intermediate_vec->size ()
+         >= thread_context->combine_at)
+  {
+    combine_run (thread_context);
+  }
+  if (job->serializer != nullptr
+      && thread_context->memory_used >= job->thread_budget)
+  {
+    sort_run (thread_context);
+    spill_run (thread_context);
+  }
+}
+
+/**
+ * Maps chunks pulled from the input source of the job until it is exhausted,
+ * releasing each chunk once it is mapped. The progress of a chunk is its
+ * share of the total of the source, counted once the chunk is mapped, and
+ * stops at map_total should the source hand out more than its total.
+ */
+void map_source (ThreadDataBlock *thread_context)
+{
+  JobDataBlock *job = thread_context->job_context;
+  InputVec chunk;
+  size_t consumed;
+  while (job->input_source->next (chunk, &consumed))
+  {
+    for (const InputPair &pair : chunk)
+    {
+      map_pair (thread_context, pair);
+    }
+    job->input_source->release (chunk);
+    if (job->map_total > 0)
+    {
+      uint64_t before = job->input_consumed->fetch_add (consumed);
+      uint64_t after = before + consumed;
+      (*(job->job_state)) +=
+          std::min<uint64_t> (after >> job->map_shift, job->map_total)
+          - std::min<uint64_t> (before >> job->map_shift, job->map_total);
+    }
+  }
+}
+
+/**
+ * Orders intermediate pairs by their keys.
+ */
+bool key_less (const IntermediatePair &p1, const IntermediatePair &p2)
+{
+  return *(p1.first) < *(p2.first);
+}
+
+/**
+ * Orders intermediate keys.
+ */
+bool k2_less (const K2 *k1, const K2 *k2)
+{
+  return *k1 < *k2;
+}
+
+/**
+ * Packs a stage and its progress the way job_state holds them.
+ */
+uint64_t stage_value (stage_t stage, unsigned long total,
+                      unsigned long current)
+{
+  return (static_cast<uint64_t>(stage) << 62)
+         | (static_cast<uint64_t>(total) << 31)
+         | static_cast<uint64_t>(current);
+}
+
+/**
+ * Moves job_state to next if it is still in stage, whatever its progress in
+ * stage. Only the first of the threads that call it moves the job.
+ */
+void advance_stage (JobDataBlock *job, stage_t stage, uint64_t next)
+{
+  uint64_t state = job->job_state->load ();
+  while (static_cast<stage_t>(state >> 62) == stage
+         && !job->job_state->compare_exchange_weak (state, next))
+  {}
+}
+
+/**
+ * Picks the splitters of the job from the samples of all its threads, see
+ * mapreduce::detail::choose_splitters.
+ */
+std::vector<K2 *> job_splitters (JobDataBlock *job)
+{
+  return mapreduce::detail::choose_splitters<K2 *> (
+      job->num_of_threads, [job] (int i) -> const std::vector<K2 *> &
+      {
+          return job->threads_data_blocks[i].samples;
+      }, k2_less);
+}
+
+/**
+ * Merges the slices of every sorted run that fall in the partition of the
+ * thread into groups of equal keys, in ascending key order.
+ */
+void merge_partition (ThreadDataBlock *thread_context,
+                      const std::vector<K2 *> &splitters)
+{
+  JobDataBlock *job = thread_context->job_context;
+  RunMerger<IntermediatePair, IntermediateLess> merger (key_less);
+  size_t total = 0;
+  for (int i = 0; i < job->num_of_threads; ++i)
+  {
+    IntermediateVec &run = *job->threads_data_blocks[i].intermediate_vec;
+    IntermediatePair *first = run.data ();
+    IntermediatePair *last = run.data () + run.size ();
+    mapreduce::detail::partition_slice (&first, &last, splitters,
+                                        thread_context->thread_id, k2_less);
+    merger.add_run (first, last);
+    total += last - first;
+  }
+  thread_context->partition.reserve (total);
+  mapreduce::detail::merge_groups (merger, thread_context->partition,
+                                   thread_context->group_ends,
+                                   [job] (size_t size)
+                                   {
+                                       (*(job->job_state)) += size;
+                                   });
+}
+
+/**
+ * Sorts the pairs of the thread and replaces every group of equal keys with
+ * what the combiner emits for it.
+ */
+void combine_run (ThreadDataBlock *thread_context)
+{
+  IntermediateVec *run = thread_context->intermediate_vec;
+  size_t emitted = run->size ();
+  std::sort (run->begin (), run->end (), key_less);
+  // emit2 from the combiner appends to the new run, and counts it anew.
+  thread_context->intermediate_vec = new IntermediateVec ();
+  thread_context->memory_used = 0;
+  IntermediateVec group;
+  auto first = run->begin ();
+  while (first != run->end ())
+  {
+    auto last = first + 1;
+    while (last != run->end () && !(*(first->first) < *(last->first)))
+    {
+      ++last;
+    }
+    group.assign (first, last);
+    thread_context->job_context->combiner->combine (&group, thread_context);
+    first = last;
+  }
+  delete run;
+  size_t combined = thread_context->intermediate_vec->size ();
+  thread_context->combine_at = 2 * combined > emitted
+                               ? SIZE_MAX
+                               : std::max<size_t> (COMBINE_THRESHOLD,
+                                                   2 * combined);
+}
+
+/**
+ * Sorts the pairs of the thread, combining them if the client has a combiner.
+ */
+void sort_run (ThreadDataBlock *thread_context)
+{
+  if (thread_context->job_context->combiner != nullptr)
+  {
+    combine_run (thread_context);
+  }
+  else
+  {
+    std::sort (thread_context->intermediate_vec->begin (),
+               thread_context->intermediate_vec->end (), key_less);
+  }
+}
+
+/**
+ * Appends the sorted pairs of the thread to its spill file as a new run, and
+ * frees them.
+ */
+void spill_run (ThreadDataBlock *thread_context)
+{
+  JobDataBlock *job = thread_context->job_context;
+  IntermediateVec &run = *thread_context->intermediate_vec;
+  job->spilled.store (true);
+  if (run.empty ())
+  {
+    return;
+  }
+  if (thread_context->spill_fd < 0)
+  {
+    thread_context->spill_fd = create_spill_file ();
+  }
+
+  SpilledRun spilled;
+  spilled.begin = thread_context->spill_size;
+  std::vector<char> buffer;
+  buffer.reserve (SPILL_BUFFER_SIZE);
+  for (size_t i = 0; i < run.size (); ++i)
+  {
+    size_t size = 1 + job->serializer->size (run[i].first, run[i].second);
+    if (!buffer.empty () && buffer.size () + size > SPILL_BUFFER_SIZE)
+    {
+      write_spill (thread_context->spill_fd, buffer);
+      buffer.clear ();
+    }
+    if (i % SPILL_INDEX_STRIDE == 0)
+    {
+      spilled.index.push_back (thread_context->spill_size);
+    }
+    // the parts from emit2_alloc go back with the arena, not to destroy.
+    bool arena_key = thread_context->arena.owns (run[i].first);
+    bool arena_value = thread_context->arena.owns (run[i].second);
+    size_t at = buffer.size ();
+    buffer.resize (at + size);
+    buffer[at] = (char) ((arena_key ? SPILL_ARENA_KEY : 0)
+                         | (arena_value ? SPILL_ARENA_VALUE : 0));
+    job->serializer->serialize (run[i].first, run[i].second,
+                                buffer.data () + at + 1);
+    if (!arena_key || !arena_value)
+    {
+      job->serializer->destroy (arena_key ? nullptr : run[i].first,
+                                arena_value ? nullptr : run[i].second);
+    }
+    thread_context->spill_size += size;
+  }
+  write_spill (thread_context->spill_fd, buffer);
+  spilled.end = thread_context->spill_size;
+  thread_context->spilled_runs.push_back (spilled);
+  thread_context->spilled_pairs += run.size ();
+  run.clear ();
+  thread_context->memory_used = 0;
+}
+
+/**
+ * Creates a temporary file in $TMPDIR, or in /tmp, and unlinks it, so it is
+ * gone once closed.
+ * @return - its file descriptor.
+ */
+int create_spill_file ()
+{
+  const char *dir = getenv ("TMPDIR");
+  std::string path = dir != nullptr && *dir != '\0' ? dir : "/tmp";
+  path += "/mapreduce_spill_XXXXXX";
+  int fd = mkstemp (&path[0]);
+  if (fd < 0)
+  {
+    std::cout << "system error: spill file creation failed." << std::endl;
+    exit (1);
+  }
+  unlink (path.c_str ());
+  return fd;
+}
+
+/**
+ * Writes all of buffer at the end of the spill file fd.
+ */
+void write_spill (int fd, const std::vector<char> &buffer)
+{
+  size_t written = 0;
+  while (written < buffer.size ())
+  {
+    ssize_t ret = write (fd, buffer.data () + written,
+                         buffer.size () - written);
+    if (ret < 0)
+    {
+      std::cout << "system error: spill file write failed." << std::endl;
+      exit (1);
+    }
+    written += ret;
+  }
+}
+
+/**
+ * Maps the spill file of the thread, read only, once it has spilled all of
+ * its pairs.
+ */
+void map_spill_file (ThreadDataBlock *thread_context)
+{
+  if (thread_context->spill_size == 0)
+  {
+    return;
+  }
+  void *data = mmap (nullptr, thread_context->spill_size, PROT_READ,
+                     MAP_SHARED, thread_context->spill_fd, 0);
+  if (data == MAP_FAILED)
+  {
+    std::cout << "system error: spill file mapping failed." << std::endl;
+    exit (1);
+  }
+  thread_context->spill_data = static_cast<char *>(data);
+}
+
+/**
+ * Takes SAMPLES_PER_PARTITION keys per thread of the job, evenly spaced, from
+ * the indexed pairs of the spilled runs of the thread, reading them back.
+ */
+void sample_spilled_runs (ThreadDataBlock *thread_context)
+{
+  JobDataBlock *job = thread_context->job_context;
+  std::vector<size_t> offsets;
+  for (const SpilledRun &run : thread_context->spilled_runs)
+  {
+    offsets.insert (offsets.end (), run.index.begin (), run.index.end ());
+  }
+  size_t wanted = (size_t) SAMPLES_PER_PARTITION * job->num_of_threads;
+  size_t step = std::max<size_t> (offsets.size () / wanted, 1);
+  thread_context->samples.clear ();
+  for (size_t i = step / 2; i < offsets.size (); i += step)
+  {
+    K2 *key;
+    V2 *value;
+    job->serializer->deserialize (thread_context->spill_data + offsets[i] + 1,
+                                  &key, &value);
+    thread_context->spill_samples.emplace_back (key, value);
+    thread_context->samples.push_back (key);
+  }
+}
+
+/**
+ * Spills what the thread has left, then merges the slices of every spilled
+ * run that fall in the partition of the thread straight from the mapped
+ * spill files, reducing each group as soon as it is complete. Only one group
+ * and the next pair of every slice are in memory at a time, and the pages a
+ * slice has been read past are given back. The reduce stage counts pairs,
+ * since the number of groups is not known before they are merged.
+ */
+void reduce_spilled (ThreadDataBlock *thread_context)
+{
+  JobDataBlock *job = thread_context->job_context;
+  spill_run (thread_context);
+  map_spill_file (thread_context);
+  sample_spilled_runs (thread_context);
+  job->barrier->barrier ();
+
+  advance_stage (job, SHUFFLE_STAGE,
+                 stage_value (REDUCE_STAGE,
+                              job->total_intermediate_elems->load (), 0));
+
+  // every thread picks the same splitters from the same samples.
+  std::vector<K2 *> splitters = job_splitters (job);
+  int p = thread_context->thread_id;
+  std::vector<SpillCursor> heap;
+  for (int i = 0; i < job->num_of_threads; ++i)
+  {
+    const char *data = job->threads_data_blocks[i].spill_data;
+    for (const SpilledRun &run : job->threads_data_blocks[i].spilled_runs)
+    {
+      size_t first = run.begin;
+      size_t last = run.end;
+      if (p > 0 && !splitters.empty ())
+      {
+        first = spilled_lower_bound (job->serializer, data, run,
+                                     splitters[p - 1]);
+      }
+      if ((size_t) p < splitters.size ())
+      {
+        last = spilled_lower_bound (job->serializer, data, run, splitters[p]);
+      }
+      if (first < last)
+      {
+        heap.push_back ({data + first, data + last, data + first,
+                         IntermediatePair (), 0});
+      }
+    }
+  }
+
+  // the searches read pages all over the spill files. once every thread is
+  // done with them, each gives back the pages of its own file.
+  job->barrier->barrier ();
+  if (thread_context->spill_data != nullptr)
+  {
+    madvise (thread_context->spill_data, thread_context->spill_size,
+             MADV_DONTNEED);
+  }
+  for (SpillCursor &cursor : heap)
+  {
+    read_spilled_pair (job->serializer, &cursor);
+  }
+  std::make_heap (heap.begin (), heap.end (), cursor_greater);
+
+  IntermediateVec group;
+  std::vector<char> group_arena;
+  while (!heap.empty ())
+  {
+    group.clear ();
+    group_arena.clear ();
+    do
+    {
+      group.push_back (heap.front ().head);
+      group_arena.push_back (heap.front ().head_arena);
+      std::pop_heap (heap.begin (), heap.end (), cursor_greater);
+      if (read_spilled_pair (job->serializer, &heap.back ()))
+      {
+        std::push_heap (heap.begin (), heap.end (), cursor_greater);
+      }
+      else
+      {
+        heap.pop_back ();
+      }
+    }
+    while (!heap.empty ()
+           && !(*(group.front ().first) < *(heap.front ().head.first)));
+    job->client->reduce (&group, thread_context);
+    for (size_t i = 0; i < group.size (); ++i)
+    {
+      destroy_arena_parts (job->serializer, group[i], group_arena[i]);
+    }
+    (*(job->job_state)) += group.size ();
+  }
+}
+
+/**
+ * Finds the first pair of a spilled run whose key is not less than bound, by
+ * a binary search of the index of the run and a scan of one stride of it.
+ * @return - the offset of the pair in the spill file, or the end of the run.
+ */
+size_t spilled_lower_bound (const MapReduceSerializer *serializer,
+                            const char *data, const SpilledRun &run,
+                            const K2 *bound)
+{
+  size_t size;
+  size_t low = 0;
+  size_t high = run.index.size ();
+  while (low < high)
+  {
+    size_t middle = (low + high) / 2;
+    if (spilled_key_less (serializer, data + run.index[middle], bound, &size))
+    {
+      low = middle + 1;
+    }
+    else
+    {
+      high = middle;
+    }
+  }
+  if (low == 0)
+  {
+    return run.begin;
+  }
+  size_t offset = run.index[low - 1];
+  size_t end = low < run.index.size () ? run.index[low] : run.end;
+  while (offset < end
+         && spilled_key_less (serializer, data + offset, bound, &size))
+  {
+    offset += size;
+  }
+  return offset;
+}
+
+/**
+ * Reads back the spilled pair at at, compares its key to bound and frees it.
+ * @return - whether the key is less than bound. size is set to the bytes of
+ * the pair.
+ */
+bool spilled_key_less (const MapReduceSerializer *serializer, const char *at,
+                       const K2 *bound, size_t *size)
+{
+  K2 *key;
+  V2 *value;
+  *size = 1 + serializer->deserialize (at + 1, &key, &value);
+  bool less = *key < *bound;
+  serializer->destroy (key, value);
+  return less;
+}
+
+/**
+ * Reads the next pair of the slice of cursor into its head, giving back the
+ * pages behind it once SPILL_RELEASE_SIZE bytes of them are read, and when
+ * the slice is exhausted.
+ * @return - false when the slice is exhausted.
+ */
+bool read_spilled_pair (const MapReduceSerializer *serializer,
+                        SpillCursor *cursor)
+{
+  bool exhausted = cursor->next >= cursor->end;
+  if (!exhausted)
+  {
+    cursor->head_arena = *cursor->next;
+    cursor->next += 1 + serializer->deserialize (cursor->next + 1,
+                                                 &cursor->head.first,
+                                                 &cursor->head.second);
+  }
+  if (exhausted || cursor->next - cursor->kept >= SPILL_RELEASE_SIZE)
+  {
+    // the pages stay in the file, and are read again should another slice
+    // on them need them.
+    uintptr_t page_size = sysconf (_SC_PAGESIZE);
+    uintptr_t from = (uintptr_t) cursor->kept & ~(page_size - 1);
+    uintptr_t to = (uintptr_t) cursor->next & ~(page_size - 1);
+    madvise ((void *) from, to - from, MADV_DONTNEED);
+    cursor->kept = (const char *) to;
+  }
+  return !exhausted;
+}
+
+/**
+ * Frees the parts of a pair read back from a spill file that were spilled
+ * from emit2_alloc memory, once reduce is done with it. Reduce never frees
+ * those, as it would not have freed the originals.
+ */
+void destroy_arena_parts (const MapReduceSerializer *serializer,
+                          const IntermediatePair &pair, char arena)
+{
+  if (arena != 0)
+  {
+    serializer->destroy ((arena & SPILL_ARENA_KEY) ? pair.first : nullptr,
+                         (arena & SPILL_ARENA_VALUE) ? pair.second : nullptr);
+  }
+}
+
+/**
+ * Orders cursors by their heads, the greatest key first, for a min-heap.
+ */
+bool cursor_greater (const SpillCursor &c1, const SpillCursor &c2)
+{
+  return *(c2.head.first) < *(c1.head.first);
+}
+
+/**
+ * Orders output pairs by their keys.
+ */
+bool output_less (const OutputPair &p1, const OutputPair &p2)
+{
+  return *(p1.first) < *(p2.first);
+}
@@ -2,8 +2,10 @@
 #define MAPREDUCEFRAMEWORK_H
 
 #include "MapReduceClient.h"
+#include <cstddef>
 
 typedef void* JobHandle;
+typedef void* RuntimeHandle;
 
 enum stage_t {UNDEFINED_STAGE=0, MAP_STAGE=1, SHUFFLE_STAGE=2, REDUCE_STAGE=3};
 
@@ -12,9 +14,39 @@ typedef struct {
 	float percentage;
 } JobState;
 
+// how startMapReduceJobConfig runs a job.
+typedef struct {
+	// the number of threads of the job, ignored when runtime is set.
+	int multiThreadLevel;
+	// the runtime to run on, or null for the shared one.
+	RuntimeHandle runtime;
+	// appends the output to outputVec ordered by K3, instead of in the
+	// order of the threads that emitted it.
+	bool orderOutput;
+	// the bytes of intermediate pairs the threads of the job may hold in
+	// memory, split evenly between them, or 0 for no limit. a pair counts
+	// sizeof(IntermediatePair) plus the size serializer gives it. a thread
+	// over its share sorts its pairs and spills them to a temporary file,
+	// and the job then shuffles and reduces from the files. pairs from
+	// emit2_alloc may be spilled too, see MapReduceSerializer::destroy.
+	size_t memoryBudget;
+	// what spills the pairs, required with a memoryBudget: a job with a
+	// memoryBudget and no serializer does not start, see
+	// startMapReduceJobConfig.
+	const MapReduceSerializer* serializer;
+} JobConfig;
+
 void emit2 (K2* key, V2* value, void* context);
 void emit3 (K3* key, V3* value, void* context);
 
+// allocates size bytes from the arena of the calling thread, for a K2 or V2
+// built with placement new and passed to emit2. context is the one map,
+// combine or reduce got. the memory is freed all at once by closeJobHandle,
+// so such pairs must not be deleted and their destructors never run. a job
+// that spills them never deletes them either, but reduce then gets copies
+// read back from disk, which live only until reduce returns.
+void* emit2_alloc (size_t size, void* context);
+
 JobHandle startMapReduceJob(const MapReduceClient& client,
 	const InputVec& inputVec, OutputVec& outputVec,
 	int multiThreadLevel);
@@ -22,6 +54,44 @@ JobHandle startMapReduceJob(const MapReduceClient& client,
 void waitForJob(JobHandle job);
 void getJobState(JobHandle job, JobState* state);
 void closeJobHandle(JobHandle job);
+
+// a pool of numThreads long-lived worker threads that run the jobs started
+// on it one after the other, so a job costs no thread creation.
+// startMapReduceJob runs its jobs on a shared runtime of its own, which grows
+// to as many workers as the jobs running at once need. it never shrinks and
+// its workers are never joined: they stay, idle, after the jobs are closed,
+// until the process exits.
+RuntimeHandle createMapReduceRuntime(int numThreads);
+
+// starts a job that runs on all the workers of runtime.
+JobHandle startMapReduceJobOn(RuntimeHandle runtime,
+	const MapReduceClient& client,
+	const InputVec& inputVec, OutputVec& outputVec);
+
+// starts a job as config says. returns null, and starts nothing, when config
+// is not valid. waitForJob, getJobState and closeJobHandle take null as a job
+// that never started.
+JobHandle startMapReduceJobConfig(const MapReduceClient& client,
+	const InputVec& inputVec, OutputVec& outputVec,
+	const JobConfig* config);
+
+// starts a job whose threads pull their input from source as they map, as
+// config says, so mapping starts before the input is all read and the input
+// in memory is a chunk per thread. the source must outlive the job. returns
+// null when config is not valid, as startMapReduceJobConfig does.
+JobHandle startMapReduceJobSource(const MapReduceClient& client,
+	InputSource& source, OutputVec& outputVec,
+	const JobConfig* config);
+
+// runs routine(arg, threadId) on numThreads workers of the shared runtime at
+// once, threadId going from 0 to numThreads - 1, and returns when all are
+// done. what the jobs of MapReduceJob.h run on.
+void runOnWorkers(int numThreads, void (*routine)(void* arg, int threadId),
+	void* arg);
+
+// waits for every job started on runtime to finish and ends its workers.
+// the handles of those jobs stay valid until they are closed.
+void closeMapReduceRuntime(RuntimeHandle runtime);
 	
 	
 #endif //MAPREDUCEFRAMEWORK_H
@@ -0,0 +1,250 @@
+#ifndef MAPREDUCEJOB_H
+#define MAPREDUCEJOB_H
+
+#include "MapReduceFramework.h"
+#include "Barrier.h"
+#include "MapReduceCore.h"
+#include <algorithm>
+#include <functional>
+#include <utility>
+#include <vector>
+
+/*
+ * A statically typed MapReduce, header only. A client is any class with the
+ * typedefs K1, V1, K2, V2, K3 and V3, which name plain value types, and the
+ * const member templates
+ *      template <typename Context>
+ *      void map (const K1 &key, const V1 &value, Context &context) const;
+ *      template <typename Context>
+ *      void reduce (const std::pair<K2, V2> *first,
+ *                   const std::pair<K2, V2> *last, Context &context) const;
+ * map calls context.emit (K2, V2) any number of times. reduce gets the pairs
+ * of one key, contiguous and in [first, last), and calls context.emit (K3, V3).
+ * Pairs are stored inline in vectors, intermediate keys are ordered by Compare
+ * and output keys by OutputCompare, so sorting and merging them makes no
+ * virtual call and follows no pointer. The shuffle and the output run the
+ * same code as the classic API, see MapReduceCore.h.
+ * K3 and V3 must be default constructible, since the output is placed in
+ * parallel into a resized output vector.
+ * The threads of a job are workers of the shared runtime, see runOnWorkers.
+ * The classic MapReduceClient API of MapReduceFramework.h stays as it is.
+ */
+template <typename Client, typename Compare = std::less<typename Client::K2>,
+          typename OutputCompare = std::less<typename Client::K3> >
+class MapReduceJob
+{
+ public:
+  typedef typename Client::K1 K1;
+  typedef typename Client::V1 V1;
+  typedef typename Client::K2 K2;
+  typedef typename Client::V2 V2;
+  typedef typename Client::K3 K3;
+  typedef typename Client::V3 V3;
+  typedef std::pair<K1, V1> InputPair;
+  typedef std::pair<K2, V2> IntermediatePair;
+  typedef std::pair<K3, V3> OutputPair;
+  typedef std::vector<InputPair> InputVec;
+  typedef std::vector<OutputPair> OutputVec;
+
+  // what map gets to emit with.
+  class MapContext
+  {
+   public:
+    void emit (K2 key, V2 value)
+    {
+      run->emplace_back (std::move (key), std::move (value));
+    }
+
+   private:
+    friend class MapReduceJob;
+    std::vector<IntermediatePair> *run;
+  };
+
+  // what reduce gets to emit with.
+  class ReduceContext
+  {
+   public:
+    void emit (K3 key, V3 value)
+    {
+      output->emplace_back (std::move (key), std::move (value));
+    }
+
+   private:
+    friend class MapReduceJob;
+    OutputVec *output;
+  };
+
+  // a job of client on numThreads threads. orderOutput orders the output by
+  // outputCompare, instead of leaving it in the order of the threads that
+  // emitted it.
+  MapReduceJob (const Client &client, int numThreads,
+                bool orderOutput = false, Compare compare = Compare (),
+                OutputCompare outputCompare = OutputCompare ()) :
+      client (client),
+      num_threads (numThreads),
+      order_output (orderOutput),
+      pair_less (compare),
+      output_less (outputCompare),
+      input (nullptr),
+      output (nullptr),
+      output_base (0),
+      barrier (nullptr),
+      map_ranges (nullptr)
+  {}
+
+  // runs the job over input, appends its output to output and returns when
+  // the job is done. a job may be run again, but not twice at once.
+  void run (const InputVec &inputVec, OutputVec &outputVec)
+  {
+    Barrier job_barrier (num_threads);
+    input = &inputVec;
+    output = &outputVec;
+    barrier = &job_barrier;
+    map_ranges = new mapreduce::detail::MapRange[num_threads];
+    mapreduce::detail::init_map_ranges (map_ranges, num_threads,
+                                        inputVec.size ());
+    threads.clear ();
+    threads.resize (num_threads);
+    runOnWorkers (num_threads, &thread_routine, this);
+    threads.clear ();
+    delete[] map_ranges;
+    map_ranges = nullptr;
+    barrier = nullptr;
+  }
+
+ private:
+  // orders pairs by their keys, with the order of the keys at hand, for the
+  // sorts and the merges.
+  template <typename Pair, typename KeyCompare>
+  struct PairLess
+  {
+      explicit PairLess (KeyCompare compare) : compare (compare)
+      {}
+
+      bool operator() (const Pair &p1, const Pair &p2) const
+      {
+        return compare (p1.first, p2.first);
+      }
+
+      KeyCompare compare;
+  };
+
+  typedef PairLess<IntermediatePair, Compare> IntermediateLess;
+  typedef PairLess<OutputPair, OutputCompare> OutputLess;
+
+  struct ThreadState
+  {
+    // the sorted pairs the thread emitted in map.
+    std::vector<IntermediatePair> run;
+    std::vector<K2> samples;
+    // the pairs of the partition, merged, and where each group of equal keys
+    // in it ends.
+    std::vector<IntermediatePair> partition;
+    std::vector<size_t> group_ends;
+    OutputVec output;
+  };
+
+  static void thread_routine (void *arg, int thread_id)
+  {
+    static_cast<MapReduceJob *>(arg)->run_thread (thread_id);
+  }
+
+  void run_thread (int thread_id)
+  {
+    ThreadState &self = threads[thread_id];
+
+    // running Map
+    MapContext map_context;
+    map_context.run = &self.run;
+    unsigned long first;
+    unsigned long last;
+    while (mapreduce::detail::claim_map_chunk (map_ranges, num_threads,
+                                               thread_id, &first, &last))
+    {
+      for (unsigned long i = first; i < last; ++i)
+      {
+        client.map ((*input)[i].first, (*input)[i].second, map_context);
+      }
+    }
+
+    // running Sort
+    std::sort (self.run.begin (), self.run.end (), pair_less);
+    mapreduce::detail::sample_run (self.run, num_threads, self.samples);
+    barrier->barrier ();
+
+    // running Shuffle. the runs are only read until every thread has found
+    // its slices, and only merged from after that.
+    std::vector<K2> splitters = mapreduce::detail::choose_splitters<K2> (
+        num_threads, [this] (int i) -> const std::vector<K2> &
+        {
+            return threads[i].samples;
+        }, pair_less.compare);
+    mapreduce::detail::RunMerger<IntermediatePair, IntermediateLess> merger (
+        pair_less);
+    size_t total = 0;
+    for (ThreadState &thread : threads)
+    {
+      IntermediatePair *run_first = thread.run.data ();
+      IntermediatePair *run_last = thread.run.data () + thread.run.size ();
+      mapreduce::detail::partition_slice (&run_first, &run_last, splitters,
+                                          thread_id, pair_less.compare);
+      merger.add_run (run_first, run_last);
+      total += run_last - run_first;
+    }
+    barrier->barrier ();
+    self.partition.reserve (total);
+    mapreduce::detail::merge_groups (merger, self.partition, self.group_ends,
+                                     [] (size_t)
+                                     {});
+
+    // running Reduce
+    ReduceContext reduce_context;
+    reduce_context.output = &self.output;
+    size_t group_begin = 0;
+    for (size_t group_end : self.group_ends)
+    {
+      client.reduce (self.partition.data () + group_begin,
+                     self.partition.data () + group_end, reduce_context);
+      group_begin = group_end;
+    }
+
+    // running Output
+    if (order_output)
+    {
+      std::sort (self.output.begin (), self.output.end (), output_less);
+    }
+    auto output_of = [this] (int i) -> OutputVec &
+    {
+        return threads[i].output;
+    };
+    barrier->barrier ();
+    if (thread_id == 0)
+    {
+      output_base = mapreduce::detail::gather_output (
+          num_threads, output_of, *output, order_output, output_less);
+    }
+    if (!order_output)
+    {
+      barrier->barrier ();
+      mapreduce::detail::place_output (thread_id, output_base, output_of,
+                                       *output);
+    }
+  }
+
+  const Client &client;
+  int num_threads;
+  bool order_output;
+  IntermediateLess pair_less;
+  OutputLess output_less;
+
+  const InputVec *input;
+  OutputVec *output;
+  // the size of output before the job appended to it.
+  size_t output_base;
+  Barrier *barrier;
+  std::vector<ThreadState> threads;
+  // one range of input per thread, see mapreduce::detail::MapRange.
+  mapreduce::detail::MapRange *map_ranges;
+};
+
+#endif //MAPREDUCEJOB_H
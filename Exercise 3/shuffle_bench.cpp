@@ -0,0 +1,271 @@
+// OS 24 EX3
+
+#include <cstdlib>
+#include <cstdint>
+#include <ctime>
+#include <iostream>
+#include <algorithm>
+#include <cstring>
+#include <new>
+#include <random>
+#include <sched.h>
+#include "MapReduceFramework.h"
+#include "MapReduceJob.h"
+
+#define DEFAULT_KEYS 1000000
+
+/*
+ * Every input pair maps to one pair of an int key, so a job with keys keys
+ * and copies copies of each shuffles keys * copies pairs into keys groups.
+ * The reduce does nothing but free the keys, so the job time beyond map and
+ * sort is the shuffle. template_job runs the same job through MapReduceJob,
+ * with the keys stored inline. spill_job runs it with keys from emit2_alloc
+ * and a memory budget of a quarter of its pairs, so every pair is spilled.
+ */
+
+class IntKey : public K2
+{
+ public:
+  explicit IntKey (int value) : value (value)
+  {}
+
+  bool operator< (const K2 &other) const override
+  {
+    return value < static_cast<const IntKey &>(other).value;
+  }
+
+  int value;
+};
+
+class IntValue : public V1
+{
+ public:
+  explicit IntValue (int value) : value (value)
+  {}
+
+  int value;
+};
+
+class BenchClient : public MapReduceClient
+{
+ public:
+  void map (const K1 *key, const V1 *value, void *context) const override
+  {
+    emit2 (new IntKey (static_cast<const IntValue *>(value)->value), nullptr,
+           context);
+  }
+
+  void reduce (const IntermediateVec *pairs, void *context) const override
+  {
+    for (const IntermediatePair &pair : *pairs)
+    {
+      delete pair.first;
+    }
+  }
+};
+
+class ArenaClient : public MapReduceClient
+{
+ public:
+  void map (const K1 *key, const V1 *value, void *context) const override
+  {
+    void *memory = emit2_alloc (sizeof (IntKey), context);
+    emit2 (new (memory) IntKey (static_cast<const IntValue *>(value)->value),
+           nullptr, context);
+  }
+
+  // the keys are from emit2_alloc, or copies the framework frees.
+  void reduce (const IntermediateVec *pairs, void *context) const override
+  {}
+};
+
+class IntKeySerializer : public MapReduceSerializer
+{
+ public:
+  size_t size (const K2 *key, const V2 *value) const override
+  {
+    return sizeof (int);
+  }
+
+  void serialize (const K2 *key, const V2 *value, char *buffer) const override
+  {
+    memcpy (buffer, &static_cast<const IntKey *>(key)->value, sizeof (int));
+  }
+
+  size_t deserialize (const char *buffer, K2 **key,
+                      V2 **value) const override
+  {
+    int key_value;
+    memcpy (&key_value, buffer, sizeof (int));
+    *key = new IntKey (key_value);
+    *value = nullptr;
+    return sizeof (int);
+  }
+};
+
+class TemplateClient
+{
+ public:
+  typedef int K1;
+  typedef int V1;
+  typedef int K2;
+  typedef char V2;
+  typedef int K3;
+  typedef int V3;
+
+  template <typename Context>
+  void map (const int &key, const int &value, Context &context) const
+  {
+    context.emit (value, 0);
+  }
+
+  template <typename Context>
+  void reduce (const std::pair<int, char> *first,
+               const std::pair<int, char> *last, Context &context) const
+  {}
+};
+
+/**
+ * Reads the monotonic clock.
+ * @return - the current time in nano-seconds.
+ */
+uint64_t now_ns ()
+{
+  struct timespec t;
+  clock_gettime (CLOCK_MONOTONIC, &t);
+  return (uint64_t) t.tv_sec * 1000000000ULL + (uint64_t) t.tv_nsec;
+}
+
+/**
+ * Prints one CSV row.
+ */
+void report (const char *bench, int threads, long pairs, double value,
+             const char *unit)
+{
+  std::cout << bench << "," << threads << "," << pairs << "," << value << ","
+            << unit << std::endl;
+}
+
+/**
+ * Runs one job on threads threads, watching its stage to time the shuffle.
+ */
+void run_job (const BenchClient &client, const InputVec &input, int threads)
+{
+  OutputVec output;
+  uint64_t start = now_ns ();
+  JobHandle job = startMapReduceJob (client, input, output, threads);
+  uint64_t shuffle_start = 0;
+  uint64_t shuffle_end = 0;
+  JobState state = {UNDEFINED_STAGE, 0};
+  while (state.stage != REDUCE_STAGE)
+  {
+    sched_yield ();
+    getJobState (job, &state);
+    if (state.stage == SHUFFLE_STAGE && shuffle_start == 0)
+    {
+      shuffle_start = now_ns ();
+    }
+  }
+  shuffle_end = now_ns ();
+  if (shuffle_start == 0)
+  {
+    // the shuffle ended between two looks at the stage.
+    shuffle_start = shuffle_end;
+  }
+  closeJobHandle (job);
+  uint64_t end = now_ns ();
+  report ("shuffle", threads, (long) input.size (),
+          (double) (shuffle_end - shuffle_start) / 1000000, "ms");
+  report ("job", threads, (long) input.size (),
+          (double) (end - start) / 1000000, "ms");
+}
+
+/**
+ * Runs the job of run_job through MapReduceJob, which has no stages to watch.
+ */
+void run_template_job (const MapReduceJob<TemplateClient>::InputVec &input,
+                       int threads)
+{
+  TemplateClient client;
+  MapReduceJob<TemplateClient> job (client, threads);
+  MapReduceJob<TemplateClient>::OutputVec output;
+  uint64_t start = now_ns ();
+  job.run (input, output);
+  uint64_t end = now_ns ();
+  report ("template_job", threads, (long) input.size (),
+          (double) (end - start) / 1000000, "ms");
+}
+
+/**
+ * Runs the job of run_job with keys from emit2_alloc, spilling all its pairs.
+ */
+void run_spill_job (const InputVec &input, int threads)
+{
+  ArenaClient client;
+  IntKeySerializer serializer;
+  JobConfig config = {};
+  config.multiThreadLevel = threads;
+  config.memoryBudget = input.size () * (sizeof (IntermediatePair)
+                                         + sizeof (int)) / 4;
+  config.serializer = &serializer;
+  OutputVec output;
+  uint64_t start = now_ns ();
+  JobHandle job = startMapReduceJobConfig (client, input, output, &config);
+  closeJobHandle (job);
+  uint64_t end = now_ns ();
+  report ("spill_job", threads, (long) input.size (),
+          (double) (end - start) / 1000000, "ms");
+}
+
+/**
+ * Times the shuffle of a job over many distinct keys for growing numbers of
+ * threads. With one sorted run per thread, the merge of each partition costs
+ * O(log threads) key comparisons per pair. Also times the whole job with the
+ * virtual API, with MapReduceJob and spilled to disk.
+ * Usage: './shuffle_bench [keys] [copies]' where:
+ *      - keys - the number of distinct keys (default 1000000).
+ *      - copies - how many pairs every key has (default 1).
+ * The program will print output to stdout in the following format:
+ *      benchmark,threads,pairs,value,unit
+ *      benchmark_1,threads_1,pairs_1,value_1,unit_1
+ *              ...
+ */
+int main (int argc, char *argv[])
+{
+  long keys = argc > 1 ? atol (argv[1]) : DEFAULT_KEYS;
+  long copies = argc > 2 ? atol (argv[2]) : 1;
+  if (keys <= 0 || copies <= 0)
+  {
+    std::cerr << "keys and copies must be positive" << std::endl;
+    return -1;
+  }
+
+  InputVec input;
+  for (long i = 0; i < keys * copies; i++)
+  {
+    input.emplace_back (nullptr, new IntValue ((int) (i % keys)));
+  }
+  std::shuffle (input.begin (), input.end (), std::mt19937 (1));
+
+  MapReduceJob<TemplateClient>::InputVec template_input;
+  for (const InputPair &pair : input)
+  {
+    template_input.emplace_back (0,
+                                 static_cast<IntValue *>(pair.second)->value);
+  }
+
+  BenchClient client;
+  std::cout << "benchmark,threads,pairs,value,unit" << std::endl;
+  const int thread_counts[] = {1, 2, 4, 8, 16};
+  for (int threads: thread_counts)
+  {
+    run_job (client, input, threads);
+    run_template_job (template_input, threads);
+    run_spill_job (input, threads);
+  }
+  for (const InputPair &pair : input)
+  {
+    delete pair.second;
+  }
+  return 0;
+}